@@ -1,6 +1,7 @@
 ﻿#include <iostream>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 #include <boost/json.hpp>
 #include "bserv/common.hpp"
@@ -8,6 +9,21 @@
 #include "rendering.h"
 #include "handlers.h"
 
+// whether `/metrics` and `/trace` are served ("metrics-routes" in the
+// config). they are off by default, as anyone who can reach the server
+// could read them.
+bool metrics_routes = false;
+
+std::nullopt_t metrics_page(bserv::response_type& response) {
+	if (!metrics_routes) throw bserv::url_not_found_exception{};
+	return bserv::serve_metrics(response);
+}
+
+std::nullopt_t trace_page(bserv::response_type& response) {
+	if (!metrics_routes) throw bserv::url_not_found_exception{};
+	return bserv::serve_trace(response);
+}
+
 void show_usage(const bserv::server_config& config) {
 	std::cout << "Usage: " << config.get_name() << " [config.json]\n"
 		<< config.get_name() << " is a C++ HTTP server.\n\n"
@@ -20,10 +36,46 @@ void show_config(const bserv::server_config& config) {
 	std::cout << config.get_name() << " config:"
 		<< "\nport: " << config.get_port()
 		<< "\nthreads: " << config.get_num_threads()
+		<< "\nper-core: " << config.get_per_core()
+		<< "\nstack-size: " << config.get_stack_size() / 1024 << "K"
+		<< "\npayload-limit: " << config.get_payload_limit() / 1024 << "K"
+		<< "\nheader-timeout: " << config.get_header_timeout()
+		<< "\nbody-timeout: " << config.get_body_timeout()
+		<< "\nhandler-timeout: " << config.get_handler_timeout()
+		<< "\nidle-timeout: " << config.get_idle_timeout()
+		<< "\nwrite-timeout: " << config.get_write_timeout()
+		<< "\nclient-timeout: " << config.get_client_timeout()
+		<< "\nkeep-alive-requests: " << config.get_keep_alive_requests()
+		<< "\ndrain-timeout: " << config.get_drain_timeout()
+		<< "\nhandoff-path: " << config.get_handoff_path()
+		<< "\nmax-connections: " << config.get_max_connections()
+		<< "\nmax-in-flight: " << config.get_max_in_flight()
+		<< "\nqueue-target: " << config.get_queue_target() << "ms"
+		<< "\nqueue-interval: " << config.get_queue_interval() << "ms"
+		<< "\ncompute-threads: " << config.get_num_compute_threads()
 		<< "\nrotation: " << config.get_log_rotation_size() / 1024 / 1024
 		<< "\nlog path: " << config.get_log_path()
+		<< "\nlog-level: " << config.get_log_level()
+		<< "\nlog-drop: " << config.get_log_drop()
+		<< "\ntrace-buffer-size: " << config.get_trace_buffer_size()
+		<< "\ntrace-path: " << config.get_trace_path()
+		<< "\nmetrics-routes: " << metrics_routes
+		<< "\naccess-log-path: " << config.get_access_log_path()
+		<< "\naccess-log-sample: " << config.get_access_log_sample()
+		<< "\nsession-expiry: " << config.get_session_expiry_time()
+		<< "\nsession-backend: " << config.get_session_backend()
+		<< "\nsession-revalidate: " << config.get_session_revalidate_time() << "ms"
 		<< "\ndb-conn: " << config.get_num_db_conn()
-		<< "\nconn-str: " << config.get_db_conn_str() << std::endl;
+		<< "\nconn-str: " << config.get_db_conn_str()
+		<< "\ndb-backend: " << config.get_db_backend()
+		<< "\ndb-file: " << config.get_db_file_path()
+		<< "\ndb-latency: " << config.get_db_latency() << "us"
+		<< "\nreplica-conn-strs:";
+	for (const std::string& conn_str : config.get_db_replica_conn_strs())
+		std::cout << "\n  " << conn_str;
+	std::cout
+		<< "\nreplica-conn-num: " << config.get_num_replica_db_conn()
+		<< "\nread-your-writes: " << config.get_read_your_writes() << "ms" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -42,12 +94,86 @@ int main(int argc, char* argv[]) {
 				config.set_port((unsigned short)config_obj["port"].as_int64());
 			if (config_obj.contains("thread-num"))
 				config.set_num_threads((int)config_obj["thread-num"].as_int64());
+			if (config_obj.contains("per-core"))
+				config.set_per_core(config_obj["per-core"].as_bool());
+			if (config_obj.contains("stack-size"))
+				config.set_stack_size((std::size_t)config_obj["stack-size"].as_int64());
+			if (config_obj.contains("payload-limit"))
+				config.set_payload_limit((std::size_t)config_obj["payload-limit"].as_int64());
+			if (config_obj.contains("header-timeout"))
+				config.set_header_timeout((int)config_obj["header-timeout"].as_int64());
+			if (config_obj.contains("body-timeout"))
+				config.set_body_timeout((int)config_obj["body-timeout"].as_int64());
+			if (config_obj.contains("handler-timeout"))
+				config.set_handler_timeout((int)config_obj["handler-timeout"].as_int64());
+			if (config_obj.contains("idle-timeout"))
+				config.set_idle_timeout((int)config_obj["idle-timeout"].as_int64());
+			if (config_obj.contains("write-timeout"))
+				config.set_write_timeout((int)config_obj["write-timeout"].as_int64());
+			if (config_obj.contains("client-timeout"))
+				config.set_client_timeout((int)config_obj["client-timeout"].as_int64());
+			if (config_obj.contains("keep-alive-requests"))
+				config.set_keep_alive_requests((int)config_obj["keep-alive-requests"].as_int64());
+			if (config_obj.contains("drain-timeout"))
+				config.set_drain_timeout((int)config_obj["drain-timeout"].as_int64());
+			if (config_obj.contains("handoff-path"))
+				config.set_handoff_path(std::string{ config_obj["handoff-path"].as_string() });
+			if (config_obj.contains("max-connections"))
+				config.set_max_connections((std::size_t)config_obj["max-connections"].as_int64());
+			if (config_obj.contains("max-in-flight"))
+				config.set_max_in_flight((std::size_t)config_obj["max-in-flight"].as_int64());
+			if (config_obj.contains("queue-target"))
+				config.set_queue_target((int)config_obj["queue-target"].as_int64());
+			if (config_obj.contains("queue-interval"))
+				config.set_queue_interval((int)config_obj["queue-interval"].as_int64());
+			if (config_obj.contains("compute-thread-num"))
+				config.set_num_compute_threads((int)config_obj["compute-thread-num"].as_int64());
 			if (config_obj.contains("conn-num"))
 				config.set_num_db_conn((int)config_obj["conn-num"].as_int64());
 			if (config_obj.contains("conn-str"))
 				config.set_db_conn_str(config_obj["conn-str"].as_string().c_str());
+			if (config_obj.contains("db-backend"))
+				config.set_db_backend(std::string{ config_obj["db-backend"].as_string() });
+			if (config_obj.contains("db-file"))
+				config.set_db_file_path(std::string{ config_obj["db-file"].as_string() });
+			if (config_obj.contains("db-latency"))
+				config.set_db_latency((int)config_obj["db-latency"].as_int64());
+			if (config_obj.contains("replica-conn-strs")) {
+				std::vector<std::string> conn_strs;
+				for (const auto& conn_str : config_obj["replica-conn-strs"].as_array())
+					conn_strs.emplace_back(conn_str.as_string().c_str());
+				config.set_db_replica_conn_strs(std::move(conn_strs));
+			}
+			if (config_obj.contains("replica-conn-num"))
+				config.set_num_replica_db_conn((int)config_obj["replica-conn-num"].as_int64());
+			if (config_obj.contains("read-your-writes"))
+				config.set_read_your_writes((int)config_obj["read-your-writes"].as_int64());
+			if (config_obj.contains("session-expiry"))
+				config.set_session_expiry_time((int)config_obj["session-expiry"].as_int64());
+			if (config_obj.contains("session-backend"))
+				config.set_session_backend(std::string{ config_obj["session-backend"].as_string() });
+			if (config_obj.contains("session-file"))
+				config.set_session_file_path(std::string{ config_obj["session-file"].as_string() });
+			if (config_obj.contains("session-conn-num"))
+				config.set_num_session_db_conn((int)config_obj["session-conn-num"].as_int64());
+			if (config_obj.contains("session-revalidate"))
+				config.set_session_revalidate_time((int)config_obj["session-revalidate"].as_int64());
 			if (config_obj.contains("log-dir"))
 				config.set_log_path(std::string{ config_obj["log-dir"].as_string() });
+			if (config_obj.contains("log-level"))
+				config.set_log_level(std::string{ config_obj["log-level"].as_string() });
+			if (config_obj.contains("log-drop"))
+				config.set_log_drop(config_obj["log-drop"].as_bool());
+			if (config_obj.contains("trace-buffer-size"))
+				config.set_trace_buffer_size((std::size_t)config_obj["trace-buffer-size"].as_int64());
+			if (config_obj.contains("trace-path"))
+				config.set_trace_path(std::string{ config_obj["trace-path"].as_string() });
+			if (config_obj.contains("metrics-routes"))
+				metrics_routes = config_obj["metrics-routes"].as_bool();
+			if (config_obj.contains("access-log-path"))
+				config.set_access_log_path(std::string{ config_obj["access-log-path"].as_string() });
+			if (config_obj.contains("access-log-sample"))
+				config.set_access_log_sample((int)config_obj["access-log-sample"].as_int64());
 			if (!config_obj.contains("template_root")) {
 				std::cerr << "`template_root` must be specified" << std::endl;
 				return EXIT_FAILURE;
@@ -71,15 +197,23 @@ int main(int argc, char* argv[]) {
 		bserv::make_path("/hello", &hello,
 			bserv::placeholders::response,
 			bserv::placeholders::session),
+		// Prometheus metrics (if "metrics-routes" is enabled)
+		bserv::make_path("/metrics", &metrics_page,
+			bserv::placeholders::response),
+		// the spans of the recent requests (chrome://tracing)
+		bserv::make_path("/trace", &trace_page,
+			bserv::placeholders::response),
 		bserv::make_path("/register", &user_register,
 			bserv::placeholders::request,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr),
+			bserv::placeholders::db_connection_mgr,
+			bserv::placeholders::offloader_ptr),
 		bserv::make_path("/login", &user_login,
 			bserv::placeholders::request,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
-			bserv::placeholders::session),
+			bserv::placeholders::db_connection_mgr,
+			bserv::placeholders::session,
+			bserv::placeholders::offloader_ptr),
 		bserv::make_path("/logout", &user_logout,
 			bserv::placeholders::session),
 		bserv::make_path("/find/<str>", &find_user,
@@ -105,69 +239,71 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
-			bserv::placeholders::session),
+			bserv::placeholders::db_connection_mgr,
+			bserv::placeholders::session,
+			bserv::placeholders::offloader_ptr),
 		bserv::make_path("/form_logout", &form_logout,
 			bserv::placeholders::session,
 			bserv::placeholders::response),
+		// the pages which only read use the read replicas (if any)
 		bserv::make_path("/users", &view_users,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/users/<int>", &view_users,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/list", &view_list,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			std::string{"1"}),
 		bserv::make_path("/collection", &view_collection,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
 			std::string{"1"}),
 		bserv::make_path("/collection/<int>", &view_collection,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
 			bserv::placeholders::_1),
 		bserv::make_path("/rec", &view_rec,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
 			std::string{"1"}),
 		bserv::make_path("/rec/<int>", &view_rec,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
 			bserv::placeholders::_1),
 		bserv::make_path("/list/<int>", &view_list,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::_1),
 		bserv::make_path("/list/language", &view_language,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
 			std::string{"1"}),
 		bserv::make_path("/list/search", &view_search,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
 			std::string{"1"}),
 		bserv::make_path("/list/searchs", &view_searchs,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
@@ -177,10 +313,10 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session),
 		bserv::make_path("/list/singer", &view_singer,
-			bserv::placeholders::db_connection_ptr,
+			bserv::placeholders::db_read_connection_ptr,
 			bserv::placeholders::session,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
@@ -190,8 +326,9 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
-			bserv::placeholders::session),
+			bserv::placeholders::db_connection_mgr,
+			bserv::placeholders::session,
+			bserv::placeholders::offloader_ptr),
 		bserv::make_path("/form_add_list", &form_add_list,
 			bserv::placeholders::request,
 			bserv::placeholders::response,
@@ -208,8 +345,9 @@ int main(int argc, char* argv[]) {
 			bserv::placeholders::request,
 			bserv::placeholders::response,
 			bserv::placeholders::json_params,
-			bserv::placeholders::db_connection_ptr,
-			bserv::placeholders::session),
+			bserv::placeholders::db_connection_mgr,
+			bserv::placeholders::session,
+			bserv::placeholders::offloader_ptr),
 		bserv::make_path("/dlist", &delete_list,
 			bserv::placeholders::request,
 			bserv::placeholders::response,
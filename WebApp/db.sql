@@ -0,0 +1,121 @@
+-- the tables of the sample project, with sample data.
+-- it can be imported into postgresql (`psql bserv < db.sql`),
+-- or loaded by the in-memory backend (`"db-backend": "memory"`).
+-- the users `admin`, `alice` and `bob` have their names as passwords.
+
+DROP TABLE IF EXISTS auth_user;
+CREATE TABLE auth_user (
+    id serial PRIMARY KEY,
+    username character varying(255) NOT NULL UNIQUE,
+    password character varying(255) NOT NULL,
+    is_superuser boolean NOT NULL,
+    first_name character varying(255),
+    last_name character varying(255),
+    email character varying(255),
+    is_active boolean NOT NULL
+);
+
+DROP TABLE IF EXISTS music;
+CREATE TABLE music (
+    id serial PRIMARY KEY,
+    musicname character varying(255) NOT NULL UNIQUE,
+    length integer,
+    year integer,
+    language character varying(255),
+    sname character varying(255)
+);
+
+DROP TABLE IF EXISTS singers;
+CREATE TABLE singers (
+    sname character varying(255) PRIMARY KEY,
+    sex character varying(255),
+    birthyear integer,
+    area character varying(255),
+    message character varying(255),
+    award character varying(255)
+);
+
+DROP TABLE IF EXISTS collection;
+CREATE TABLE collection (
+    mname character varying(255) NOT NULL,
+    uname character varying(255) NOT NULL,
+    freq integer NOT NULL,
+    is_favorite boolean NOT NULL,
+    PRIMARY KEY (mname, uname)
+);
+
+INSERT INTO auth_user (username, password, is_superuser, first_name, last_name, email, is_active) VALUES
+    ('admin', 'sAmPlEsAlTaDmIn0$qNbHYz+AfABVCvTbIzDvo7jQ6QztmKFG5aoQTCWiooc=', true, 'Ada', 'Admin', 'admin@example.com', true),
+    ('alice', 'sAmPlEsAlTaLiCe1$cS/fA7ROM3nxfUI9m+mfBUdpCC1buGHQxEqWogu3XbY=', false, 'Alice', 'Liddell', 'alice@example.com', true),
+    ('bob', 'sAmPlEsAlTbOb002$EILVwEPwNEagBKRC8JHOPl5dWCOZ9mK8q1ZtkmGg1Sg=', false, 'Bob', 'Builder', 'bob@example.com', true);
+
+INSERT INTO singers (sname, sex, birthyear, area, message, award) VALUES
+    ('Jay Chou', 'male', 1979, 'Taiwan', 'Mandopop singer and songwriter.', 'Golden Melody Award'),
+    ('Faye Wong', 'female', 1969, 'Beijing', 'Cantopop and Mandopop singer.', 'Golden Melody Award'),
+    ('Adele', 'female', 1988, 'London', 'Singer and songwriter.', 'Grammy Award'),
+    ('Ed Sheeran', 'male', 1991, 'Halifax', 'Singer and songwriter.', 'Grammy Award'),
+    ('Hikaru Utada', 'female', 1983, 'New York', 'J-pop singer and songwriter.', 'Japan Gold Disc Award'),
+    ('IU', 'female', 1993, 'Seoul', 'K-pop singer and actress.', 'Melon Music Award'),
+    ('Edith Piaf', 'female', 1915, 'Paris', 'Chanson singer.', 'Grand Prix du Disque'),
+    ('Eason Chan', 'male', 1974, 'Hong Kong', 'Cantopop singer.', 'Golden Melody Award');
+
+INSERT INTO music (musicname, length, year, language, sname) VALUES
+    ('Song 01', 150, 1990, 'Chinese', 'Jay Chou'),
+    ('Song 02', 187, 1997, 'Chinese', 'Faye Wong'),
+    ('Song 03', 224, 2004, 'English', 'Adele'),
+    ('Song 04', 261, 2011, 'English', 'Ed Sheeran'),
+    ('Song 05', 298, 2018, 'Japanese', 'Hikaru Utada'),
+    ('Song 06', 185, 1992, 'Korean', 'IU'),
+    ('Song 07', 222, 1999, 'French', 'Edith Piaf'),
+    ('Song 08', 259, 2006, 'Chinese', 'Eason Chan'),
+    ('Song 09', 296, 2013, 'Chinese', 'Jay Chou'),
+    ('Song 10', 183, 2020, 'Chinese', 'Faye Wong'),
+    ('Song 11', 220, 1994, 'English', 'Adele'),
+    ('Song 12', 257, 2001, 'English', 'Ed Sheeran'),
+    ('Song 13', 294, 2008, 'Japanese', 'Hikaru Utada'),
+    ('Song 14', 181, 2015, 'Korean', 'IU'),
+    ('Song 15', 218, 2022, 'French', 'Edith Piaf'),
+    ('Song 16', 255, 1996, 'Chinese', 'Eason Chan'),
+    ('Song 17', 292, 2003, 'Chinese', 'Jay Chou'),
+    ('Song 18', 179, 2010, 'Chinese', 'Faye Wong'),
+    ('Song 19', 216, 2017, 'English', 'Adele'),
+    ('Song 20', 253, 1991, 'English', 'Ed Sheeran'),
+    ('Song 21', 290, 1998, 'Japanese', 'Hikaru Utada'),
+    ('Song 22', 177, 2005, 'Korean', 'IU'),
+    ('Song 23', 214, 2012, 'French', 'Edith Piaf'),
+    ('Song 24', 251, 2019, 'Chinese', 'Eason Chan'),
+    ('Song 25', 288, 1993, 'Chinese', 'Jay Chou'),
+    ('Song 26', 175, 2000, 'Chinese', 'Faye Wong'),
+    ('Song 27', 212, 2007, 'English', 'Adele'),
+    ('Song 28', 249, 2014, 'English', 'Ed Sheeran'),
+    ('Song 29', 286, 2021, 'Japanese', 'Hikaru Utada'),
+    ('Song 30', 173, 1995, 'Korean', 'IU'),
+    ('Song 31', 210, 2002, 'French', 'Edith Piaf'),
+    ('Song 32', 247, 2009, 'Chinese', 'Eason Chan'),
+    ('Song 33', 284, 2016, 'Chinese', 'Jay Chou'),
+    ('Song 34', 171, 1990, 'Chinese', 'Faye Wong'),
+    ('Song 35', 208, 1997, 'English', 'Adele'),
+    ('Song 36', 245, 2004, 'English', 'Ed Sheeran');
+
+INSERT INTO collection (mname, uname, freq, is_favorite) VALUES
+    ('Song 01', 'alice', 0, true),
+    ('Song 02', 'bob', 3, true),
+    ('Song 04', 'alice', 15, false),
+    ('Song 06', 'bob', 4, false),
+    ('Song 07', 'alice', 13, true),
+    ('Song 10', 'alice', 11, false),
+    ('Song 10', 'bob', 5, false),
+    ('Song 13', 'alice', 9, true),
+    ('Song 14', 'bob', 6, true),
+    ('Song 16', 'alice', 7, false),
+    ('Song 18', 'bob', 7, false),
+    ('Song 19', 'alice', 5, true),
+    ('Song 22', 'alice', 3, false),
+    ('Song 22', 'bob', 8, false),
+    ('Song 25', 'alice', 1, true),
+    ('Song 26', 'bob', 9, true),
+    ('Song 28', 'alice', 16, false),
+    ('Song 30', 'bob', 10, false),
+    ('Song 31', 'alice', 14, true),
+    ('Song 34', 'alice', 12, false),
+    ('Song 34', 'bob', 0, false);
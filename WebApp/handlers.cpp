@@ -82,6 +82,16 @@ std::optional<boost::json::object> get_user(
 	return orm_user.convert_to_optional(r);
 }
 
+// reads the user in a transaction of its own, and puts the connection
+// back before returning (e.g. so that it is not held while the password
+// is checked by `offloader`)
+std::optional<boost::json::object> find_user_row(
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	const boost::json::string& username) {
+	bserv::db_transaction tx{ db_mgr->get_or_block() };
+	return get_user(tx, username);
+}
+
 std::optional<boost::json::object> get_list(
 	bserv::db_transaction& tx,
 	const boost::json::string& musicname) {
@@ -130,21 +140,13 @@ std::nullopt_t hello(
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	bserv::session_type& session = *session_ptr;
 	boost::json::object obj;
-	if (session.count("user")) {
-		// NOTE: modifications to sessions must be performed
-		// BEFORE referencing objects in them. this is because
-		// modifications might invalidate referenced objects.
-		// in this example, "count" might be added to `session`,
-		// which should be performed first.
-		// then `user` can be referenced safely.
-		if (!session.count("count")) {
-			session["count"] = 0;
-		}
-		auto& user = session["user"].as_object();
-		session["count"] = session["count"].as_int64() + 1;
+	if (auto user = session.user()) {
+		// the session may be used by concurrent requests,
+		// so the counter is incremented atomically.
+		std::int64_t count = session.increment("count");
 		obj = {
-			{"welcome", user["username"]},
-			{"count", session["count"]}
+			{"welcome", user->username},
+			{"count", count}
 		};
 	}
 	else {
@@ -164,7 +166,8 @@ boost::json::object user_register(
 	// the json object is obtained from the request body,
 	// as well as the url parameters
 	boost::json::object&& params,
-	std::shared_ptr<bserv::db_connection> conn) {
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	std::shared_ptr<bserv::offloader> offloader) {
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
@@ -181,7 +184,14 @@ boost::json::object user_register(
 		};
 	}
 	auto username = params["username"].as_string();
-	bserv::db_transaction tx{ conn };
+	auto password = params["password"].as_string();
+	// hashing is slow, so it is not done on the I/O thread.
+	// it is done before a connection is taken, as the handler
+	// must not hold one while it is suspended.
+	auto encoded_password = offloader->run([&] {
+		return bserv::utils::security::encode_password(password.c_str());
+	});
+	bserv::db_transaction tx{ db_mgr->get_or_block() };
 	auto opt_user = get_user(tx, username);
 	if (opt_user.has_value()) {
 		return {
@@ -189,7 +199,6 @@ boost::json::object user_register(
 			{"message", "`username` existed"}
 		};
 	}
-	auto password = params["password"].as_string();
 	bserv::db_result r = tx.exec(
 		"insert into ? "
 		"(?, password, is_superuser, "
@@ -197,8 +206,7 @@ boost::json::object user_register(
 		"(?, ?, ?, ?, ?, ?, ?)", bserv::db_name("auth_user"),
 		bserv::db_name("username"),
 		username,
-		bserv::utils::security::encode_password(
-			password.c_str()), 
+		encoded_password,
 		(get_or_empty(params,"superuser")=="true")?true:false,
 		get_or_empty(params, "first_name"),
 		get_or_empty(params, "last_name"),
@@ -216,7 +224,8 @@ boost::json::object user_delete(
 	// the json object is obtained from the request body,
 	// as well as the url parameters
 	boost::json::object&& params,
-	std::shared_ptr<bserv::db_connection> conn) {
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	std::shared_ptr<bserv::offloader> offloader) {
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
@@ -233,8 +242,7 @@ boost::json::object user_delete(
 		};
 	}
 	auto username = params["duser"].as_string();
-	bserv::db_transaction tx{ conn };
-	auto opt_user = get_user(tx, username);
+	auto opt_user = find_user_row(db_mgr, username);
 	if (!opt_user.has_value()) {
 		return {
 			{"success", false},
@@ -250,13 +258,16 @@ boost::json::object user_delete(
 	}
 	auto password = params["password"].as_string();
 	auto encoded_password = user["password"].as_string();
-	if (!bserv::utils::security::check_password(
-		password.c_str(), encoded_password.c_str())) {
+	if (!offloader->run([&] {
+		return bserv::utils::security::check_password(
+			password.c_str(), encoded_password.c_str());
+	})) {
 		return {
 			{"success", false},
 			{"message", "invalid username/password"}
 		};
 	}
+	bserv::db_transaction tx{ db_mgr->get_or_block() };
 	bserv::db_result r = tx.exec(
 		"update ?"
 		"set is_active=false "
@@ -697,8 +708,9 @@ boost::json::object delete_set(
 boost::json::object user_login(
 	bserv::request_type& request,
 	boost::json::object&& params,
-	std::shared_ptr<bserv::db_connection> conn,
-	std::shared_ptr<bserv::session_type> session_ptr) {
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	std::shared_ptr<bserv::offloader> offloader) {
 	if (request.method() != boost::beast::http::verb::post) {
 		throw bserv::url_not_found_exception{};
 	}
@@ -715,8 +727,7 @@ boost::json::object user_login(
 		};
 	}
 	auto username = params["username"].as_string();
-	bserv::db_transaction tx{ conn };
-	auto opt_user = get_user(tx, username);
+	auto opt_user = find_user_row(db_mgr, username);
 	if (!opt_user.has_value()) {
 		return {
 			{"success", false},
@@ -732,15 +743,17 @@ boost::json::object user_login(
 	}
 	auto password = params["password"].as_string();
 	auto encoded_password = user["password"].as_string();
-	if (!bserv::utils::security::check_password(
-		password.c_str(), encoded_password.c_str())) {
+	if (!offloader->run([&] {
+		return bserv::utils::security::check_password(
+			password.c_str(), encoded_password.c_str());
+	})) {
 		return {
 			{"success", false},
 			{"message", "invalid username/password"}
 		};
 	}
 	bserv::session_type& session = *session_ptr;
-	session["user"] = user;
+	session.set_user(std::make_shared<const bserv::session_user>(user));
 	return {
 		{"success", true},
 		{"message", "login successfully"}
@@ -769,9 +782,7 @@ boost::json::object find_user(
 boost::json::object user_logout(
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	bserv::session_type& session = *session_ptr;
-	if (session.count("user")) {
-		session.erase("user");
-	}
+	session.set_user(nullptr);
 	return {
 		{"success", true},
 		{"message", "logout successfully"}
@@ -796,11 +807,8 @@ boost::json::object send_request(
 	auto obj = client_ptr->post_for_value(
 		"localhost", "8080", "/echo", { {"request", params} }
 	);
-	if (session->count("cnt") == 0) {
-		(*session)["cnt"] = 0;
-	}
-	(*session)["cnt"] = (*session)["cnt"].as_int64() + 1;
-	return { {"response", obj}, {"cnt", (*session)["cnt"]} };
+	std::int64_t cnt = session->increment("cnt");
+	return { {"response", obj}, {"cnt", cnt} };
 }
 
 boost::json::object echo(
@@ -812,7 +820,7 @@ boost::json::object echo(
 std::nullopt_t ws_echo(
 	std::shared_ptr<bserv::session_type> session,
 	std::shared_ptr<bserv::websocket_server> ws_server) {
-	ws_server->write_json((*session)["cnt"]);
+	ws_server->write_json(session->get("cnt"));
 	while (true) {
 		try {
 			std::string data = ws_server->read();
@@ -838,9 +846,13 @@ std::nullopt_t index(
 	std::shared_ptr<bserv::session_type> session_ptr,
 	bserv::response_type& response,
 	boost::json::object& context) {
-	bserv::session_type& session = *session_ptr;
-	if (session.contains("user")) {
-		context["user"] = session["user"];
+	// only the fields used by the templates are copied
+	if (auto user = session_ptr->user()) {
+		context["user"] = {
+			{"id", user->id},
+			{"username", user->username},
+			{"is_superuser", user->is_superuser}
+		};
 	}
 	return render(response, template_path, context);
 }
@@ -868,10 +880,11 @@ std::nullopt_t form_login(
 	bserv::request_type& request,
 	bserv::response_type& response,
 	boost::json::object&& params,
-	std::shared_ptr<bserv::db_connection> conn,
-	std::shared_ptr<bserv::session_type> session_ptr) {
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	std::shared_ptr<bserv::offloader> offloader) {
 	lgdebug << params << std::endl;
-	auto context = user_login(request, std::move(params), conn, session_ptr);
+	auto context = user_login(request, std::move(params), db_mgr, session_ptr, offloader);
 	lginfo << "login: " << context << std::endl;
 	return index("index.html", session_ptr, response, context);
 }
@@ -1661,10 +1674,11 @@ std::nullopt_t form_add_user(
 	bserv::request_type& request,
 	bserv::response_type& response,
 	boost::json::object&& params,
-	std::shared_ptr<bserv::db_connection> conn,
-	std::shared_ptr<bserv::session_type> session_ptr) {
-	boost::json::object context = user_register(request, std::move(params), conn);
-	return redirect_to_users(conn, session_ptr, response, 1, std::move(context));
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	std::shared_ptr<bserv::offloader> offloader) {
+	boost::json::object context = user_register(request, std::move(params), db_mgr, offloader);
+	return redirect_to_users(db_mgr->get_or_block(), session_ptr, response, 1, std::move(context));
 }
 std::nullopt_t form_add_list(
 	bserv::request_type& request,
@@ -1688,10 +1702,11 @@ std::nullopt_t delete_user(
 	bserv::request_type& request,
 	bserv::response_type& response,
 	boost::json::object&& params,
-	std::shared_ptr<bserv::db_connection> conn,
-	std::shared_ptr<bserv::session_type> session_ptr) {
-	boost::json::object context = user_delete(request, std::move(params), conn);
-	return redirect_to_users(conn, session_ptr, response, 1, std::move(context));
+	std::shared_ptr<bserv::db_connection_manager> db_mgr,
+	std::shared_ptr<bserv::session_type> session_ptr,
+	std::shared_ptr<bserv::offloader> offloader) {
+	boost::json::object context = user_delete(request, std::move(params), db_mgr, offloader);
+	return redirect_to_users(db_mgr->get_or_block(), session_ptr, response, 1, std::move(context));
 }
 
 std::nullopt_t delete_list(
@@ -15,13 +15,15 @@ std::nullopt_t hello(
 boost::json::object user_register(
     bserv::request_type& request,
     boost::json::object&& params,
-    std::shared_ptr<bserv::db_connection> conn);
+    std::shared_ptr<bserv::db_connection_manager> db_mgr,
+    std::shared_ptr<bserv::offloader> offloader);
 
 boost::json::object user_login(
     bserv::request_type& request,
     boost::json::object&& params,
-    std::shared_ptr<bserv::db_connection> conn,
-    std::shared_ptr<bserv::session_type> session_ptr);
+    std::shared_ptr<bserv::db_connection_manager> db_mgr,
+    std::shared_ptr<bserv::session_type> session_ptr,
+    std::shared_ptr<bserv::offloader> offloader);
 
 boost::json::object find_user(
     std::shared_ptr<bserv::db_connection> conn,
@@ -55,8 +57,9 @@ std::nullopt_t form_login(
     bserv::request_type& request,
     bserv::response_type& response,
     boost::json::object&& params,
-    std::shared_ptr<bserv::db_connection> conn,
-    std::shared_ptr<bserv::session_type> session_ptr);
+    std::shared_ptr<bserv::db_connection_manager> db_mgr,
+    std::shared_ptr<bserv::session_type> session_ptr,
+    std::shared_ptr<bserv::offloader> offloader);
 
 std::nullopt_t form_logout(
     std::shared_ptr<bserv::session_type> session_ptr,
@@ -120,8 +123,9 @@ std::nullopt_t form_add_user(
     bserv::request_type& request,
     bserv::response_type& response,
     boost::json::object&& params,
-    std::shared_ptr<bserv::db_connection> conn,
-    std::shared_ptr<bserv::session_type> session_ptr);
+    std::shared_ptr<bserv::db_connection_manager> db_mgr,
+    std::shared_ptr<bserv::session_type> session_ptr,
+    std::shared_ptr<bserv::offloader> offloader);
 
 std::nullopt_t form_add_list(
     bserv::request_type& request,
@@ -141,8 +145,9 @@ std::nullopt_t delete_user(
     bserv::request_type& request,
     bserv::response_type& response,
     boost::json::object&& params,
-    std::shared_ptr<bserv::db_connection> conn,
-    std::shared_ptr<bserv::session_type> session_ptr);
+    std::shared_ptr<bserv::db_connection_manager> db_mgr,
+    std::shared_ptr<bserv::session_type> session_ptr,
+    std::shared_ptr<bserv::offloader> offloader);
 std::nullopt_t delete_list(
     bserv::request_type& request,
     bserv::response_type& response,
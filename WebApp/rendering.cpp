@@ -24,6 +24,8 @@ std::nullopt_t render(
 	bserv::response_type& response,
 	const std::string& template_file,
 	const boost::json::object& context) {
+	bserv::scoped_latency timer{ bserv::metrics().render };
+	bserv::trace_span span{ "render" };
 	response.set(bserv::http::field::content_type, "text/html");
 	inja::json data = inja::json::parse(boost::json::serialize(context));
 	response.body() = inja::Environment{}.render_file(template_root_ + template_file, data);
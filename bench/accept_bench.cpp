@@ -0,0 +1,129 @@
+// benchmarks accepting connections in the shared io_context mode and
+// in the per-core mode. each request is sent on a new connection
+// (`Connection: close`), so the throughput is bounded by the accept path.
+// the server runs in this process, and the clients are blocking sockets
+// on their own threads. the latency is measured from `connect` to the end
+// of the response.
+//
+// Usage: accept_bench [shared|per-core] [server threads] [client threads] [seconds] [port]
+#include <bserv/common.hpp>
+
+#include <boost/asio.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+std::nullopt_t hello(bserv::response_type& response) {
+	response.body() = "hello";
+	response.prepare_payload();
+	return std::nullopt;
+}
+
+// returns the latency in nanoseconds, or -1 on errors
+long long request_once(asio::io_context& ioc, const tcp::endpoint& endpoint) {
+	static const std::string request =
+		"GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+	auto start = std::chrono::steady_clock::now();
+	boost::system::error_code ec;
+	tcp::socket socket{ ioc };
+	socket.connect(endpoint, ec);
+	if (ec) return -1;
+	// closes with RST, so the client ports are not held in TIME_WAIT
+	socket.set_option(asio::socket_base::linger(true, 0), ec);
+	asio::write(socket, asio::buffer(request), ec);
+	if (ec) return -1;
+	char buf[1024];
+	std::size_t total = 0;
+	while (true) {
+		std::size_t n = socket.read_some(asio::buffer(buf), ec);
+		total += n;
+		if (ec == asio::error::eof) break;
+		if (ec) return -1;
+	}
+	if (total == 0) return -1;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	std::string mode = argc > 1 ? argv[1] : "shared";
+	int server_threads = argc > 2 ? std::atoi(argv[2]) : bserv::NUM_THREADS;
+	int client_threads = argc > 3 ? std::atoi(argv[3]) : 4;
+	int seconds = argc > 4 ? std::atoi(argv[4]) : 5;
+	unsigned short port = argc > 5 ? (unsigned short)std::atoi(argv[5]) : 18080;
+	if ((mode != "shared" && mode != "per-core")
+		|| server_threads <= 0 || client_threads <= 0 || seconds <= 0) {
+		std::cerr << "Usage: " << argv[0]
+			<< " [shared|per-core] [server threads] [client threads] [seconds] [port]"
+			<< std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bserv::server_config config;
+	config.set_port(port);
+	config.set_num_threads(server_threads);
+	config.set_per_core(mode == "per-core");
+	std::thread server_thread{ [&] {
+		bserv::server{ config, {
+			bserv::make_path("/hello", &hello,
+				bserv::placeholders::response)
+		} };
+	} };
+
+	asio::io_context ioc;
+	tcp::endpoint endpoint{ asio::ip::make_address("127.0.0.1"), port };
+	// waits for the server to start
+	while (request_once(ioc, endpoint) < 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	std::atomic<long long> errors{ 0 };
+	std::vector<std::vector<long long>> latencies(client_threads);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+	std::vector<std::thread> clients;
+	for (int i = 0; i < client_threads; ++i) {
+		clients.emplace_back([&, i] {
+			asio::io_context client_ioc;
+			auto& result = latencies[i];
+			while (std::chrono::steady_clock::now() < deadline) {
+				long long ns = request_once(client_ioc, endpoint);
+				if (ns < 0) ++errors;
+				else result.push_back(ns);
+			}
+		});
+	}
+	for (auto& t : clients) t.join();
+
+	// stops the server
+	std::raise(SIGINT);
+	server_thread.join();
+
+	std::vector<long long> all;
+	for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+	std::sort(all.begin(), all.end());
+	auto percentile = [&all](double p) {
+		if (all.empty()) return 0.0;
+		std::size_t idx = std::min(all.size() - 1, (std::size_t)(p * all.size()));
+		return all[idx] / 1000.0;
+	};
+	std::cout << std::fixed << std::setprecision(1)
+		<< "mode: " << mode
+		<< ", server threads: " << server_threads
+		<< ", client threads: " << client_threads << '\n'
+		<< "connections/s: " << all.size() / (double)seconds
+		<< ", errors: " << errors << '\n'
+		<< "latency (us): p50 " << percentile(0.50)
+		<< ", p99 " << percentile(0.99)
+		<< ", p99.9 " << percentile(0.999)
+		<< ", max " << (all.empty() ? 0.0 : all.back() / 1000.0) << std::endl;
+}
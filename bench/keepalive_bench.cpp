@@ -0,0 +1,210 @@
+// benchmarks requests on keep-alive connections and counts the heap
+// allocations made per request. the server runs in this process, the
+// global `operator new` is replaced by a counting one, and each client
+// thread sends its requests on a single connection, `depth` at a time
+// (pipelining). the clients only use fixed buffers, so (almost) all of
+// the counted allocations are made by the server.
+//
+// the "co_hello" mode is the same as "hello", with a C++20 coroutine
+// handler (if bserv is compiled with -DBSERV_ENABLE_COROUTINES=ON).
+//
+// Usage: keepalive_bench [hello|echo|co_hello] [server threads] [client threads] [seconds] [port] [depth]
+#include <bserv/common.hpp>
+
+#include <boost/asio.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <csignal>
+#include <cstdlib>
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+std::atomic<long long> num_allocations{ 0 };
+
+void* operator new(std::size_t size) {
+	++num_allocations;
+	if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+std::nullopt_t hello(bserv::response_type& response) {
+	response.body() = "hello";
+	response.prepare_payload();
+	return std::nullopt;
+}
+
+#ifdef BSERV_HAS_CO_AWAIT
+bserv::awaitable<std::nullopt_t> co_hello(bserv::response_type& response) {
+	response.body() = "hello";
+	response.prepare_payload();
+	co_return std::nullopt;
+}
+#endif
+
+std::nullopt_t echo(
+	bserv::request_type& request,
+	bserv::response_type& response) {
+	response.body().assign(request.body());
+	response.prepare_payload();
+	return std::nullopt;
+}
+
+class client {
+private:
+	tcp::socket socket_;
+	std::string request_;
+	char buf_[4096];
+	std::size_t size_ = 0;
+	int depth_;
+public:
+	client(asio::io_context& ioc, const std::string& path, int depth)
+		: socket_{ ioc }, depth_{ depth } {
+		std::string body = path == "/echo" ? std::string(64, 'x') : "";
+		std::string request = (body.empty() ? "GET " : "POST ") + path + " HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+		for (int i = 0; i < depth; ++i) request_ += request;
+	}
+	bool connect(const tcp::endpoint& endpoint) {
+		boost::system::error_code ec;
+		socket_.connect(endpoint, ec);
+		return !ec;
+	}
+	// sends `depth` requests and reads their responses
+	bool request_once() {
+		boost::system::error_code ec;
+		asio::write(socket_, asio::buffer(request_), ec);
+		if (ec) return false;
+		for (int i = 0; i < depth_; ++i)
+			if (!read_response()) return false;
+		return true;
+	}
+	bool read_response() {
+		boost::system::error_code ec;
+		// reads the header
+		std::size_t header_end;
+		while (true) {
+			header_end = std::string_view{ buf_, size_ }.find("\r\n\r\n");
+			if (header_end != std::string_view::npos) {
+				header_end += 4;
+				break;
+			}
+			if (size_ == sizeof(buf_)) return false;
+			size_ += socket_.read_some(asio::buffer(buf_ + size_, sizeof(buf_) - size_), ec);
+			if (ec) return false;
+		}
+		std::size_t length = std::string_view{ buf_, header_end }.find("Content-Length: ");
+		if (length == std::string_view::npos) return false;
+		std::size_t total = header_end + std::strtoul(buf_ + length + 16, nullptr, 10);
+		if (total > sizeof(buf_)) return false;
+		// reads the body
+		while (size_ < total) {
+			size_ += socket_.read_some(asio::buffer(buf_ + size_, sizeof(buf_) - size_), ec);
+			if (ec) return false;
+		}
+		std::memmove(buf_, buf_ + total, size_ - total);
+		size_ -= total;
+		return true;
+	}
+};
+
+int main(int argc, char* argv[]) {
+	std::string mode = argc > 1 ? argv[1] : "hello";
+	int server_threads = argc > 2 ? std::atoi(argv[2]) : bserv::NUM_THREADS;
+	int client_threads = argc > 3 ? std::atoi(argv[3]) : 4;
+	int seconds = argc > 4 ? std::atoi(argv[4]) : 5;
+	unsigned short port = argc > 5 ? (unsigned short)std::atoi(argv[5]) : 18080;
+	int depth = argc > 6 ? std::atoi(argv[6]) : 1;
+	bool valid_mode = mode == "hello" || mode == "echo";
+#ifdef BSERV_HAS_CO_AWAIT
+	valid_mode = valid_mode || mode == "co_hello";
+#endif
+	if (!valid_mode || server_threads <= 0
+		|| client_threads <= 0 || seconds <= 0 || depth <= 0 || depth > 16) {
+		std::cerr << "Usage: " << argv[0]
+			<< " [hello|echo|co_hello] [server threads] [client threads] [seconds] [port] [depth]"
+			<< std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bserv::server_config config;
+	config.set_port(port);
+	config.set_num_threads(server_threads);
+	std::thread server_thread{ [&] {
+		bserv::server{ config, {
+			bserv::make_path("/hello", &hello,
+				bserv::placeholders::response),
+			bserv::make_path("/echo", &echo,
+				bserv::placeholders::request,
+				bserv::placeholders::response),
+#ifdef BSERV_HAS_CO_AWAIT
+			bserv::make_path("/co_hello", &co_hello,
+				bserv::placeholders::response),
+#endif
+		} };
+	} };
+
+	asio::io_context ioc;
+	tcp::endpoint endpoint{ asio::ip::make_address("127.0.0.1"), port };
+	std::vector<std::unique_ptr<client>> clients;
+	for (int i = 0; i < client_threads; ++i) {
+		clients.push_back(std::make_unique<client>(ioc, "/" + mode, depth));
+		// waits for the server to start
+		while (!clients.back()->connect(endpoint))
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	// warms up the connections (and the pools on the server)
+	for (auto& c : clients)
+		for (int i = 0; i < 100; ++i) c->request_once();
+
+	std::atomic<long long> requests{ 0 }, errors{ 0 };
+	std::atomic<bool> start{ false };
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < client_threads; ++i) {
+		threads.emplace_back([&, i] {
+			long long done = 0;
+			while (!start) std::this_thread::yield();
+			while (std::chrono::steady_clock::now() < deadline) {
+				if (!clients[i]->request_once()) {
+					++errors;
+					break;
+				}
+				done += depth;
+			}
+			requests += done;
+		});
+	}
+	long long allocations = num_allocations;
+	start = true;
+	for (auto& t : threads) t.join();
+	allocations = num_allocations - allocations;
+
+	// stops the server
+	std::raise(SIGINT);
+	server_thread.join();
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< "path: /" << mode
+		<< ", server threads: " << server_threads
+		<< ", client threads: " << client_threads
+		<< ", depth: " << depth << '\n'
+		<< "requests/s: " << requests / (double)seconds
+		<< ", errors: " << errors << '\n'
+		<< "allocations/request: "
+		<< (requests == 0 ? 0.0 : allocations / (double)requests) << std::endl;
+}
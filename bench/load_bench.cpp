@@ -0,0 +1,277 @@
+// generates load on a running server, and reports the throughput and
+// the percentiles of the latency.
+//
+// - closed loop (by default): each connection sends a request, waits
+//   for its response, then sends the next one.
+// - open loop (`-r rate`): the requests are scheduled at a fixed rate
+//   (in turn on the connections), however fast the server answers.
+//   the latency of a request is measured from when it was scheduled,
+//   instead of when it was sent, so that the time it waits behind a
+//   slow response is counted (the correction for "coordinated omission").
+//
+// the targets are requested in turn, e.g. for the sample project:
+//   load_bench -p 8080 -c 64 -d 30 /list/1 /collection /rec /statics/css/bootstrap.min.css
+// the responses of the first `-w` seconds are not counted. a request
+// which is not answered within `-T` seconds (including connecting)
+// is counted as an error, and its connection is reopened.
+//
+// Usage: load_bench [-h host] [-p port] [-c connections] [-t threads]
+//                   [-d seconds] [-w seconds] [-r requests/s] [-T seconds]
+//                   [target]...
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/beast.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using asio::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+	std::string host = "127.0.0.1";
+	std::string port = "8080";
+	int connections = 16;
+	int threads = 1;
+	int seconds = 10;
+	int warm_up = 2;
+	// 0: closed loop
+	double rate = 0;
+	int timeout = 10;
+	std::vector<std::string> targets;
+};
+
+// the results of a connection
+struct connection_stats {
+	std::vector<clock_type::duration> latencies;
+	// 1xx, 2xx, 3xx, 4xx, 5xx
+	std::uint64_t statuses[5]{};
+	std::uint64_t errors = 0;
+	// the errors which are timeouts
+	std::uint64_t timeouts = 0;
+	std::uint64_t bytes = 0;
+	// when the last response was read
+	clock_type::time_point last;
+};
+
+class connection {
+private:
+	const options& options_;
+	const tcp::resolver::results_type& endpoints_;
+	// the index of this connection, and of the next request it sends
+	std::uint64_t next_;
+	clock_type::time_point start_, measure_start_, end_;
+	beast::tcp_stream stream_;
+	beast::flat_buffer buffer_;
+	std::vector<http::request<http::empty_body>> requests_;
+	bool connected_ = false;
+public:
+	connection_stats stats;
+	connection(asio::io_context& ioc, const options& options,
+		const tcp::resolver::results_type& endpoints, int index,
+		clock_type::time_point start)
+		: options_{ options }, endpoints_{ endpoints }, next_{ (std::uint64_t)index },
+		start_{ start }, measure_start_{ start + std::chrono::seconds(options.warm_up) },
+		end_{ measure_start_ + std::chrono::seconds(options.seconds) },
+		stream_{ asio::make_strand(ioc) } {
+		for (const std::string& target : options.targets) {
+			http::request<http::empty_body> request{ http::verb::get, target, 11 };
+			request.set(http::field::host, options.host);
+			request.set(http::field::user_agent, "load_bench");
+			request.keep_alive(true);
+			requests_.push_back(std::move(request));
+		}
+	}
+	void run(asio::yield_context yield) {
+		asio::steady_timer timer{ stream_.get_executor() };
+		beast::error_code ec;
+		// the first requests of the connections go to different targets
+		std::size_t target = next_ % requests_.size();
+		while (true) {
+			clock_type::time_point scheduled = clock_type::now();
+			if (options_.rate > 0) {
+				scheduled = start_ + std::chrono::duration_cast<clock_type::duration>(
+					std::chrono::duration<double>(next_ / options_.rate));
+				next_ += options_.connections;
+				if (scheduled >= end_) break;
+				timer.expires_at(scheduled);
+				timer.async_wait(yield[ec]);
+			}
+			else if (scheduled >= end_) break;
+			// connecting, writing the request and reading the response
+			stream_.expires_after(std::chrono::seconds(options_.timeout));
+			if (!connected_) {
+				stream_.async_connect(endpoints_, yield[ec]);
+				if (ec) {
+					count_error(scheduled, ec);
+					// the server may not be listening yet
+					timer.expires_after(std::chrono::milliseconds(10));
+					timer.async_wait(yield[ec]);
+					continue;
+				}
+				connected_ = true;
+			}
+			http::async_write(stream_, requests_[target], yield[ec]);
+			if (++target == requests_.size()) target = 0;
+			http::response<http::string_body> response;
+			std::size_t bytes = 0;
+			if (!ec) bytes = http::async_read(stream_, buffer_, response, yield[ec]);
+			clock_type::time_point done = clock_type::now();
+			if (ec) {
+				count_error(scheduled, ec);
+				reconnect();
+				continue;
+			}
+			if (scheduled >= measure_start_) {
+				stats.latencies.push_back(done - scheduled);
+				unsigned status = response.result_int();
+				if (status >= 100 && status < 600) ++stats.statuses[status / 100 - 1];
+				stats.bytes += bytes;
+				stats.last = done;
+			}
+			if (!response.keep_alive()) reconnect();
+		}
+		beast::error_code ignored;
+		stream_.socket().shutdown(tcp::socket::shutdown_both, ignored);
+	}
+	auto executor() {
+		return stream_.get_executor();
+	}
+	void count_error(clock_type::time_point scheduled, const beast::error_code& ec) {
+		if (scheduled < measure_start_) return;
+		++stats.errors;
+		if (ec == beast::error::timeout) ++stats.timeouts;
+	}
+	void reconnect() {
+		stream_.close();
+		buffer_.clear();
+		connected_ = false;
+	}
+};
+
+bool parse_options(int argc, char* argv[], options& opts) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+			const char* value = argv[++i];
+			switch (arg[1]) {
+			case 'h': opts.host = value; break;
+			case 'p': opts.port = value; break;
+			case 'c': opts.connections = std::atoi(value); break;
+			case 't': opts.threads = std::atoi(value); break;
+			case 'd': opts.seconds = std::atoi(value); break;
+			case 'w': opts.warm_up = std::atoi(value); break;
+			case 'r': opts.rate = std::atof(value); break;
+			case 'T': opts.timeout = std::atoi(value); break;
+			default: return false;
+			}
+		}
+		else if (arg[0] == '/') opts.targets.push_back(arg);
+		else return false;
+	}
+	if (opts.targets.empty()) opts.targets.push_back("/");
+	return opts.connections > 0 && opts.threads > 0
+		&& opts.seconds > 0 && opts.warm_up >= 0 && opts.rate >= 0
+		&& opts.timeout > 0;
+}
+
+double to_ms(clock_type::duration d) {
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int main(int argc, char* argv[]) {
+	options opts;
+	if (!parse_options(argc, argv, opts)) {
+		std::cerr << "Usage: " << argv[0]
+			<< " [-h host] [-p port] [-c connections] [-t threads]"
+			" [-d seconds] [-w seconds] [-r requests/s] [-T seconds] [target]..."
+			<< std::endl;
+		return EXIT_FAILURE;
+	}
+
+	asio::io_context ioc{ opts.threads };
+	tcp::resolver::results_type endpoints;
+	try {
+		endpoints = tcp::resolver{ ioc }.resolve(opts.host, opts.port);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "cannot resolve " << opts.host << ':' << opts.port
+			<< ": " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	clock_type::time_point start = clock_type::now();
+	std::vector<std::unique_ptr<connection>> connections;
+	for (int i = 0; i < opts.connections; ++i) {
+		connections.push_back(std::make_unique<connection>(
+			ioc, opts, endpoints, i, start));
+		connection* c = connections.back().get();
+		asio::spawn(
+			c->executor(),
+			[c](asio::yield_context yield) { c->run(yield); });
+	}
+	std::vector<std::thread> threads;
+	for (int i = 1; i < opts.threads; ++i)
+		threads.emplace_back([&] { ioc.run(); });
+	ioc.run();
+	for (auto& t : threads) t.join();
+
+	connection_stats total;
+	for (auto& c : connections) {
+		total.latencies.insert(total.latencies.end(),
+			c->stats.latencies.begin(), c->stats.latencies.end());
+		for (int i = 0; i < 5; ++i) total.statuses[i] += c->stats.statuses[i];
+		total.errors += c->stats.errors;
+		total.timeouts += c->stats.timeouts;
+		total.bytes += c->stats.bytes;
+		total.last = std::max(total.last, c->stats.last);
+	}
+	// the requests scheduled before the end are all answered, so an
+	// overloaded server takes longer than `opts.seconds`.
+	double seconds = std::max<double>(opts.seconds,
+		std::chrono::duration<double>(
+			total.last - start - std::chrono::seconds(opts.warm_up)).count());
+	std::vector<clock_type::duration>& latencies = total.latencies;
+	std::sort(latencies.begin(), latencies.end());
+	const auto percentile = [&](double q) {
+		if (latencies.empty()) return 0.0;
+		std::size_t rank = static_cast<std::size_t>(std::ceil(q * latencies.size()));
+		return to_ms(latencies[rank == 0 ? 0 : rank - 1]);
+	};
+	clock_type::duration sum{ 0 };
+	for (auto d : latencies) sum += d;
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< "targets:";
+	for (const std::string& target : opts.targets) std::cout << ' ' << target;
+	std::cout << '\n'
+		<< (opts.rate > 0 ? "open loop, " : "closed loop, ")
+		<< opts.connections << " connection(s), " << opts.threads << " thread(s), "
+		<< opts.seconds << "s";
+	if (opts.rate > 0) std::cout << ", " << opts.rate << " requests/s scheduled";
+	std::cout << '\n'
+		<< "requests/s: " << latencies.size() / seconds
+		<< ", MB/s: " << total.bytes / 1e6 / seconds
+		<< ", errors: " << total.errors << " (timeouts: " << total.timeouts << ')'
+		<< ", non-2xx: " << latencies.size() - total.statuses[1] << '\n'
+		<< "latency (ms): mean " << (latencies.empty() ? 0.0 : to_ms(sum) / latencies.size())
+		<< ", p50 " << percentile(0.5)
+		<< ", p90 " << percentile(0.9)
+		<< ", p99 " << percentile(0.99)
+		<< ", p99.9 " << percentile(0.999)
+		<< ", max " << (latencies.empty() ? 0.0 : to_ms(latencies.back()))
+		<< std::endl;
+	return total.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+// benchmarks the library functions that run on each request: parsing
+// and decoding urls, matching the routes (of the sample project), building
+// the queries, running them on the in-memory database and converting their
+// results, looking up the sessions, serializing the context of a page
+// and rendering it.
+//
+// each benchmark is run in `SAMPLES` samples of about `SAMPLE_TIME`,
+// and the median (and the fastest) of the samples is reported.
+// with `-j`, the results are written as JSON, in a fixed order and
+// format, so that they can be compared between revisions:
+//   {"benchmarks":[{"name":"utils.decode_url","ns_per_op":91.2,"min_ns_per_op":90.4,"iterations":2097152},...]}
+//
+// Usage: micro_bench [-j] [name filter]
+#include <bserv/common.hpp>
+
+#include "../WebApp/rendering.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef BSERV_TEMPLATE_ROOT
+#define BSERV_TEMPLATE_ROOT "../templates/"
+#endif
+
+const int SAMPLES = 7;
+const auto SAMPLE_TIME = std::chrono::milliseconds(100);
+
+// prevents the optimizer from removing the benchmarked calls
+volatile std::size_t sink = 0;
+
+struct result {
+	std::string name;
+	double ns_per_op;
+	double min_ns_per_op;
+	std::uint64_t iterations;
+};
+
+double run_batch(const std::function<std::size_t()>& func, std::uint64_t iterations) {
+	auto start = std::chrono::steady_clock::now();
+	std::size_t n = 0;
+	for (std::uint64_t i = 0; i < iterations; ++i) n += func();
+	auto end = std::chrono::steady_clock::now();
+	sink = sink + n;
+	return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+result measure(const std::string& name, const std::function<std::size_t()>& func) {
+	// finds the number of iterations of a sample (which also warms up)
+	std::uint64_t iterations = 1;
+	double ns;
+	while ((ns = run_batch(func, iterations)) < 1e6 && iterations < (1ull << 40))
+		iterations *= 2;
+	iterations = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(
+		iterations * std::chrono::duration<double, std::nano>(SAMPLE_TIME).count() / ns));
+	std::vector<double> samples;
+	for (int i = 0; i < SAMPLES; ++i)
+		samples.push_back(run_batch(func, iterations) / iterations);
+	std::sort(samples.begin(), samples.end());
+	return { name, samples[SAMPLES / 2], samples[0], iterations };
+}
+
+std::nullopt_t noop() {
+	return std::nullopt;
+}
+
+// the routes of the sample project, in the same order
+bserv::router make_webapp_router() {
+	return {
+		bserv::make_path("/hello", &noop),
+		bserv::make_path("/metrics", &noop),
+		bserv::make_path("/trace", &noop),
+		bserv::make_path("/register", &noop),
+		bserv::make_path("/login", &noop),
+		bserv::make_path("/logout", &noop),
+		bserv::make_path("/find/<str>", &noop),
+		bserv::make_path("/send", &noop),
+		bserv::make_path("/echo", &noop),
+		bserv::make_path("/statics/<path>", &noop),
+		bserv::make_path("/", &noop),
+		bserv::make_path("/form_login", &noop),
+		bserv::make_path("/form_logout", &noop),
+		bserv::make_path("/users", &noop),
+		bserv::make_path("/users/<int>", &noop),
+		bserv::make_path("/list", &noop),
+		bserv::make_path("/collection", &noop),
+		bserv::make_path("/collection/<int>", &noop),
+		bserv::make_path("/rec", &noop),
+		bserv::make_path("/rec/<int>", &noop),
+		bserv::make_path("/list/<int>", &noop),
+		bserv::make_path("/list/language", &noop),
+		bserv::make_path("/list/search", &noop),
+		bserv::make_path("/list/searchs", &noop),
+		bserv::make_path("/more", &noop),
+		bserv::make_path("/list/singer", &noop),
+		bserv::make_path("/form_add_user", &noop),
+		bserv::make_path("/form_add_list", &noop),
+		bserv::make_path("/form_add_singer", &noop),
+		bserv::make_path("/delete_user", &noop),
+		bserv::make_path("/dlist", &noop),
+		bserv::make_path("/collect", &noop),
+		bserv::make_path("/set", &noop),
+		bserv::make_path("/play", &noop),
+		bserv::make_path("/clear", &noop),
+		bserv::make_path("/dlt", &noop)
+	};
+}
+
+// the context of `/list/<int>` (see `redirect_to_list`)
+boost::json::object make_list_context() {
+	const char* languages[] = { "Chinese", "English", "Japanese", "Korean", "French" };
+	boost::json::array lists, json_languages, singers;
+	for (int i = 0; i < 10; ++i) {
+		boost::json::object list;
+		list["id"] = i + 1;
+		list["musicname"] = "Song number " + std::to_string(i + 1);
+		list["length"] = 180 + i * 7;
+		list["year"] = 1990 + i * 3;
+		list["language"] = languages[i % 5];
+		list["sname"] = "Singer " + std::to_string(i % 4);
+		lists.push_back(list);
+	}
+	for (const char* language : languages)
+		json_languages.push_back(boost::json::object{ { "language", language } });
+	for (int i = 0; i < 20; ++i)
+		singers.push_back(boost::json::object{ { "sname", "Singer " + std::to_string(i) } });
+	boost::json::object pagination;
+	pagination["total"] = 12;
+	pagination["previous"] = 4;
+	pagination["next"] = 6;
+	pagination["current"] = 5;
+	pagination["right_ellipsis"] = true;
+	pagination["pages_left"] = boost::json::array{ 1, 2, 3, 4 };
+	pagination["pages_right"] = boost::json::array{ 6, 7, 8 };
+	boost::json::object context;
+	context["pagination"] = pagination;
+	context["lists"] = lists;
+	context["languages"] = json_languages;
+	context["singers"] = singers;
+	return context;
+}
+
+int main(int argc, char* argv[]) {
+	bool json = false;
+	std::string filter;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-j") json = true;
+		else if (arg[0] != '-' && filter.empty()) filter = arg;
+		else {
+			std::cerr << "Usage: " << argv[0]
+				<< " [-j] [name filter]" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	// only the errors are logged
+	bserv::server_config config;
+	config.set_log_level("error");
+	bserv::init_logging(config);
+
+	std::vector<std::pair<std::string, std::function<std::size_t()>>> benchmarks;
+	const auto add = [&](const std::string& name, std::function<std::size_t()> func) {
+		if (name.find(filter) != std::string::npos)
+			benchmarks.emplace_back(name, std::move(func));
+	};
+
+	// the inputs are copied, as `parse_url` and `parse_params` modify them
+	const std::string encoded = "%E5%91%A8%E6%9D%B0%E4%BC%A6+%E4%B8%83%E9%87%8C%E9%A6%99+Jay+Chou";
+	const std::string decoded = bserv::utils::decode_url(encoded);
+	const std::string target = "/list/search?search=" + encoded + "&page=2";
+	const std::string body = "username=someone&password=p%40ss+word&remember=on&next=%2Flist%2F3";
+	add("utils.decode_url", [&] { return bserv::utils::decode_url(encoded).size(); });
+	add("utils.encode_url", [&] { return bserv::utils::encode_url(decoded).size(); });
+	add("utils.parse_url", [&] {
+		std::string s = target;
+		return std::get<1>(bserv::utils::parse_url(s)).size();
+	});
+	add("utils.parse_params", [&] {
+		std::string s = body;
+		return bserv::utils::parse_params(s).first.size();
+	});
+
+	bserv::router router = make_webapp_router();
+	std::vector<std::string> url_params;
+	add("router.find/first", [&] {
+		return router.find("/hello", url_params) != nullptr ? 1 : 0;
+	});
+	add("router.find/list", [&] {
+		return router.find("/list/3", url_params) != nullptr ? 1 : 0;
+	});
+	add("router.find/last", [&] {
+		return router.find("/dlt", url_params) != nullptr ? 1 : 0;
+	});
+	add("router.find/unmatched", [&] {
+		return router.find("/not/found", url_params) != nullptr ? 1 : 0;
+	});
+
+	// the parameters are quoted by the transaction (see `db_value`)
+	const std::string query = "select * from music where language = ? and year > ? limit 10 offset ?;";
+	const std::vector<std::string> params = { "'Chinese'", "1999", "20" };
+	add("db.build_query", [&] {
+		return bserv::db_internal::build_query(query, params).size();
+	});
+
+	// the queries are run on the in-memory database (see `db_backend.hpp`),
+	// so that no database server is needed
+	auto backend = std::make_shared<bserv::memory_backend>();
+	backend->run_script(
+		"create table music (id serial, musicname text, length integer, "
+		"year integer, language text, sname text);");
+	for (int i = 0; i < 100; ++i)
+		backend->run_script(
+			"insert into music (musicname, length, year, language, sname) values ('Song number "
+			+ std::to_string(i + 1) + "', " + std::to_string(180 + i) + ", "
+			+ std::to_string(1990 + i % 30) + ", 'Chinese', 'Singer " + std::to_string(i % 4) + "');");
+	bserv::db_connection_manager db{ backend, 1 };
+	bserv::db_relation_to_object orm_list{
+		bserv::make_db_field<int>("id"),
+		bserv::make_db_field<std::string>("musicname"),
+		bserv::make_db_field<int>("length"),
+		bserv::make_db_field<int>("year"),
+		bserv::make_db_field<std::string>("language"),
+		bserv::make_db_field<std::string>("sname")
+	};
+	add("db.exec/memory", [&] {
+		bserv::db_transaction tx{ db.get_or_block() };
+		bserv::db_result r = tx.exec("select * from music limit 10 offset ?;", 20);
+		return r.begin() != r.end() ? 1 : 0;
+	});
+	bserv::db_result db_result;
+	{
+		bserv::db_transaction tx{ db.get_or_block() };
+		db_result = tx.exec("select * from music limit 10 offset ?;", 20);
+	}
+	add("db.convert_to_vector", [&] {
+		return orm_list.convert_to_vector(db_result).size();
+	});
+
+	bserv::memory_session_manager sessions;
+	std::string session_id;
+	std::shared_ptr<bserv::session_type> session_ptr;
+	sessions.get_or_create(session_id, session_ptr);
+	add("session.get_or_create", [&] {
+		std::string id = session_id;
+		std::shared_ptr<bserv::session_type> ptr;
+		return sessions.get_or_create(id, ptr) ? 1 : 0;
+	});
+
+	const boost::json::object context = make_list_context();
+	add("json.serialize/list", [&] {
+		return boost::json::serialize(context).size();
+	});
+	init_rendering(BSERV_TEMPLATE_ROOT);
+	bserv::response_type response;
+	add("render/list.html", [&] {
+		render(response, "list.html", context);
+		return response.body().size();
+	});
+
+	std::vector<result> results;
+	for (auto& [name, func] : benchmarks) {
+		results.push_back(measure(name, func));
+		if (!json)
+			std::cout << std::left << std::setw(24) << name
+				<< std::right << std::fixed << std::setprecision(1)
+				<< std::setw(12) << results.back().ns_per_op << " ns/op"
+				<< std::setw(12) << results.back().min_ns_per_op << " min"
+				<< std::endl;
+	}
+	if (json) {
+		std::cout << "{\"benchmarks\":[";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const result& r = results[i];
+			std::cout << (i == 0 ? "" : ",") << "\n{\"name\":\"" << r.name
+				<< "\",\"ns_per_op\":" << std::fixed << std::setprecision(1) << r.ns_per_op
+				<< ",\"min_ns_per_op\":" << r.min_ns_per_op
+				<< ",\"iterations\":" << r.iterations << '}';
+		}
+		std::cout << "\n]}" << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
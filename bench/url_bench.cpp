@@ -0,0 +1,246 @@
+// benchmarks `utils::decode_url`, `encode_url`, `parse_params` and `parse_url`
+// over search query strings like those sent to `/list/search?search=...`.
+// the previous (char by char) implementations are kept here as the baseline,
+// and the results of both are compared before timing.
+//
+// Usage: url_bench [iterations]
+#include <bserv/common.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+
+namespace baseline {
+
+	const std::string url_safe_characters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		"abcdefghijklmnopqrstuvwxyz"
+		"0123456789-._~";
+
+	std::string decode_url(const std::string& s) {
+		std::string r;
+		for (std::size_t i = 0; i < s.length(); ++i) {
+			if (s[i] == '%') {
+				int v = std::stoi(s.substr(i + 1, 2), nullptr, 16);
+				r.push_back(0xff & v);
+				i += 2;
+			}
+			else if (s[i] == '+') r.push_back(' ');
+			else r.push_back(s[i]);
+		}
+		return r;
+	}
+
+	std::string encode_url(const std::string& s) {
+		std::ostringstream oss;
+		for (auto& c : s) {
+			if (url_safe_characters.find(c) != std::string::npos) {
+				oss << c;
+			}
+			else {
+				oss << '%' << std::setfill('0') << std::setw(2) <<
+					std::uppercase << std::hex << (0xff & c);
+			}
+		}
+		return oss.str();
+	}
+
+	std::pair<
+		std::map<std::string, std::string>,
+		std::map<std::string, std::vector<std::string>>>
+		parse_params(std::string& s, std::size_t start_pos = 0, char delimiter = '&') {
+		std::map<std::string, std::string> dict_params;
+		std::map<std::string, std::vector<std::string>> list_params;
+		std::string key, value, * a = &key, * b = &value;
+		s.push_back(delimiter);
+		for (std::size_t i = start_pos; i < s.length(); ++i) {
+			if (s[i] == '=') {
+				std::swap(a, b);
+			}
+			else if (s[i] == delimiter) {
+				a = &key;
+				b = &value;
+				while (!key.empty() && key.back() == ' ') key.pop_back();
+				while (!value.empty() && value.back() == ' ') value.pop_back();
+				if (key.empty() && value.empty())
+					continue;
+				key = decode_url(key);
+				value = decode_url(value);
+				if (list_params.find(key) != list_params.end()) {
+					list_params[key].push_back(value);
+				}
+				else {
+					auto p = dict_params.find(key);
+					if (p != dict_params.end()) {
+						list_params[key] = { p->second, value };
+						dict_params.erase(p);
+					}
+					else {
+						dict_params[key] = value;
+					}
+				}
+				key = "";
+				value = "";
+			}
+			else {
+				if (a->empty() && s[i] == ' ') {
+					continue;
+				}
+				(*a) += s[i];
+			}
+		}
+		s.pop_back();
+		return std::make_pair(dict_params, list_params);
+	}
+
+	std::tuple<std::string,
+		std::map<std::string, std::string>,
+		std::map<std::string, std::vector<std::string>>>
+		parse_url(std::string& s) {
+		std::string url;
+		std::size_t i = 0;
+		for (; i < s.length(); ++i) {
+			if (s[i] != '?') {
+				url += s[i];
+			}
+			else {
+				break;
+			}
+		}
+		if (i == s.length())
+			return std::make_tuple(url,
+				std::map<std::string, std::string>{},
+				std::map<std::string, std::vector<std::string>>{});
+		auto&& [dict_params, list_params] = parse_params(s, i + 1);
+		return std::make_tuple(url, dict_params, list_params);
+	}
+
+}  // baseline
+
+// what users type into the search boxes of `list.html`
+const std::vector<std::string> search_terms{
+	"Yesterday",
+	"Bohemian Rhapsody",
+	"Hotel California (Live)",
+	"Don't Stop Me Now",
+	"Smells Like Teen Spirit",
+	"Fly Me to the Moon",
+	"AC/DC - Back in Black",
+	"Beyonc\xc3\xa9",
+	"Caf\xc3\xa9 del Mar & Friends",
+	"\xe6\x99\xb4\xe5\xa4\xa9",  // Sunny Day
+	"\xe5\x91\xa8\xe6\x9d\xb0\xe4\xbc\xa6",  // Jay Chou
+	"\xe4\xb8\x83\xe9\x87\x8c\xe9\xa6\x99",  // Common Jasmine Orange
+	"\xe5\x8f\xaa\xe8\xa6\x81\xe5\xb9\xb3\xe5\xb9\xb3\xe5\x87\xa1\xe5\x87\xa1",
+	"\xe3\x83\x97\xe3\x83\xa9\xe3\x82\xb9\xe3\x83\x81\xe3\x83\x83\xe3\x82\xaf\xe3\x83\xbb\xe3\x83\xa9\xe3\x83\x96",
+	"Symphony No. 9 in D minor, Op. 125: IV. Presto - Allegro assai",
+	"a",
+	"",
+};
+
+// the browser encodes ' ' as '+' in form submissions
+std::string form_encode(const std::string& s) {
+	std::string r;
+	for (auto& c : s) {
+		if (c == ' ') r += '+';
+		else r += bserv::utils::encode_url(std::string(1, c));
+	}
+	return r;
+}
+
+struct result {
+	std::string name;
+	double baseline_ns;
+	double current_ns;
+};
+
+template <typename Func>
+double measure(int iterations, std::size_t batch, Func&& func) {
+	// warms up
+	for (int i = 0; i < iterations / 10 + 1; ++i) func();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) func();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count()
+		/ iterations / batch;
+}
+
+// prevents the optimizer from removing the benchmarked calls
+volatile std::size_t sink = 0;
+
+int main(int argc, char* argv[]) {
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 20000;
+	if (iterations <= 0) {
+		std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> decoded, encoded, targets, bodies;
+	for (auto& term : search_terms) {
+		decoded.push_back(term);
+		encoded.push_back(form_encode(term));
+		targets.push_back("/list/search?search=" + encoded.back());
+		bodies.push_back("search=" + encoded.back() + "&page=1&sort=year&sort=name");
+	}
+
+	// checks that both implementations agree before timing them
+	for (std::size_t i = 0; i < decoded.size(); ++i) {
+		std::string t1 = targets[i], t2 = targets[i];
+		std::string b1 = bodies[i], b2 = bodies[i];
+		if (bserv::utils::decode_url(encoded[i]) != baseline::decode_url(encoded[i])
+			|| bserv::utils::encode_url(decoded[i]) != baseline::encode_url(decoded[i])
+			|| bserv::utils::parse_url(t1) != baseline::parse_url(t2)
+			|| bserv::utils::parse_params(b1) != baseline::parse_params(b2)) {
+			std::cerr << "results differ for: " << targets[i] << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<result> results;
+	auto run = [&](const std::string& name,
+		const std::vector<std::string>& inputs,
+		const std::function<std::size_t(std::string&)>& baseline_func,
+		const std::function<std::size_t(std::string&)>& current_func) {
+			std::vector<std::string> copies = inputs;
+			results.push_back({ name,
+				measure(iterations, copies.size(), [&] {
+					for (auto& s : copies) sink = sink + baseline_func(s);
+				}),
+				measure(iterations, copies.size(), [&] {
+					for (auto& s : copies) sink = sink + current_func(s);
+				}) });
+	};
+
+	run("decode_url", encoded,
+		[](std::string& s) { return baseline::decode_url(s).size(); },
+		[](std::string& s) { return bserv::utils::decode_url(s).size(); });
+	run("encode_url", decoded,
+		[](std::string& s) { return baseline::encode_url(s).size(); },
+		[](std::string& s) { return bserv::utils::encode_url(s).size(); });
+	run("parse_url", targets,
+		[](std::string& s) { return std::get<1>(baseline::parse_url(s)).size(); },
+		[](std::string& s) { return std::get<1>(bserv::utils::parse_url(s)).size(); });
+	run("parse_params", bodies,
+		[](std::string& s) { return baseline::parse_params(s).first.size(); },
+		[](std::string& s) { return bserv::utils::parse_params(s).first.size(); });
+
+	std::cout << std::left << std::setw(16) << "function"
+		<< std::right << std::setw(16) << "baseline ns/op"
+		<< std::setw(16) << "current ns/op"
+		<< std::setw(10) << "speedup" << '\n';
+	for (auto& r : results) {
+		std::cout << std::left << std::setw(16) << r.name
+			<< std::right << std::fixed << std::setprecision(1)
+			<< std::setw(16) << r.baseline_ns
+			<< std::setw(16) << r.current_ns
+			<< std::setw(9) << r.baseline_ns / r.current_ns << 'x' << '\n';
+	}
+	std::cout << std::flush;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "bserv/access_log.hpp"
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "bserv/config.hpp"
+
+namespace bserv {
+
+    namespace {
+
+        // the records formatted by the threads which map to it,
+        // waiting to be written
+        struct alignas(64) shard {
+            std::mutex lock;
+            std::string records;
+        };
+
+        std::array<shard, METRICS_SHARDS> shards_;
+
+        std::atomic<bool> open_{ false };
+        std::atomic<int> sample_{ 1 };
+        std::atomic<std::uint64_t> dropped_{ 0 };
+
+        // `file_` is only written by `writer_` while it runs
+        std::mutex writer_lock_;
+        std::condition_variable cv_;
+        bool stopped_ = true;
+        std::ofstream file_;
+        std::thread writer_;
+
+        std::size_t this_shard() {
+            static std::atomic<std::size_t> next{ 0 };
+            thread_local const std::size_t index =
+                next.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+            return index;
+        }
+
+        // xorshift64, seeded once per thread
+        std::uint64_t next_random() {
+            thread_local std::uint64_t state =
+                (std::uint64_t{ std::random_device{}() } << 32) | 1;
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+
+        void append_number(std::string& out, std::uint64_t n) {
+            char buf[24];
+            char* end = std::to_chars(buf, buf + sizeof(buf), n).ptr;
+            out.append(buf, end);
+        }
+
+        void append_string(std::string& out, std::string_view s) {
+            out += '"';
+            for (char c : s) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20) out += ' ';
+                else out += c;
+            }
+            out += '"';
+        }
+
+        std::uint64_t to_us(std::chrono::steady_clock::duration d) {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+            return us < 0 ? 0 : static_cast<std::uint64_t>(us);
+        }
+
+        // writes the records of all the shards, once in `ACCESS_LOG_FLUSH_INTERVAL`.
+        // the buffer of a shard is swapped with an empty one, so that the
+        // threads are not blocked while the records are written.
+        void run() {
+            std::string batch;
+            std::unique_lock<std::mutex> lock{ writer_lock_ };
+            while (true) {
+                bool stopped = stopped_;
+                lock.unlock();
+                for (shard& s : shards_) {
+                    {
+                        std::lock_guard<std::mutex> lg{ s.lock };
+                        batch.swap(s.records);
+                    }
+                    file_.write(batch.data(), batch.size());
+                    batch.clear();
+                }
+                file_.flush();
+                lock.lock();
+                if (stopped) break;
+                cv_.wait_for(lock, ACCESS_LOG_FLUSH_INTERVAL, [] { return stopped_; });
+            }
+        }
+
+    }  // namespace
+
+    bool open_access_log(const std::string& path, int sample) {
+        close_access_log();
+        file_.open(path, std::ios::binary | std::ios::app);
+        if (!file_) {
+            file_.clear();
+            return false;
+        }
+        for (shard& s : shards_) {
+            std::lock_guard<std::mutex> lg{ s.lock };
+            s.records.clear();
+        }
+        sample_ = sample < 1 ? 1 : sample;
+        stopped_ = false;
+        writer_ = std::thread{ run };
+        open_ = true;
+        return true;
+    }
+
+    void close_access_log() {
+        if (!open_.exchange(false)) return;
+        {
+            std::lock_guard<std::mutex> lg{ writer_lock_ };
+            stopped_ = true;
+        }
+        cv_.notify_one();
+        writer_.join();
+        file_.close();
+    }
+
+    bool access_log_sampled() {
+        if (!open_.load(std::memory_order_relaxed)) return false;
+        int sample = sample_.load(std::memory_order_relaxed);
+        return sample == 1 || next_random() % static_cast<std::uint64_t>(sample) == 0;
+    }
+
+    void log_access(const access_record& record) {
+        thread_local std::string line;
+        line.clear();
+        line += "{\"ts\":";
+        append_number(line, static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count()));
+        line += ",\"route\":";
+        append_string(line, record.route);
+        line += ",\"method\":";
+        append_string(line, record.method);
+        line += ",\"status\":";
+        append_number(line, record.status);
+        line += ",\"us\":";
+        append_number(line, to_us(record.latency));
+        line += ",\"db_us\":";
+        append_number(line, to_us(record.db_time));
+        line += ",\"in\":";
+        append_number(line, record.bytes_in);
+        line += ",\"out\":";
+        append_number(line, record.bytes_out);
+        line += "}\n";
+
+        shard& s = shards_[this_shard()];
+        std::lock_guard<std::mutex> lg{ s.lock };
+        if (s.records.size() + line.size() > ACCESS_LOG_BUFFER_SIZE / METRICS_SHARDS) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        s.records += line;
+    }
+
+    std::uint64_t access_log_dropped() {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+}  // bserv
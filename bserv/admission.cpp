@@ -0,0 +1,106 @@
+#include "pch.h"
+#include "bserv/admission.hpp"
+
+#include <limits>
+
+namespace bserv {
+
+    namespace {
+
+        using clock = std::chrono::steady_clock;
+
+        constexpr std::int64_t no_delay = std::numeric_limits<std::int64_t>::max();
+
+        std::int64_t to_ns(clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        }
+
+    }  // namespace
+
+    connection_ticket& connection_ticket::operator=(connection_ticket&& other) noexcept {
+        if (this != &other) {
+            if (controller_ != nullptr) --controller_->connections_;
+            controller_ = std::move(other.controller_);
+        }
+        return *this;
+    }
+
+    connection_ticket::~connection_ticket() {
+        if (controller_ != nullptr) --controller_->connections_;
+    }
+
+    admission_controller::admission_controller(
+        std::size_t max_connections, std::size_t max_in_flight,
+        std::chrono::milliseconds queue_target,
+        std::chrono::milliseconds queue_interval)
+        : max_connections_{ max_connections },
+        max_in_flight_{ max_in_flight },
+        queue_target_{ queue_target },
+        queue_interval_{ queue_interval },
+        min_delay_ns_{ no_delay },
+        interval_end_ns_{ to_ns((clock::now() + queue_interval_).time_since_epoch()) } {}
+
+    bool admission_controller::accepting() const {
+        return max_connections_ == 0
+            || connections_.load(std::memory_order_relaxed) < max_connections_;
+    }
+
+    connection_ticket admission_controller::try_connect() {
+        std::size_t connections = ++connections_;
+        if (max_connections_ != 0 && connections > max_connections_) {
+            --connections_;
+            ++rejected_connections_;
+            return {};
+        }
+        return connection_ticket{ shared_from_this() };
+    }
+
+    bool admission_controller::try_begin_request() {
+        std::size_t in_flight = ++in_flight_;
+        if (max_in_flight_ != 0 && in_flight > max_in_flight_) {
+            --in_flight_;
+            ++rejected_requests_;
+            return false;
+        }
+        return true;
+    }
+
+    void admission_controller::end_request() {
+        --in_flight_;
+    }
+
+    bool admission_controller::admit(clock::time_point received) {
+        if (queue_target_ == clock::duration::zero()) return true;
+        clock::time_point now = clock::now();
+        std::int64_t delay = to_ns(now - received);
+        std::int64_t min_delay = min_delay_ns_.load(std::memory_order_relaxed);
+        while (delay < min_delay
+            && !min_delay_ns_.compare_exchange_weak(min_delay, delay)) {}
+        // the thread which ends the interval decides for the next one
+        std::int64_t now_ns = to_ns(now.time_since_epoch());
+        std::int64_t interval_end = interval_end_ns_.load(std::memory_order_relaxed);
+        if (now_ns >= interval_end && interval_end_ns_.compare_exchange_strong(
+            interval_end, now_ns + to_ns(queue_interval_))) {
+            // the queue never drained below the target
+            overloaded_ = min_delay_ns_.exchange(no_delay) > to_ns(queue_target_);
+        }
+        clock::duration limit = overloaded_ ? queue_target_ : queue_interval_;
+        if (delay > to_ns(limit)) {
+            ++shed_requests_;
+            return false;
+        }
+        return true;
+    }
+
+    admission_stats admission_controller::stats() const {
+        return {
+            connections_.load(),
+            in_flight_.load(),
+            overloaded_.load(),
+            rejected_connections_.load(),
+            rejected_requests_.load(),
+            shed_requests_.load()
+        };
+    }
+
+}  // bserv
@@ -6,103 +6,230 @@
 #include <cstddef>
 #include <cstdlib>
 #include <vector>
+#include <deque>
+#include <exception>
 #include <optional>
 #include <functional>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
 #include <chrono>
+#include <limits>
+#include <cstdint>
+#include <string_view>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "bserv/server.hpp"
 
 #include "bserv/logging.hpp"
 #include "bserv/utils.hpp"
+#include "bserv/stack_pool.hpp"
+#include "bserv/handoff.hpp"
+#include "bserv/metrics.hpp"
+#include "bserv/tracing.hpp"
+#include "bserv/access_log.hpp"
 #include "bserv/client.hpp"
+#include "bserv/db_backend.hpp"
 #include "bserv/websocket.hpp"
 
 namespace bserv {
 
-	std::string get_address(const tcp::socket& socket) {
+#ifdef SO_REUSEPORT
+#define BSERV_HAS_REUSE_PORT
+	using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+	// the cpus this process may run on
+	std::vector<int> get_allowed_cpus() {
+		std::vector<int> cpus;
+#ifdef __linux__
+		cpu_set_t set;
+		if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+			for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+				if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+		}
+#endif
+		return cpus;
+	}
+
+	// pins the calling thread to `cpu`
+	void pin_thread(int cpu) {
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			lgwarning << "failed to pin thread to cpu " << cpu << std::endl;
+#else
+		boost::ignore_unused(cpu);
+#endif
+	}
+
+	template <typename Socket>
+	std::string get_address(const Socket& socket) {
 		tcp::endpoint end_point = socket.remote_endpoint();
 		std::string addr = end_point.address().to_string()
 			+ ':' + std::to_string(end_point.port());
 		return addr;
 	}
 
-	http::response<http::string_body> handle_request(
-		http::request<http::string_body>& req, router& routes,
-		std::shared_ptr<websocket_session> ws_session,
-		asio::io_context& ioc, asio::yield_context& yield) {
+	// serializes `val` into `out`, reusing the capacity of `out`
+	void serialize_to(const json::value& val, std::string& out) {
+		json::serializer sr;
+		sr.reset(&val);
+		out.clear();
+		while (!sr.done()) {
+			std::size_t size = out.size();
+			if (out.capacity() - size < 64)
+				out.reserve(2 * out.capacity() + 64);
+			out.resize(out.capacity());
+			size += sr.read(&out[size], out.size() - size).size();
+			out.resize(size);
+		}
+	}
 
-		const auto bad_request = [&req](beast::string_view why) {
-			http::response<http::string_body> res{
-				http::status::bad_request, req.version() };
-			res.set(http::field::server, NAME);
-			res.set(http::field::content_type, "text/html");
-			res.keep_alive(req.keep_alive());
-			res.body() = std::string{ why };
-			res.prepare_payload();
-			return res;
-		};
+	// the target of `req` without the query string
+	boost::string_view get_url(const http::request<http::string_body>& req) {
+		boost::string_view target = req.target();
+		auto pos = target.find('?');
+		if (pos == boost::string_view::npos) return target;
+		return target.substr(0, pos);
+	}
 
-		const auto not_found = [&req](beast::string_view target) {
-			http::response<http::string_body> res{
-				http::status::not_found, req.version() };
-			res.set(http::field::server, NAME);
-			res.set(http::field::content_type, "text/html");
-			res.keep_alive(req.keep_alive());
-			res.body() = "The requested url '"
-				+ std::string{ target } + "' does not exist.";
-			res.prepare_payload();
-			return res;
-		};
+	// resets `res` for the response to `req`. the body of `res` is
+	// cleared, but its capacity is kept.
+	void init_response(
+		http::request<http::string_body>& req,
+		http::response<http::string_body>& res) {
+		res.base() = {};
+		res.result(http::status::ok);
+		res.version(req.version());
+		res.body().clear();
+		res.set(http::field::server, NAME);
+		res.set(http::field::content_type, "application/json");
+		res.keep_alive(req.keep_alive());
+	}
 
-		const auto server_error = [&req](beast::string_view what) {
-			http::response<http::string_body> res{
-				http::status::internal_server_error, req.version() };
+	// produces the response to `req` for the exception `error`,
+	// which is thrown while handling the request
+	void set_error_response(
+		http::request<http::string_body>& req,
+		http::response<http::string_body>& res,
+		std::exception_ptr error) {
+
+		const auto make_response = [&req](
+			http::status status, std::string&& body) {
+			http::response<http::string_body> res{ status, req.version() };
 			res.set(http::field::server, NAME);
 			res.set(http::field::content_type, "text/html");
 			res.keep_alive(req.keep_alive());
-			res.body() = "Internal server error: " + std::string{ what };
+			res.body() = std::move(body);
 			res.prepare_payload();
 			return res;
 		};
 
-		boost::string_view target = req.target();
-		auto pos = target.find('?');
-		boost::string_view url;
-		if (pos == boost::string_view::npos) url = target;
-		else url = target.substr(0, pos);
-
-		http::response<http::string_body> res{
-			http::status::ok, req.version() };
-		res.set(http::field::server, NAME);
-		res.set(http::field::content_type, "application/json");
-		res.keep_alive(req.keep_alive());
-
-		std::optional<boost::json::value> val;
 		try {
-			val = routes(ioc, yield, ws_session, std::string{ url }, req, res);
+			std::rethrow_exception(error);
 		}
 		catch (const url_not_found_exception& /*e*/) {
-			return not_found(url);
+			res = make_response(http::status::not_found,
+				"The requested url '" + std::string{ get_url(req) } + "' does not exist.");
 		}
 		catch (const bad_request_exception& /*e*/) {
-			return bad_request("Request body is not a valid JSON string.");
+			res = make_response(http::status::bad_request,
+				"Request body is not a valid JSON string.");
+		}
+		catch (const payload_too_large_exception& /*e*/) {
+			res = make_response(http::status::payload_too_large,
+				"Request body is too large.");
+		}
+		catch (const service_unavailable_exception& /*e*/) {
+			res = make_response(http::status::service_unavailable,
+				"The server is overloaded, please retry later.");
+			res.set(http::field::retry_after, std::to_string(RETRY_AFTER));
 		}
 		catch (const std::exception& e) {
-			return server_error(e.what());
+			res = make_response(http::status::internal_server_error,
+				"Internal server error: " + std::string{ e.what() });
 		}
 		catch (...) {
-			return server_error("Unknown exception.");
+			res = make_response(http::status::internal_server_error,
+				"Internal server error: Unknown exception.");
 		}
+	}
 
+	// writes the value returned by the handler (if any) to `res`
+	void finish_response(
+		http::response<http::string_body>& res,
+		const std::optional<boost::json::value>& val) {
 		if (val.has_value()) {
-			res.body() = json::serialize(val.value());
+			scoped_latency timer{ metrics().serialize };
+			trace_span span{ "serialize" };
+			serialize_to(val.value(), res.body());
 			res.prepare_payload();
 		}
+	}
+
+	// produces the response to `req` in `res` with `path`, which is
+	// the path matched by `routes` (or nullptr if no path matches).
+	void handle_request(
+		http::request<http::string_body>& req,
+		http::response<http::string_body>& res, router& routes,
+		router_internal::path_holder* path,
+		const std::vector<std::string>& url_params,
+		std::shared_ptr<websocket_session> ws_session,
+		asio::io_context& ioc, asio::yield_context& yield) {
+		init_response(req, res);
+		std::optional<boost::json::value> val;
+		try {
+			if (path == nullptr) throw url_not_found_exception{};
+			val = routes.invoke(*path, ioc, &yield, ws_session, url_params, req, res);
+		}
+		catch (...) {
+			set_error_response(req, res, std::current_exception());
+			return;
+		}
+		finish_response(res, val);
+	}
 
+	http::response<http::string_body> handle_request(
+		http::request<http::string_body>& req, router& routes,
+		std::shared_ptr<websocket_session> ws_session,
+		asio::io_context& ioc, asio::yield_context& yield) {
+		http::response<http::string_body> res;
+		std::vector<std::string> url_params;
+		router_internal::path_holder* path =
+			routes.find(std::string{ get_url(req) }, url_params);
+		handle_request(req, res, routes, path, url_params, ws_session, ioc, yield);
 		return res;
 	}
 
+#ifdef BSERV_HAS_CO_AWAIT
+	// the same as `handle_request`, for a handler which is a C++20 coroutine
+	awaitable<void> co_handle_request(
+		http::request<http::string_body>& req,
+		http::response<http::string_body>& res, router& routes,
+		router_internal::path_holder& path,
+		const std::vector<std::string>& url_params,
+		asio::io_context& ioc) {
+		init_response(req, res);
+		std::optional<boost::json::value> val;
+		try {
+			val = co_await routes.co_invoke(path, ioc, nullptr, url_params, req, res);
+		}
+		catch (...) {
+			set_error_response(req, res, std::current_exception());
+			co_return;
+		}
+		finish_response(res, val);
+	}
+#endif
+
 	class websocket_session_server;
 
 	void handle_websocket_request(
@@ -119,14 +246,16 @@ namespace bserv {
 		std::shared_ptr<websocket_session> session_;
 		http::request<http::string_body> req_;
 		router& routes_;
+		const std::size_t stack_size_;
+		connection_ticket ticket_;
 		void on_accept(beast::error_code ec) {
 			if (ec) {
 				fail(ec, "websocket_session_server accept");
 				return;
 			}
 			// handles request here
-			asio::spawn(
-				session_->ioc_,
+			bserv::spawn(
+				asio::make_strand(session_->ioc_),
 				std::bind(
 					&handle_websocket_request,
 					shared_from_this(),
@@ -134,22 +263,22 @@ namespace bserv {
 					std::ref(req_),
 					std::ref(routes_),
 					std::ref(session_->ioc_),
-					std::placeholders::_1)
-#ifdef _MSC_VER
-				, boost::coroutines::attributes{ STACK_SIZE }
-#endif
-			);
+					std::placeholders::_1),
+				stack_size_);
 		}
 	public:
 		explicit websocket_session_server(
 			asio::io_context& ioc,
 			tcp::socket&& socket,
 			http::request<http::string_body>&& req,
-			router& routes)
+			router& routes, std::size_t stack_size,
+			connection_ticket&& ticket)
 			: address_{ get_address(socket) },
 			session_{ std::make_shared<
 				websocket_session>(address_, ioc, std::move(socket)) },
-			req_{ std::move(req) }, routes_{ routes } {
+			req_{ std::move(req) }, routes_{ routes },
+			stack_size_{ stack_size },
+			ticket_{ std::move(ticket) } {
 			lgtrace << "websocket_session_server opened: " << address_;
 		}
 		~websocket_session_server() {
@@ -187,10 +316,14 @@ namespace bserv {
 	}
 
 	std::string websocket_server::read() {
+		if (yield_ == nullptr)
+			throw websocket_io_exception{
+				"websocket_server: a coroutine handler should use the co_ functions" };
+		const trace_guard guard;
 		beast::error_code ec;
 		beast::flat_buffer buffer;
 		// reads a message into the buffer
-		session_.ws_.async_read(buffer, yield_[ec]);
+		session_.ws_.async_read(buffer, (*yield_)[ec]);
 		lgtrace << "websocket_server: read from " << session_.address_;
 		// this indicates that the session was closed
 		if (ec == websocket::error::closed) {
@@ -205,9 +338,13 @@ namespace bserv {
 	}
 
 	void websocket_server::write(const std::string& data) {
+		if (yield_ == nullptr)
+			throw websocket_io_exception{
+				"websocket_server: a coroutine handler should use the co_ functions" };
+		const trace_guard guard;
 		beast::error_code ec;
 		// ws_.text(ws_.got_text());
-		session_.ws_.async_write(asio::buffer(data), yield_[ec]);
+		session_.ws_.async_write(asio::buffer(data), (*yield_)[ec]);
 		lgtrace << "websocket_server: write to " << session_.address_;
 		if (ec) {
 			fail(ec, "websocket_server write");
@@ -216,135 +353,557 @@ namespace bserv {
 	}
 
 
-	class http_session;
+#ifdef BSERV_HAS_CO_AWAIT
+	awaitable<std::string> websocket_server::co_read() {
+		const trace_guard guard;
+		beast::error_code ec;
+		beast::flat_buffer buffer;
+		// reads a message into the buffer
+		co_await session_.ws_.async_read(
+			buffer, asio::redirect_error(use_awaitable, ec));
+		lgtrace << "websocket_server: read from " << session_.address_;
+		// this indicates that the session was closed
+		if (ec == websocket::error::closed) {
+			throw websocket_closed{};
+		}
+		if (ec) {
+			fail(ec, "websocket_server read");
+			throw websocket_io_exception{ "websocket_server read: " + ec.message() };
+		}
+		co_return beast::buffers_to_string(buffer.data());
+	}
 
-	// this function produces an HTTP response for the given
-	// request. The type of the response object depends on the
-	// contents of the request, so the interface requires the
-	// caller to pass a generic lambda for receiving the response.
-	// NOTE: `send` should be called only once!
-	template <class Send>
-	void handle_http_request(
-		std::shared_ptr<http_session>,
-		http::request<http::string_body> req,
-		Send& send, router& routes, asio::io_context& ioc, asio::yield_context yield) {
-		send(handle_request(req, routes, nullptr, ioc, yield));
+	awaitable<void> websocket_server::co_write(std::string data) {
+		const trace_guard guard;
+		beast::error_code ec;
+		co_await session_.ws_.async_write(
+			asio::buffer(data), asio::redirect_error(use_awaitable, ec));
+		lgtrace << "websocket_server: write to " << session_.address_;
+		if (ec) {
+			fail(ec, "websocket_server write");
+			throw websocket_io_exception{ "websocket_server write: " + ec.message() };
+		}
 	}
+#endif
+
+	using strand_type = asio::strand<asio::io_context::executor_type>;
+	// the stream of an http session. the executor type is concrete,
+	// so that it is not type-erased (and allocated) for each operation.
+	using http_stream = beast::basic_stream<tcp, strand_type>;
+
+	// a per-thread free list of objects, which are recycled
+	// rather than allocated and freed for each use.
+	template <typename Type>
+	class object_pool {
+	private:
+		std::vector<std::unique_ptr<Type>> free_;
+		object_pool() = default;
+	public:
+		static object_pool& local() {
+			thread_local object_pool pool;
+			return pool;
+		}
+		std::unique_ptr<Type> acquire() {
+			if (free_.empty()) return std::make_unique<Type>();
+			std::unique_ptr<Type> ptr = std::move(free_.back());
+			free_.pop_back();
+			return ptr;
+		}
+		void release(std::unique_ptr<Type> ptr) {
+			if (free_.size() < HTTP_POOL_SIZE)
+				free_.push_back(std::move(ptr));
+		}
+	};
 
-	// handles an HTTP server connection
+	// a request and its response, which are reused
+	// across keep-alive requests and across sessions.
+	struct http_exchange {
+		http::request<http::string_body> request;
+		http::response<http::string_body> response;
+		// the path matched by the router, and the parameters in the url
+		router_internal::path_holder* path = nullptr;
+		std::vector<std::string> url_params;
+		// when the request was read, for the admission control
+		std::chrono::steady_clock::time_point received;
+		// 0 if the tracing is disabled
+		std::uint64_t trace = 0;
+		// when its first byte was read
+		std::chrono::steady_clock::time_point started;
+		// for the access log
+		std::size_t bytes_read = 0;
+		std::chrono::steady_clock::duration db_time{ 0 };
+		// whether the response is ready to be written
+		bool done = false;
+		// frees the memory which is too large to be kept
+		void trim() {
+			done = false;
+			path = nullptr;
+			trace = 0;
+			bytes_read = 0;
+			db_time = std::chrono::steady_clock::duration{ 0 };
+			request.body().clear();
+			if (request.body().capacity() > HTTP_RETAINED_SIZE)
+				request.body().shrink_to_fit();
+			if (response.body().capacity() > HTTP_RETAINED_SIZE) {
+				response.body().clear();
+				response.body().shrink_to_fit();
+			}
+		}
+	};
+
+	// the limits of the http sessions, which are taken from the config
+	struct http_options {
+		std::size_t stack_size;
+		std::size_t body_limit;
+		// zero if it is disabled
+		std::chrono::seconds header_timeout;
+		std::chrono::seconds body_timeout;
+		std::chrono::seconds handler_timeout;
+		std::chrono::seconds idle_timeout;
+		std::chrono::seconds write_timeout;
+		int keep_alive_requests;
+		explicit http_options(const server_config& config)
+			: stack_size{ config.get_stack_size() },
+			body_limit{ config.get_payload_limit() },
+			header_timeout{ config.get_header_timeout() },
+			body_timeout{ config.get_body_timeout() },
+			handler_timeout{ config.get_handler_timeout() },
+			idle_timeout{ config.get_idle_timeout() },
+			write_timeout{ config.get_write_timeout() },
+			keep_alive_requests{ config.get_keep_alive_requests() } {}
+		// the shortest of the timeouts (or zero)
+		std::chrono::seconds min_timeout() const {
+			std::chrono::seconds result{ 0 };
+			for (auto timeout : { header_timeout, body_timeout,
+				handler_timeout, idle_timeout })
+				if (timeout.count() > 0 && (result.count() == 0 || timeout < result))
+					result = timeout;
+			return result;
+		}
+	};
+
+	class http_session;
+
+	// the open http sessions, which are drained on shutdown
+	class http_session_registry {
+	private:
+		std::mutex lock_;
+		std::unordered_set<http_session*> sessions_;
+		std::atomic<bool> draining_{ false };
+	public:
+		void add(http_session* session) {
+			std::lock_guard<std::mutex> lg{ lock_ };
+			sessions_.insert(session);
+		}
+		void remove(http_session* session) {
+			std::lock_guard<std::mutex> lg{ lock_ };
+			sessions_.erase(session);
+		}
+		std::size_t size() {
+			std::lock_guard<std::mutex> lg{ lock_ };
+			return sessions_.size();
+		}
+		bool draining() const { return draining_; }
+		// asks each session to answer the requests it has received,
+		// and then to close
+		void drain();
+	};
+
+	// handles an HTTP server connection.
+	// requests are read ahead (pipelined) up to `HTTP_PIPELINE_LIMIT`,
+	// handled concurrently, and answered in the order they were received.
 	class http_session
 		: public std::enable_shared_from_this<http_session> {
 	private:
-		// the function object is used to send an HTTP message.
-		class send_lambda {
-		private:
-			http_session& self_;
-		public:
-			send_lambda(http_session& self)
-				: self_{ self } {}
-			template <bool isRequest, class Body, class Fields>
-			void operator()(
-				http::message<isRequest, Body, Fields>&& msg) const {
-				// the lifetime of the message has to extend
-				// for the duration of the async operation so
-				// we use a shared_ptr to manage it.
-				auto sp = std::make_shared<
-					http::message<isRequest, Body, Fields>>(
-						std::move(msg));
-				// stores a type-erased version of the shared
-				// pointer in the class to keep it alive.
-				self_.res_ = sp;
-				// writes the response
-				http::async_write(
-					self_.stream_, *sp,
-					beast::bind_front_handler(
-						&http_session::on_write,
-						self_.shared_from_this(),
-						sp->need_eof()));
-			}
-		} lambda_;
+		using exchange_ptr = std::unique_ptr<http_exchange>;
+		using clock = std::chrono::steady_clock;
+		using timer_type = asio::basic_waitable_timer<
+			clock, asio::wait_traits<clock>, strand_type>;
+		// the state of the request being read
+		enum class read_state { idle, header, body };
 		asio::io_context& ioc_;
-		beast::tcp_stream stream_;
-		beast::flat_buffer buffer_;
+		http_stream stream_;
+		std::unique_ptr<beast::flat_buffer> buffer_;
 		boost::optional<
 			http::request_parser<http::string_body>> parser_;
-		std::shared_ptr<void> res_;
+		// the exchange being read
+		exchange_ptr reading_;
+		read_state read_state_ = read_state::idle;
+		// when the header (or the body) of the request began to arrive
+		clock::time_point read_start_;
+		clock::time_point write_start_;
+		// the requests that are not answered yet, in order
+		std::deque<exchange_ptr> queue_;
+		// idle strands for handling the requests
+		std::vector<strand_type> strands_;
+		// enforces the timeouts of reading, handling and being idle.
+		// the reads cannot use the timeout of the stream, because
+		// a read is pending while requests are handled.
+		timer_type timer_;
+		std::chrono::steady_clock::time_point last_active_;
+		// the number of requests received
+		int requests_ = 0;
+		bool writing_ = false;
+		// no more requests will be read
+		bool eof_ = false;
+		// a websocket upgrade is waiting for the queue to drain
+		bool upgrade_ = false;
+		// the server is shutting down
+		bool draining_ = false;
+		bool closed_ = false;
 		router& routes_;
 		router& ws_routes_;
+		const http_options& options_;
+		admission_controller& admission_;
+		connection_ticket ticket_;
+		std::shared_ptr<http_session_registry> registry_;
 		const std::string address_;
+		void do_start() {
+			// it is accepted while draining: one request is answered
+			if (registry_->draining()) draining_ = true;
+			do_read();
+			on_timer({});
+		}
 		void do_read() {
-			// constructs a new parser for each message
-			parser_.emplace();
-			// applies a reasonable limit to the allowed size
-			// of the body in bytes to prevent abuse.
-			parser_->body_limit(PAYLOAD_LIMIT);
-			// sets the timeout.
-			stream_.expires_after(std::chrono::seconds(EXPIRY_TIME));
-			// reads a request using the parser-oriented interface
-			http::async_read(
-				stream_, buffer_, *parser_,
+			if (eof_ || closed_ || reading_ != nullptr
+				|| queue_.size() >= HTTP_PIPELINE_LIMIT) return;
+			beast::flat_buffer& buffer = *buffer_;
+			if (buffer.size() == 0 && buffer.capacity() > HTTP_RETAINED_SIZE)
+				buffer.shrink_to_fit();
+			reading_ = object_pool<http_exchange>::local().acquire();
+			// constructs a new parser for each message, which
+			// takes over the (empty) body of a recycled request.
+			parser_.emplace(
+				std::piecewise_construct,
+				std::make_tuple(std::move(reading_->request.body())));
+			// the limit depends on the route, which is checked after
+			// the header is read (see `on_read_header`)
+			parser_->body_limit((std::numeric_limits<std::uint64_t>::max)());
+			stream_.expires_never();
+			if (buffer.size() > 0) {
+				do_read_header();
+				return;
+			}
+			// waits for the first byte of the request, so that the time
+			// it is idle is not counted towards the header timeout.
+			read_state_ = read_state::idle;
+			stream_.socket().async_wait(
+				tcp::socket::wait_read,
 				beast::bind_front_handler(
-					&http_session::on_read,
+					&http_session::on_readable,
 					shared_from_this()));
 		}
-		void on_read(
+		void on_readable(beast::error_code ec) {
+			if (closed_) {
+				reading_.reset();
+				return;
+			}
+			if (ec) {
+				reading_.reset();
+				fail(ec, "http_session async_wait");
+				do_abort();
+				return;
+			}
+			do_read_header();
+		}
+		void do_read_header() {
+			// the write timeout of a response which was sent while the
+			// session was idle (`async_wait` is not a read of the stream)
+			// also applies to the next read. the deadlines of the reads
+			// are checked by `on_timer`.
+			stream_.expires_never();
+			read_state_ = read_state::header;
+			read_start_ = clock::now();
+			http::async_read_header(
+				stream_, *buffer_, *parser_,
+				beast::bind_front_handler(
+					&http_session::on_read_header,
+					shared_from_this()));
+		}
+		void on_read_header(
 			beast::error_code ec,
 			std::size_t bytes_transferred) {
 			boost::ignore_unused(bytes_transferred);
-			lgtrace << "received " << bytes_transferred << " byte(s) from: " << address_;
+			if (closed_) {
+				reading_.reset();
+				return;
+			}
 			// this means they closed the connection
 			if (ec == http::error::end_of_stream) {
-				do_close();
+				reading_.reset();
+				eof_ = true;
+				// answers the requests that are already read
+				if (queue_.empty()) do_close();
 				return;
 			}
 			if (ec) {
-				fail(ec, "http_session async_read");
+				reading_.reset();
+				fail(ec, "http_session async_read_header");
+				do_abort();
 				return;
 			}
+			last_active_ = clock::now();
 
 			// sees if it is a websocket upgrade
 			if (websocket::is_upgrade(parser_->get())) {
-				// creates a websocket session, transferring ownership
-				// of both the socket and the http request
-				std::make_shared<websocket_session_server>(
-					ioc_,
-					stream_.release_socket(),
-					parser_->release(),
-					ws_routes_
-					)->do_accept();
+				reading_.reset();
+				eof_ = true;
+				upgrade_ = true;
+				if (queue_.empty()) do_upgrade();
 				return;
 			}
 
-			// handles the request and sends the response
-
-			asio::spawn(
-				ioc_,
+			std::string url{ get_url(parser_->get()) };
+			reading_->trace = new_trace_id();
+			reading_->started = read_start_;
+			reading_->bytes_read = bytes_transferred;
+			{
+				trace_span span{ "route", reading_->trace };
+				reading_->path = routes_.find(url, reading_->url_params);
+			}
+			std::uint64_t body_limit = options_.body_limit;
+			if (reading_->path != nullptr && reading_->path->body_limit.has_value())
+				body_limit = reading_->path->body_limit.value();
+			if (parser_->content_length().value_or(0) > body_limit) {
+				do_reject(payload_too_large_exception{});
+				return;
+			}
+			// a chunked body is checked as it is parsed
+			parser_->body_limit(body_limit);
+			if (parser_->is_done()) {
+				on_read({}, 0);
+				return;
+			}
+			read_state_ = read_state::body;
+			read_start_ = last_active_;
+			http::async_read(
+				stream_, *buffer_, *parser_,
+				beast::bind_front_handler(
+					&http_session::on_read,
+					shared_from_this()));
+		}
+		void on_read(
+			beast::error_code ec,
+			std::size_t bytes_transferred) {
+			boost::ignore_unused(bytes_transferred);
+			lgtrace << "received " << bytes_transferred << " byte(s) from: " << address_;
+			if (closed_) {
+				reading_.reset();
+				return;
+			}
+			if (ec == http::error::body_limit) {
+				do_reject(payload_too_large_exception{});
+				return;
+			}
+			if (ec) {
+				reading_.reset();
+				fail(ec, "http_session async_read");
+				do_abort();
+				return;
+			}
+			last_active_ = clock::now();
+			exchange_ptr ex = std::move(reading_);
+			ex->request = parser_->release();
+			ex->received = last_active_;
+			ex->bytes_read += bytes_transferred;
+			record_span("read", ex->trace, ex->started, ex->received);
+			// the response to the last request closes the connection
+			if (draining_ || (options_.keep_alive_requests > 0
+				&& ++requests_ >= options_.keep_alive_requests))
+				ex->request.keep_alive(false);
+			if (!ex->request.keep_alive()) eof_ = true;
+			if (!admission_.try_begin_request()) {
+				// too many requests are being handled
+				set_unavailable(ex.get());
+				ex->done = true;
+				queue_.push_back(std::move(ex));
+				do_write();
+				do_read();
+				return;
+			}
+			if (ex->path != nullptr)
+				lgtrace << "router: received request: " << get_url(ex->request);
+			http_exchange* ptr = ex.get();
+			queue_.push_back(std::move(ex));
+			if (strands_.empty())
+				strands_.push_back(asio::make_strand(ioc_));
+			strand_type strand = std::move(strands_.back());
+			strands_.pop_back();
+			// handles the request on its own strand, so that it does not
+			// block the reading of the next request.
+#ifdef BSERV_HAS_CO_AWAIT
+			if (ptr->path != nullptr && ptr->path->is_coroutine()) {
+				// a coroutine handler does not need a stack of its own.
+				// the trace of the request is set whenever it is resumed.
+				asio::co_spawn(
+					traced_executor<strand_type>{ strand, ptr->trace, &ptr->db_time },
+					co_handle(shared_from_this(), strand, ptr),
+					asio::detached);
+			}
+			else
+#endif
+			// it is posted, because `asio::spawn` may run
+			// the handler inline on this strand.
+			asio::post(
+				strand,
+				beast::bind_front_handler(
+					&http_session::do_spawn,
+					shared_from_this(),
+					strand, ptr));
+			// reads the next request
+			do_read();
+		}
+		// answers the request being read with the error `e`, and closes
+		// the connection, as the rest of the request is not read.
+		template <typename Exception>
+		void do_reject(Exception&& e) {
+			exchange_ptr ex = std::move(reading_);
+			ex->request = parser_->release();
+			ex->request.body().clear();
+			ex->request.keep_alive(false);
+			eof_ = true;
+			init_response(ex->request, ex->response);
+			set_error_response(
+				ex->request, ex->response,
+				std::make_exception_ptr(std::forward<Exception>(e)));
+			ex->done = true;
+			queue_.push_back(std::move(ex));
+			do_write();
+		}
+		// answers the request with 503
+		void set_unavailable(http_exchange* ex) {
+			init_response(ex->request, ex->response);
+			set_error_response(
+				ex->request, ex->response,
+				std::make_exception_ptr(service_unavailable_exception{}));
+		}
+		// passes the response back to the strand of the session
+		void post_handled(strand_type strand, http_exchange* ex) {
+			asio::post(
+				stream_.get_executor(),
+				beast::bind_front_handler(
+					&http_session::on_handled,
+					shared_from_this(),
+					std::move(strand), ex));
+		}
+		void do_spawn(strand_type strand, http_exchange* ex) {
+			// the request is shed before a stack is allocated for it
+			if (!admission_.admit(ex->received)) {
+				set_unavailable(ex);
+				post_handled(std::move(strand), ex);
+				return;
+			}
+			// the stack is taken from (and returned to) a per-thread pool
+			bserv::spawn(
+				strand,
 				std::bind(
-					&handle_http_request<send_lambda>,
+					&http_session::do_handle,
 					shared_from_this(),
-					parser_->release(),
-					std::ref(lambda_),
-					std::ref(routes_),
-					std::ref(ioc_),
-					std::placeholders::_1)
-#ifdef _MSC_VER
-				// currently, it is only identified on windows
-				// that the default stack size is too small
-				, boost::coroutines::attributes{ STACK_SIZE }
+					strand, ex,
+					std::placeholders::_1),
+				options_.stack_size);
+		}
+		void do_handle(
+			strand_type strand, http_exchange* ex,
+			asio::yield_context yield) {
+			{
+				trace_scope scope{ ex->trace, &ex->db_time };
+				record_span("queue", ex->trace, ex->received, clock::now());
+				trace_span span{ "handle" };
+				handle_request(
+					ex->request, ex->response, routes_,
+					ex->path, ex->url_params, nullptr, ioc_, yield);
+			}
+			post_handled(std::move(strand), ex);
+		}
+#ifdef BSERV_HAS_CO_AWAIT
+		// `self` keeps the session alive in the coroutine frame
+		awaitable<void> co_handle(
+			std::shared_ptr<http_session> self,
+			strand_type strand, http_exchange* ex) {
+			if (!admission_.admit(ex->received))
+				set_unavailable(ex);
+			else {
+				// the trace is set by `traced_executor`, on which this is
+				// spawned, so that it is not left set while the handler is
+				// suspended
+				record_span("queue", ex->trace, ex->received, clock::now());
+				trace_span span{ "handle" };
+				co_await co_handle_request(
+					ex->request, ex->response, routes_,
+					*ex->path, ex->url_params, ioc_);
+			}
+			asio::post(
+				stream_.get_executor(),
+				beast::bind_front_handler(
+					&http_session::on_handled,
+					std::move(self),
+					std::move(strand), ex));
+		}
 #endif
-			);
-			// handle_request(parser_->release(), lambda_, routes_);
-
-			// at this point the parser can be reset
+		void on_handled(strand_type strand, http_exchange* ex) {
+			admission_.end_request();
+			(ex->path != nullptr ? *ex->path->latency : metrics().unmatched)
+				.record(std::chrono::steady_clock::now() - ex->received);
+			strands_.push_back(std::move(strand));
+			ex->done = true;
+			do_write();
+		}
+		void do_write() {
+			if (writing_ || closed_ || queue_.empty()
+				|| !queue_.front()->done) return;
+			writing_ = true;
+			http::response<http::string_body>& res = queue_.front()->response;
+			metrics().record_status(res.result_int());
+			write_start_ = clock::now();
+			// tells the client that no more requests are answered
+			if (draining_ && queue_.size() == 1
+				&& (reading_ == nullptr || read_state_ == read_state::idle))
+				res.keep_alive(false);
+			// sets the timeout.
+			if (options_.write_timeout.count() > 0)
+				stream_.expires_after(options_.write_timeout);
+			// writes the response
+			http::async_write(
+				stream_, res,
+				beast::bind_front_handler(
+					&http_session::on_write,
+					shared_from_this(),
+					res.need_eof()));
 		}
 		void on_write(
 			bool close, beast::error_code ec,
 			std::size_t bytes_transferred) {
 			boost::ignore_unused(bytes_transferred);
-			// we're done with the response so delete it
-			res_.reset();
+			writing_ = false;
+			// we're done with the request and the response
+			exchange_ptr ex = std::move(queue_.front());
+			queue_.pop_front();
+			bool logged = !ec && access_log_sampled();
+			if (ex->trace != 0 || logged) {
+				clock::time_point now = clock::now();
+				if (ex->trace != 0) {
+					record_span("write", ex->trace, write_start_, now);
+					record_span("request", ex->trace, ex->started, now,
+						std::string{ ex->request.method_string() } + ' '
+						+ std::string{ ex->request.target() });
+				}
+				if (logged) {
+					auto method = ex->request.method_string();
+					log_access({
+						ex->path != nullptr
+						? std::string_view{ ex->path->route } : std::string_view{ "(unmatched)" },
+						std::string_view{ method.data(), method.size() },
+						ex->response.result_int(), now - ex->started,
+						ex->db_time, ex->bytes_read, bytes_transferred });
+				}
+			}
+			ex->trim();
+			object_pool<http_exchange>::local().release(std::move(ex));
+			if (closed_) return;
 			if (ec) {
 				fail(ec, "http_session async_write");
+				do_abort();
 				return;
 			}
 			lgtrace << "sent " << bytes_transferred << " byte(s) to: " << address_;
@@ -354,79 +913,264 @@ namespace bserv {
 				do_close();
 				return;
 			}
-			// reads another request
+			last_active_ = clock::now();
+			if (queue_.empty() && upgrade_) {
+				do_upgrade();
+				return;
+			}
+			if (queue_.empty() && eof_
+				&& (reading_ == nullptr || read_state_ == read_state::idle)) {
+				do_close();
+				return;
+			}
+			// reads another request if the queue was full,
+			// and writes the next response if it is ready
 			do_read();
+			do_write();
+		}
+		// the time at which `timeout` after `start` expires
+		static clock::time_point expiry(
+			clock::time_point start, std::chrono::seconds timeout) {
+			return timeout.count() > 0 ? start + timeout : (clock::time_point::max)();
+		}
+		void on_timer(beast::error_code ec) {
+			if (ec == asio::error::operation_aborted || closed_) return;
+			clock::time_point now = clock::now();
+			clock::time_point deadline = (clock::time_point::max)();
+			const char* expired = nullptr;
+			const auto check = [&](clock::time_point t, const char* what) {
+				if (t <= now) {
+					if (expired == nullptr) expired = what;
+				}
+				else if (t < deadline) deadline = t;
+			};
+			bool idle = reading_ == nullptr || read_state_ == read_state::idle;
+			if (!idle && read_state_ == read_state::header)
+				check(expiry(read_start_, options_.header_timeout), "http_session read header");
+			if (!idle && read_state_ == read_state::body)
+				check(expiry(read_start_, options_.body_timeout), "http_session read body");
+			// the requests being handled keep the connection alive
+			if (queue_.empty()) {
+				if (idle) check(expiry(last_active_, options_.idle_timeout), "http_session idle");
+			}
+			else {
+				// the oldest request which is being handled
+				for (auto& ex : queue_)
+					if (!ex->done) {
+						check(expiry(ex->received, options_.handler_timeout), "http_session handler");
+						break;
+					}
+			}
+			if (expired != nullptr) {
+				fail(beast::error::timeout, expired);
+				do_abort();
+				return;
+			}
+			// a state which begins later expires after `now + timeout`
+			clock::time_point next = expiry(now, options_.min_timeout());
+			if (next < deadline) deadline = next;
+			if (deadline == (clock::time_point::max)()) return;
+			timer_.expires_at(deadline);
+			timer_.async_wait(
+				beast::bind_front_handler(
+					&http_session::on_timer,
+					shared_from_this()));
+		}
+		void do_drain() {
+			if (closed_ || draining_) return;
+			draining_ = true;
+			// the request being read (if any) is the last one
+			eof_ = true;
+			if (queue_.empty()
+				&& (reading_ == nullptr || read_state_ == read_state::idle))
+				do_close();
+		}
+		void do_upgrade() {
+			closed_ = true;
+			timer_.cancel();
+			// creates a websocket session, transferring ownership
+			// of both the socket and the http request
+			std::make_shared<websocket_session_server>(
+				ioc_,
+				stream_.release_socket(),
+				parser_->release(),
+				ws_routes_, options_.stack_size,
+				std::move(ticket_)
+				)->do_accept();
 		}
 		void do_close() {
+			closed_ = true;
+			timer_.cancel();
 			// sends a TCP shutdown
 			beast::error_code ec;
 			stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+			// no more requests are answered
+			if (reading_ != nullptr) stream_.cancel();
 			// at this point the connection is closed gracefully
 			lgtrace << "socket connection closed: " << address_;
 		}
+		void do_abort() {
+			closed_ = true;
+			timer_.cancel();
+			// cancels the pending operations
+			stream_.close();
+		}
 	public:
 		http_session(
 			asio::io_context& ioc,
-			tcp::socket&& socket,
+			http_stream::socket_type&& socket,
 			router& routes,
-			router& ws_routes)
-			: lambda_{ *this },
-			ioc_{ ioc },
+			router& ws_routes,
+			const http_options& options,
+			admission_controller& admission,
+			connection_ticket&& ticket,
+			std::shared_ptr<http_session_registry> registry)
+			: ioc_{ ioc },
 			stream_{ std::move(socket) },
+			buffer_{ object_pool<beast::flat_buffer>::local().acquire() },
+			timer_{ stream_.get_executor() },
+			last_active_{ clock::now() },
 			routes_{ routes },
 			ws_routes_{ ws_routes },
+			options_{ options },
+			admission_{ admission },
+			ticket_{ std::move(ticket) },
+			registry_{ std::move(registry) },
 			address_{ get_address(stream_.socket()) } {
+			registry_->add(this);
+			buffer_->max_size(HTTP_BUFFER_LIMIT);
+			strands_.reserve(HTTP_PIPELINE_LIMIT);
+			// pipelined responses are written one after another, which
+			// would otherwise be delayed by nagle's algorithm.
+			beast::error_code ec;
+			stream_.socket().set_option(tcp::no_delay(true), ec);
 			lgtrace << "http session opened: " << address_;
 		}
 		~http_session() {
+			registry_->remove(this);
 			lgtrace << "http session closed: " << address_;
+			// leftover bytes belong to this connection only
+			buffer_->clear();
+			if (buffer_->capacity() > HTTP_RETAINED_SIZE)
+				buffer_->shrink_to_fit();
+			object_pool<beast::flat_buffer>::local().release(std::move(buffer_));
 		}
 		void run() {
 			asio::dispatch(
 				stream_.get_executor(),
 				beast::bind_front_handler(
-					&http_session::do_read,
+					&http_session::do_start,
+					shared_from_this()));
+		}
+		void drain() {
+			asio::dispatch(
+				stream_.get_executor(),
+				beast::bind_front_handler(
+					&http_session::do_drain,
 					shared_from_this()));
 		}
 	};
 
+	void http_session_registry::drain() {
+		draining_ = true;
+		std::vector<std::shared_ptr<http_session>> sessions;
+		{
+			std::lock_guard<std::mutex> lg{ lock_ };
+			sessions.reserve(sessions_.size());
+			for (http_session* session : sessions_)
+				// the session may be being destroyed
+				if (auto ptr = session->weak_from_this().lock())
+					sessions.push_back(std::move(ptr));
+		}
+		// the last reference to a session must not be
+		// released while the lock is held
+		for (auto& session : sessions) session->drain();
+	}
+
 	// accepts incoming connections and launches the sessions
 	class listener
 		: public std::enable_shared_from_this<listener> {
 	private:
 		asio::io_context& ioc_;
 		tcp::acceptor acceptor_;
+		asio::steady_timer pause_timer_;
 		router& routes_;
 		router& ws_routes_;
+		const http_options& options_;
+		std::shared_ptr<admission_controller> admission_;
+		std::shared_ptr<http_session_registry> registry_;
 		void do_accept() {
+			// stops accepting while there are too many connections,
+			// so that the new ones wait in the backlog of the kernel.
+			if (!admission_->accepting()) {
+				pause_timer_.expires_after(std::chrono::milliseconds(ACCEPT_PAUSE));
+				pause_timer_.async_wait(
+					beast::bind_front_handler(
+						&listener::on_pause,
+						shared_from_this()));
+				return;
+			}
 			acceptor_.async_accept(
 				asio::make_strand(ioc_),
 				beast::bind_front_handler(
 					&listener::on_accept,
 					shared_from_this()));
 		}
-		void on_accept(beast::error_code ec, tcp::socket socket) {
+		void on_accept(beast::error_code ec, http_stream::socket_type socket) {
+			// it is stopped
+			if (!acceptor_.is_open()) return;
 			if (ec) {
 				fail(ec, "listener::acceptor async_accept");
 			}
-			else {
+			else if (connection_ticket ticket = admission_->try_connect()) {
 				lgtrace << "listener accepts: " << get_address(socket);
 				std::make_shared<http_session>(
-					ioc_, std::move(socket), routes_, ws_routes_)->run();
+					ioc_, std::move(socket), routes_, ws_routes_,
+					options_, *admission_, std::move(ticket), registry_)->run();
 			}
+			// another listener took the last connection (the socket is closed)
+			else lgdebug << "listener rejects: " << get_address(socket);
+			do_accept();
+		}
+		void on_pause(beast::error_code ec) {
+			if (!acceptor_.is_open()) return;
+			if (ec) fail(ec, "listener pause async_wait");
 			do_accept();
 		}
+		void do_stop() {
+			beast::error_code ec;
+			acceptor_.close(ec);
+			pause_timer_.cancel();
+		}
 	public:
 		listener(
 			asio::io_context& ioc,
 			tcp::endpoint endpoint,
 			router& routes,
-			router& ws_routes)
+			router& ws_routes,
+			const http_options& options,
+			std::shared_ptr<admission_controller> admission,
+			std::shared_ptr<http_session_registry> registry,
+			std::optional<native_socket> inherited = std::nullopt,
+			bool reuse_port_enabled = false)
 			: ioc_{ ioc },
 			acceptor_{ asio::make_strand(ioc) },
+			pause_timer_{ acceptor_.get_executor() },
 			routes_{ routes },
-			ws_routes_{ ws_routes } {
+			ws_routes_{ ws_routes },
+			options_{ options },
+			admission_{ std::move(admission) },
+			registry_{ std::move(registry) } {
 			beast::error_code ec;
+			// the socket is already bound and listening
+			if (inherited) {
+				acceptor_.assign(socket_protocol(*inherited), *inherited, ec);
+				if (ec) {
+					fail(ec, "listener::acceptor assign");
+					exit(EXIT_FAILURE);
+				}
+				return;
+			}
 			acceptor_.open(endpoint.protocol(), ec);
 			if (ec) {
 				fail(ec, "listener::acceptor open");
@@ -440,6 +1184,20 @@ namespace bserv {
 				exit(EXIT_FAILURE);
 				return;
 			}
+#ifdef BSERV_HAS_REUSE_PORT
+			// several acceptors can be bound to the same port,
+			// and the kernel distributes the connections among them.
+			if (reuse_port_enabled) {
+				acceptor_.set_option(reuse_port(true), ec);
+				if (ec) {
+					fail(ec, "listener::acceptor set_option");
+					exit(EXIT_FAILURE);
+					return;
+				}
+			}
+#else
+			boost::ignore_unused(reuse_port_enabled);
+#endif
 			acceptor_.bind(endpoint, ec);
 			if (ec) {
 				fail(ec, "listener::acceptor bind");
@@ -461,63 +1219,348 @@ namespace bserv {
 					&listener::do_accept,
 					shared_from_this()));
 		}
+		native_socket native_handle() {
+			return acceptor_.native_handle();
+		}
+		// stops accepting connections
+		void stop() {
+			asio::dispatch(
+				acceptor_.get_executor(),
+				beast::bind_front_handler(
+					&listener::do_stop,
+					shared_from_this()));
+		}
+	};
+
+
+	// removes the expired sessions every `SESSION_EXPIRY_TICK`
+	class session_collector
+		: public std::enable_shared_from_this<session_collector> {
+	private:
+		asio::steady_timer timer_;
+		std::shared_ptr<session_manager_base> session_mgr_;
+		void do_wait() {
+			timer_.expires_after(SESSION_EXPIRY_TICK);
+			timer_.async_wait(
+				beast::bind_front_handler(
+					&session_collector::on_wait,
+					shared_from_this()));
+		}
+		void on_wait(beast::error_code ec) {
+			if (ec) {
+				if (ec != asio::error::operation_aborted)
+					fail(ec, "session_collector async_wait");
+				return;
+			}
+			session_mgr_->collect_expired();
+			do_wait();
+		}
+	public:
+		session_collector(
+			asio::io_context& ioc,
+			std::shared_ptr<session_manager_base> session_mgr)
+			: timer_{ ioc },
+			session_mgr_{ std::move(session_mgr) } {}
+		void run() {
+			do_wait();
+		}
 	};
 
 
+	std::shared_ptr<db_backend> make_db_backend(const server_config& config) {
+		std::shared_ptr<db_backend> backend;
+		if (config.get_db_backend() == "postgres")
+			backend = std::make_shared<postgres_backend>(config.get_db_conn_str());
+		else if (config.get_db_backend() == "memory") {
+			auto memory = std::make_shared<memory_backend>();
+			if (config.get_db_file_path() != "")
+				memory->load_script(config.get_db_file_path());
+			backend = memory;
+		}
+		else if (config.get_db_backend() == "record")
+			backend = std::make_shared<record_backend>(
+				std::make_shared<postgres_backend>(config.get_db_conn_str()),
+				config.get_db_file_path());
+		else if (config.get_db_backend() == "replay")
+			backend = std::make_shared<replay_backend>(config.get_db_file_path());
+		else throw std::invalid_argument{
+			"unknown db backend: " + config.get_db_backend() };
+		if (config.get_db_latency() > 0)
+			backend = std::make_shared<delayed_backend>(
+				backend, std::chrono::microseconds{ config.get_db_latency() });
+		return backend;
+	}
+
 	server::server(const server_config& config, router&& routes, router&& ws_routes)
-		: ioc_{ config.get_num_threads() },
-		routes_{ std::move(routes) },
+		: routes_{ std::move(routes) },
 		ws_routes_{ std::move(ws_routes) } {
 		init_logging(config);
 
-		if (config.get_db_conn_str() != "") {
+		int num_threads = config.get_num_threads();
+		bool per_core = config.get_per_core();
+#ifndef BSERV_HAS_REUSE_PORT
+		if (per_core) {
+			lgwarning << "per-core mode requires SO_REUSEPORT, "
+				"the shared io_context is used instead" << std::endl;
+			per_core = false;
+		}
+#endif
+		if (per_core) {
+			for (int i = 0; i < num_threads; ++i)
+				iocs_.emplace_back(std::make_unique<asio::io_context>(1));
+		}
+		else iocs_.emplace_back(std::make_unique<asio::io_context>(num_threads));
+		asio::io_context& main_ioc = *iocs_[0];
+
+		// postgresql is only used if the connection string is set
+		if (config.get_db_conn_str() != "" || config.get_db_backend() != "postgres") {
 			// database connection
 			try {
 				db_conn_mgr_ = std::make_shared<
-					db_connection_manager>(config.get_db_conn_str(), config.get_num_db_conn());
+					db_connection_manager>(make_db_backend(config), config.get_num_db_conn());
+				for (const std::string& conn_str : config.get_db_replica_conn_strs())
+					db_conn_mgr_->add_replica(std::make_shared<
+						db_connection_manager>(conn_str, config.get_num_replica_db_conn()));
+				db_conn_mgr_->set_read_your_writes(
+					std::chrono::milliseconds{ config.get_read_your_writes() });
 			}
 			catch (const std::exception& e) {
 				lgfatal << "db connection initialization failed: " << e.what() << std::endl;
 				exit(EXIT_FAILURE);
 			}
 		}
-		session_mgr_ = std::make_shared<memory_session_manager>();
+		std::chrono::seconds session_expiry_time{ config.get_session_expiry_time() };
+		if (config.get_session_backend() == "memory" && per_core) {
+			// each core creates and collects sessions of its own
+			auto sessions = std::make_shared<per_core_session_manager>(
+				iocs_.size(), session_expiry_time);
+			for (std::size_t i = 0; i < sessions->num_cores(); ++i)
+				std::make_shared<session_collector>(*iocs_[i], sessions->core(i))->run();
+			session_mgr_ = sessions;
+		}
+		else if (config.get_session_backend() == "memory") {
+			session_mgr_ = std::make_shared<memory_session_manager>(session_expiry_time);
+			std::make_shared<session_collector>(main_ioc, session_mgr_)->run();
+		}
+		else {
+			// persistent sessions
+			std::shared_ptr<session_store> store;
+			try {
+				if (config.get_session_backend() == "file")
+					store = std::make_shared<file_session_store>(config.get_session_file_path());
+				else if (config.get_session_backend() == "db")
+					store = std::make_shared<db_session_store>(
+						config.get_db_conn_str(), config.get_num_session_db_conn());
+				else throw std::invalid_argument{
+					"unknown session backend: " + config.get_session_backend() };
+			}
+			catch (const std::exception& e) {
+				lgfatal << "session store initialization failed: " << e.what() << std::endl;
+				exit(EXIT_FAILURE);
+			}
+			session_mgr_ = std::make_shared<persistent_session_manager>(
+				store, session_expiry_time,
+				std::chrono::milliseconds{ config.get_session_revalidate_time() });
+			std::make_shared<session_collector>(main_ioc, session_mgr_)->run();
+		}
+
+		enable_tracing(config.get_trace_buffer_size());
+		if (config.get_access_log_path() != ""
+			&& !open_access_log(config.get_access_log_path(), config.get_access_log_sample()))
+			lgerror << "failed to open the access log: " << config.get_access_log_path() << std::endl;
+
+		compute_pool_ = std::make_shared<compute_pool>(
+			config.get_num_compute_threads(), COMPUTE_QUEUE_LIMIT);
+
+		// shared by all the listeners
+		admission_ = std::make_shared<admission_controller>(
+			config.get_max_connections(), config.get_max_in_flight(),
+			std::chrono::milliseconds(config.get_queue_target()),
+			std::chrono::milliseconds(config.get_queue_interval()));
+
+		// exported along with the other metrics
+		metrics().add_collector(
+			[compute_pool = compute_pool_, admission = admission_](std::string& out) {
+				compute_stats compute = compute_pool->stats();
+				admission_stats admission_stats = admission->stats();
+				out += "# TYPE bserv_compute_queued gauge\n"
+					"bserv_compute_queued " + std::to_string(compute.queued) + "\n"
+					"# TYPE bserv_compute_running gauge\n"
+					"bserv_compute_running " + std::to_string(compute.running) + "\n"
+					"# TYPE bserv_compute_completed_total counter\n"
+					"bserv_compute_completed_total " + std::to_string(compute.completed) + "\n"
+					"# TYPE bserv_compute_ran_inline_total counter\n"
+					"bserv_compute_ran_inline_total " + std::to_string(compute.ran_inline) + "\n"
+					"# TYPE bserv_connections gauge\n"
+					"bserv_connections " + std::to_string(admission_stats.connections) + "\n"
+					"# TYPE bserv_requests_in_flight gauge\n"
+					"bserv_requests_in_flight " + std::to_string(admission_stats.in_flight) + "\n"
+					"# TYPE bserv_overloaded gauge\n"
+					"bserv_overloaded " + std::to_string(admission_stats.overloaded ? 1 : 0) + "\n"
+					"# TYPE bserv_rejected_connections_total counter\n"
+					"bserv_rejected_connections_total "
+					+ std::to_string(admission_stats.rejected_connections) + "\n"
+					"# TYPE bserv_rejected_requests_total counter\n"
+					"bserv_rejected_requests_total "
+					+ std::to_string(admission_stats.rejected_requests) + "\n"
+					"# TYPE bserv_shed_requests_total counter\n"
+					"bserv_shed_requests_total "
+					+ std::to_string(admission_stats.shed_requests) + "\n"
+					"# TYPE bserv_access_log_dropped_total counter\n"
+					"bserv_access_log_dropped_total "
+					+ std::to_string(access_log_dropped()) + "\n";
+			});
 
 		std::shared_ptr<server_resources> resources_ptr = std::make_shared<server_resources>();
 		resources_ptr->session_mgr = session_mgr_;
 		resources_ptr->db_conn_mgr = db_conn_mgr_;
+		resources_ptr->compute_pool_ptr = compute_pool_;
+		resources_ptr->client_timeout = std::chrono::seconds(config.get_client_timeout());
 
 		routes_.set_resources(resources_ptr);
 		ws_routes_.set_resources(resources_ptr);
 
-		// creates and launches a listening port
-		std::make_shared<listener>(
-			ioc_, tcp::endpoint{ tcp::v4(), config.get_port() }, routes_, ws_routes_)->run();
+		// it lives until the `io_context`s stop
+		const http_options options{ config };
+		auto registry = std::make_shared<http_session_registry>();
 
-		// captures SIGINT and SIGTERM to perform a clean shutdown
-		asio::signal_set signals{ ioc_, SIGINT, SIGTERM };
+		// the listening sockets are taken from systemd or from the process
+		// being replaced, if any, so that no connection is refused.
+		std::vector<native_socket> inherited = inherited_sockets();
+		if (inherited.empty() && config.get_handoff_path() != "")
+			inherited = take_sockets(config.get_handoff_path());
+		if (!inherited.empty()) {
+			lginfo << "inherits " << inherited.size() << " listening socket(s)";
+			if (inherited.size() > iocs_.size()) {
+				// the connections queued on them are reset
+				lgwarning << inherited.size() - iocs_.size()
+					<< " inherited socket(s) are closed" << std::endl;
+				for (std::size_t i = iocs_.size(); i < inherited.size(); ++i)
+					close_socket(inherited[i]);
+				inherited.resize(iocs_.size());
+			}
+		}
+
+		// creates and launches the listening ports.
+		// in the per-core mode, each io_context has its own acceptor,
+		// so a connection stays on the thread (and cpu) that accepted it.
+		std::vector<std::shared_ptr<listener>> listeners;
+		for (std::size_t i = 0; i < iocs_.size(); ++i) {
+			std::optional<native_socket> socket;
+			// the acceptors share an inherited socket if there are fewer
+			if (!inherited.empty())
+				socket = i < inherited.size()
+				? inherited[i] : duplicate_socket(inherited[i % inherited.size()]);
+			listeners.push_back(std::make_shared<listener>(
+				*iocs_[i], tcp::endpoint{ tcp::v4(), config.get_port() },
+				routes_, ws_routes_, options,
+				admission_, registry, socket, per_core));
+			listeners.back()->run();
+		}
+
+		// stops the `io_context`s. This will cause `run()`
+		// to return immediately, eventually destroying the
+		// `io_context`s and all of the sockets in them.
+		const auto stop = [&] {
+			for (auto& ioc : iocs_) ioc->stop();
+		};
+
+		// captures SIGINT and SIGTERM to perform a clean shutdown:
+		// no more connections are accepted, the requests being handled
+		// are answered, and the connections are closed. the server stops
+		// when all of them are closed, or after `drain_timeout`.
+		asio::signal_set signals{ main_ioc, SIGINT, SIGTERM };
+		asio::steady_timer drain_timer{ main_ioc };
+		std::chrono::steady_clock::time_point drain_deadline;
+		std::function<void()> wait_drained = [&] {
+			std::size_t remaining = registry->size();
+			if (remaining == 0 || std::chrono::steady_clock::now() >= drain_deadline) {
+				if (remaining > 0)
+					lgwarning << remaining << " connection(s) are not drained" << std::endl;
+				stop();
+				return;
+			}
+			drain_timer.expires_after(DRAIN_TICK);
+			drain_timer.async_wait(
+				[&](const boost::system::error_code& ec) {
+					if (!ec) wait_drained();
+				});
+		};
+		std::shared_ptr<handoff_server> handoff;
+		std::atomic<bool> draining{ false };
+		const auto drain = [&] {
+			if (draining.exchange(true)) return;
+			lginfo << "draining " << registry->size() << " connection(s)";
+			drain_deadline = std::chrono::steady_clock::now()
+				+ std::chrono::seconds(config.get_drain_timeout());
+			if (handoff != nullptr) handoff->stop();
+			for (auto& l : listeners) l->stop();
+			registry->drain();
+			wait_drained();
+		};
 		signals.async_wait(
-			[&](const boost::system::error_code&, int) {
-				// stops the `io_context`. This will cause `run()`
-				// to return immediately, eventually destroying the
-				// `io_context` and all of the sockets in it.
-				ioc_.stop();
+			[&](const boost::system::error_code& ec, int) {
+				if (ec) return;
+				drain();
+				// another signal stops the server at once
+				signals.async_wait(
+					[&](const boost::system::error_code& ec, int) {
+						if (!ec) stop();
+					});
 			});
 
-		lginfo << config.get_name() << " started";
+		// a new process takes the listening sockets over,
+		// while this one drains its connections.
+		if (config.get_handoff_path() != "") {
+			std::vector<native_socket> sockets;
+			for (auto& l : listeners) sockets.push_back(l->native_handle());
+			handoff = std::make_shared<handoff_server>(
+				main_ioc, config.get_handoff_path(), std::move(sockets),
+				[&] { drain(); });
+			handoff->run();
+		}
+
+		lginfo << config.get_name() << " started"
+			<< (per_core ? " (per-core mode)" : "");
 
 		// runs the I/O service on the requested number of threads
 		std::vector<std::thread> v;
-		v.reserve(config.get_num_threads() - 1);
-		for (int i = 1; i < config.get_num_threads(); ++i)
-			v.emplace_back([&] { ioc_.run(); });
-		ioc_.run();
+		v.reserve(num_threads - 1);
+		if (per_core) {
+			std::vector<int> cpus = get_allowed_cpus();
+			auto run = [&, cpus](int i) {
+				if (!cpus.empty()) pin_thread(cpus[i % cpus.size()]);
+				per_core_session_manager::set_current_core(i);
+				iocs_[i]->run();
+			};
+			for (int i = 1; i < num_threads; ++i)
+				v.emplace_back(run, i);
+			run(0);
+		}
+		else {
+			for (int i = 1; i < num_threads; ++i)
+				v.emplace_back([&] { main_ioc.run(); });
+			main_ioc.run();
+		}
 
 		// if we get here, it means we got a SIGINT or SIGTERM
 		lginfo << "exiting " << config.get_name();
 
 		// blocks until all the threads exit
 		for (auto& t : v) t.join();
+
+		close_access_log();
+
+		if (config.get_trace_path() != "" && !write_chrome_trace(config.get_trace_path()))
+			lgerror << "failed to write the traces to " << config.get_trace_path() << std::endl;
+
+		try {
+			session_mgr_->flush();
+		}
+		catch (const std::exception& e) {
+			lgerror << "session flush failed: " << e.what() << std::endl;
+		}
+		flush_logging();
 	}
 
 }  // bserv
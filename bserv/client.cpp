@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "bserv/client.hpp"
 #include "bserv/logging.hpp"
+#include "bserv/tracing.hpp"
 
 #include <chrono>
 
@@ -15,7 +16,9 @@ namespace bserv {
         asio::yield_context& yield,
         const std::string& host,
         const std::string& port,
-        const http::request<http::string_body>& req) {
+        const http::request<http::string_body>& req,
+        std::chrono::steady_clock::duration timeout) {
+        const trace_guard guard;
         beast::error_code ec;
         tcp::resolver resolver{ ioc };
         const auto results = resolver.async_resolve(host, port, yield[ec]);
@@ -24,14 +27,14 @@ namespace bserv {
         }
         beast::tcp_stream stream{ ioc };
         // sets a timeout on the operation
-        stream.expires_after(std::chrono::seconds(EXPIRY_TIME));
+        stream.expires_after(timeout);
         // makes the connection on the IP address we get from a lookup
         stream.async_connect(results, yield[ec]);
         if (ec) {
             throw request_failed_exception{ "http_client_session::stream connect: " + ec.message() };
         }
         // sets a timeout on the operation
-        stream.expires_after(std::chrono::seconds(EXPIRY_TIME));
+        stream.expires_after(timeout);
         // sends the HTTP request to the remote host
         http::async_write(stream, req, yield[ec]);
         if (ec) {
@@ -56,6 +59,54 @@ namespace bserv {
         return res;
     }
 
+#ifdef BSERV_HAS_CO_AWAIT
+    // the same as `http_client_send`, for C++20 coroutine handlers
+    awaitable<http::response<http::string_body>> co_http_client_send(
+        asio::io_context& ioc,
+        const std::string& host,
+        const std::string& port,
+        const http::request<http::string_body>& req,
+        std::chrono::steady_clock::duration timeout) {
+        const trace_guard guard;
+        beast::error_code ec;
+        auto token = asio::redirect_error(use_awaitable, ec);
+        tcp::resolver resolver{ ioc };
+        const auto results = co_await resolver.async_resolve(host, port, token);
+        if (ec) {
+            throw request_failed_exception{ "http_client_session::resolver resolve: " + ec.message() };
+        }
+        beast::tcp_stream stream{ ioc };
+        // sets a timeout on the operation
+        stream.expires_after(timeout);
+        // makes the connection on the IP address we get from a lookup
+        co_await stream.async_connect(results, token);
+        if (ec) {
+            throw request_failed_exception{ "http_client_session::stream connect: " + ec.message() };
+        }
+        // sets a timeout on the operation
+        stream.expires_after(timeout);
+        // sends the HTTP request to the remote host
+        co_await http::async_write(stream, req, token);
+        if (ec) {
+            throw request_failed_exception{ "http_client_session::stream write: " + ec.message() };
+        }
+        beast::flat_buffer buffer;
+        http::response<http::string_body> res;
+        // receives the HTTP response
+        co_await http::async_read(stream, buffer, res, token);
+        if (ec) {
+            throw request_failed_exception{ "http_client_session::stream read: " + ec.message() };
+        }
+        // gracefully close the socket
+        stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+        // `not_connected` happens sometimes so don't bother reporting it
+        if (ec && ec != beast::errc::not_connected) {
+            fail(ec, "http_client_session::stream::socket shutdown");
+        }
+        co_return res;
+    }
+#endif
+
     request_type get_request(
         const std::string& host,
         const std::string& target,
@@ -0,0 +1,25 @@
+#include "pch.h"
+#include "bserv/compute.hpp"
+
+namespace bserv {
+
+    compute_pool::compute_pool(int num_threads, std::size_t queue_limit)
+        : pool_{ static_cast<std::size_t>(num_threads > 0 ? num_threads : 1) },
+        queue_limit_{ queue_limit } {}
+
+    compute_pool::~compute_pool() {
+        pool_.join();
+    }
+
+    compute_stats compute_pool::stats() const {
+        return {
+            queued_.load(),
+            running_.load(),
+            max_queued_.load(),
+            completed_.load(),
+            ran_inline_.load(),
+            std::chrono::nanoseconds{ total_wait_ns_.load() }
+        };
+    }
+
+}  // bserv
@@ -1,36 +1,171 @@
 #include "pch.h"
 #include "bserv/database.hpp"
 
+#include "bserv/db_backend.hpp"
+
 namespace bserv {
 
+    db_table db_result::to_table() const {
+        if (table_ != nullptr) return *table_;
+        db_table table;
+        table.query = result_.query();
+        for (pqxx::row::size_type i = 0; i < result_.columns(); ++i)
+            table.columns.emplace_back(result_.column_name(i));
+        for (const db_row& row : *this) {
+            std::vector<std::optional<std::string>>& values = table.rows.emplace_back();
+            for (std::size_t i = 0; i < row.size(); ++i) {
+                db_field field = row[i];
+                if (field.is_null()) values.emplace_back();
+                else values.emplace_back(field.c_str());
+            }
+        }
+        return table;
+    }
+
+    db_connection_manager::db_connection_manager(const std::string& conn_str, int n)
+        : db_connection_manager{ std::make_shared<postgres_backend>(conn_str), n } {}
+
     std::shared_ptr<db_connection> db_connection_manager::get_or_block() {
-        // `counter_lock_` must be acquired first.
-        // exchanging this statement with the next will cause dead-lock,
-        // because if the request is blocked by `counter_lock_`,
-        // the destructor of `db_connection` will not be able to put
-        // itself back due to the `queue_lock_` has already been acquired
-        // by this request!
-        counter_lock_.lock();
-        // `queue_lock_` is acquired so that only one thread will
-        // modify the `queue_`
-        std::lock_guard<std::mutex> lg{ queue_lock_ };
+        ++outstanding_;
+        scoped_latency timer{ metrics().db_acquire };
+        trace_span span{ "db_acquire" };
+        db_timer db_time;
+        std::unique_lock<std::mutex> lock{ queue_lock_ };
+        // `blocked_` is counted so that the connections which are put back
+        // are handed to these requests first (see `~db_connection`)
+        ++blocked_;
+        queue_ready_.wait(lock, [this] { return queue_.size() != 0; });
+        --blocked_;
+        return std::make_shared<db_connection>(*this, try_pop());
+    }
+
+    std::shared_ptr<db_connection> db_connection_manager::get_read_only_or_block(
+        const std::string& session_id) {
+        return read_only_pool(session_id).get_or_block();
+    }
+
+    db_connection_manager& db_connection_manager::read_only_pool(
+        const std::string& session_id) {
+        if (replicas_.empty() || pinned_to_primary(session_id))
+            return *this;
+        // the replica with the least outstanding requests is chosen.
+        // the search starts from each replica in turn, so that the ties
+        // (e.g. when they are all idle) are broken by round robin.
+        std::size_t n = replicas_.size();
+        std::size_t start = next_replica_++ % n;
+        db_connection_manager* replica = replicas_[start].get();
+        for (std::size_t i = 1; i < n; ++i) {
+            db_connection_manager* candidate = replicas_[(start + i) % n].get();
+            if (candidate->outstanding_ < replica->outstanding_)
+                replica = candidate;
+        }
+        return *replica;
+    }
+
+    std::shared_ptr<raw_db_connection_type> db_connection_manager::try_pop() {
+        if (queue_.size() == 0) return nullptr;
         std::shared_ptr<raw_db_connection_type> conn = queue_.front();
         queue_.pop();
-        // if there are no connections in the `queue_`,
-        // `counter_lock_` remains to be locked
-        // so that the following requests will be blocked
-        if (queue_.size() != 0) counter_lock_.unlock();
-        return std::make_shared<db_connection>(*this, conn);
+        return conn;
+    }
+
+#ifdef BSERV_HAS_CO_AWAIT
+    awaitable<std::shared_ptr<db_connection>> db_connection_manager::co_get() {
+        ++outstanding_;
+        scoped_latency timer{ metrics().db_acquire };
+        std::uint64_t trace = current_trace();
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<raw_db_connection_type> conn;
+        {
+            std::lock_guard<std::mutex> lg{ queue_lock_ };
+            conn = try_pop();
+        }
+        // the coroutine waits at the back of `waiters_` at first. if the
+        // connection it is woken for is taken by another request before it
+        // is resumed, it waits again at the front.
+        bool front = false;
+        while (conn == nullptr) {
+            const trace_guard guard;
+            conn = co_await asio::async_initiate<const asio::use_awaitable_t<>&,
+                void(std::shared_ptr<raw_db_connection_type>)>(
+                    [this, front](auto handler) {
+                        auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+                        // resumes the coroutine on its own executor, where it
+                        // takes a connection from `queue_` (if there is still one)
+                        auto wake = [this, shared]() {
+                            auto ex = asio::get_associated_executor(*shared);
+                            asio::post(ex, [this, shared]() {
+                                std::shared_ptr<raw_db_connection_type> conn;
+                                {
+                                    std::lock_guard<std::mutex> lg{ queue_lock_ };
+                                    conn = try_pop();
+                                }
+                                (*shared)(std::move(conn));
+                            });
+                        };
+                        std::lock_guard<std::mutex> lg{ queue_lock_ };
+                        // a connection may have been put back in the meantime
+                        if (queue_.size() != 0) wake();
+                        else if (front) waiters_.emplace_front(std::move(wake));
+                        else waiters_.emplace_back(std::move(wake));
+                    }, use_awaitable);
+            front = true;
+        }
+        auto end = std::chrono::steady_clock::now();
+        record_span("db_acquire", trace, start, end);
+        add_db_time(end - start);
+        co_return std::make_shared<db_connection>(*this, conn);
+    }
+#endif
+
+    void db_connection_manager::pin_to_primary(const std::string& session_id) {
+        if (session_id == "" || replicas_.empty()
+            || pin_duration_ == std::chrono::steady_clock::duration::zero())
+            return;
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lg{ pins_lock_ };
+        pins_[session_id] = now + pin_duration_;
+        if (pins_.size() >= pins_cleanup_size_) {
+            for (auto it = pins_.begin(); it != pins_.end();) {
+                if (it->second <= now) it = pins_.erase(it);
+                else ++it;
+            }
+            pins_cleanup_size_ = std::max<std::size_t>(64, pins_.size() * 2);
+        }
+    }
+
+    bool db_connection_manager::pinned_to_primary(const std::string& session_id) {
+        if (session_id == ""
+            || pin_duration_ == std::chrono::steady_clock::duration::zero())
+            return false;
+        std::lock_guard<std::mutex> lg{ pins_lock_ };
+        auto it = pins_.find(session_id);
+        if (it == pins_.end()) return false;
+        if (it->second > std::chrono::steady_clock::now()) return true;
+        pins_.erase(it);
+        return false;
     }
 
     db_connection::~db_connection() {
-        std::lock_guard<std::mutex> lg{ mgr_.queue_lock_ };
-        mgr_.queue_.emplace(conn_);
-        // if this is the first available connection back to the queue,
-        // `counter_lock_` is unlocked so that the blocked requests will
-        // be notified
-        if (mgr_.queue_.size() == 1)
-            mgr_.counter_lock_.unlock();
+        --mgr_.outstanding_;
+        std::function<void()> wake;
+        {
+            std::lock_guard<std::mutex> lg{ mgr_.queue_lock_ };
+            mgr_.queue_.emplace(conn_);
+            // the connection is left in `queue_`, rather than handed to a
+            // waiter, so that it is never held up by a coroutine which is not
+            // resumed yet. the threads blocked in `get_or_block` are notified
+            // first: a coroutine may be resumed by one of them only after it
+            // is unblocked. each connection put back notifies one blocked
+            // request (which is not notified yet) or wakes one coroutine.
+            if (mgr_.queue_.size() <= static_cast<std::size_t>(mgr_.blocked_))
+                mgr_.queue_ready_.notify_one();
+            else if (!mgr_.waiters_.empty()) {
+                wake = std::move(mgr_.waiters_.front());
+                mgr_.waiters_.pop_front();
+            }
+        }
+        if (wake) wake();
     }
 
 }  // bserv
\ No newline at end of file
@@ -0,0 +1,1227 @@
+#include "pch.h"
+#include "bserv/db_backend.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace bserv {
+
+    namespace {
+
+        class postgres_transaction : public db_backend_transaction {
+        private:
+            pqxx::work tx_;
+        public:
+            postgres_transaction(pqxx::connection& conn) : tx_{ conn } {}
+            std::string quote(const std::string& value) { return tx_.quote(value); }
+            std::string quote_name(const std::string& name) { return tx_.quote_name(name); }
+            db_result exec(const std::string& query) { return tx_.exec(query); }
+            void commit() { tx_.commit(); }
+            void abort() { tx_.abort(); }
+        };
+
+        class postgres_connection : public db_backend_connection {
+        private:
+            pqxx::connection conn_;
+        public:
+            postgres_connection(const std::string& conn_str) : conn_{ conn_str } {}
+            std::unique_ptr<db_backend_transaction> begin() {
+                return std::make_unique<postgres_transaction>(conn_);
+            }
+        };
+
+    }  // namespace
+
+    std::shared_ptr<db_backend_connection> postgres_backend::connect() {
+        return std::make_shared<postgres_connection>(conn_str_);
+    }
+
+    // **************************************************************************
+
+    namespace db_internal {
+
+        using value_type = std::optional<std::string>;
+
+        struct memory_row {
+            // the rows of a table are in the order of their ids,
+            // which is the order they are inserted
+            std::uint64_t id;
+            std::vector<value_type> values;
+        };
+
+        struct memory_table {
+            std::vector<std::string> columns;
+            std::vector<bool> serial;
+            std::vector<memory_row> rows;
+            std::int64_t next_serial = 1;
+        };
+
+        // a change of a row, to be undone if the transaction is aborted
+        struct memory_change {
+            enum kind_type { inserted, updated, deleted } kind;
+            std::string table;
+            // the row before it was changed
+            memory_row row;
+        };
+
+        struct memory_database {
+            // the queries are run one at a time
+            std::mutex lock;
+            std::map<std::string, memory_table> tables;
+            std::uint64_t next_row_id = 1;
+        };
+
+    }  // db_internal
+
+    namespace {
+
+        using db_internal::value_type;
+        using db_internal::memory_row;
+        using db_internal::memory_table;
+        using db_internal::memory_change;
+        using db_internal::memory_database;
+
+        // the text of a value of postgresql, or a quoted name
+        std::string quote_text(const std::string& s, char quote) {
+            std::string res;
+            res.reserve(s.size() + 2);
+            res += quote;
+            for (char c : s) {
+                if (c == quote) res += quote;
+                res += c;
+            }
+            res += quote;
+            return res;
+        }
+
+        bool to_integer(const std::string& s, std::int64_t& n) {
+            const char* end = s.data() + s.size();
+            auto [ptr, ec] = std::from_chars(s.data(), end, n);
+            return ec == std::errc{} && ptr == end;
+        }
+
+        bool to_number(const std::string& s, double& x) {
+            if (s.empty() || !(std::isdigit((unsigned char)s[0]) || s[0] == '-')) return false;
+            const char* end = s.data() + s.size();
+            auto [ptr, ec] = std::from_chars(s.data(), end, x);
+            return ec == std::errc{} && ptr == end;
+        }
+
+        std::string number_to_string(double x) {
+            std::ostringstream out;
+            out.precision(17);
+            out << x;
+            return out.str();
+        }
+
+        // the numbers are compared as numbers, and the other values as text.
+        // returns nothing if any of them is null.
+        std::optional<int> compare_values(const value_type& a, const value_type& b) {
+            if (!a.has_value() || !b.has_value()) return std::nullopt;
+            double x, y;
+            if (to_number(*a, x) && to_number(*b, y))
+                return x < y ? -1 : (x > y ? 1 : 0);
+            int c = a->compare(*b);
+            return c < 0 ? -1 : (c > 0 ? 1 : 0);
+        }
+
+        enum class compare_op { eq, ne, lt, le, gt, ge, is_null, is_not_null, in };
+
+        bool satisfies(compare_op op, int c) {
+            switch (op) {
+            case compare_op::eq: return c == 0;
+            case compare_op::ne: return c != 0;
+            case compare_op::lt: return c < 0;
+            case compare_op::le: return c <= 0;
+            case compare_op::gt: return c > 0;
+            case compare_op::ge: return c >= 0;
+            default: return false;
+            }
+        }
+
+        // tokens ---------------------------------------------------------------
+
+        enum class token_kind { word, name, string, number, symbol, end };
+
+        struct token {
+            token_kind kind;
+            // the words are in lower case, and the quotes are removed
+            std::string text;
+        };
+
+        std::vector<token> tokenize(const std::string& sql) {
+            std::vector<token> tokens;
+            std::size_t i = 0, n = sql.size();
+            while (i < n) {
+                char c = sql[i];
+                if (std::isspace((unsigned char)c)) {
+                    ++i;
+                }
+                else if (c == '-' && i + 1 < n && sql[i + 1] == '-') {
+                    // a comment
+                    while (i < n && sql[i] != '\n') ++i;
+                }
+                else if (std::isalpha((unsigned char)c) || c == '_') {
+                    std::size_t j = i;
+                    while (j < n && (std::isalnum((unsigned char)sql[j]) || sql[j] == '_')) ++j;
+                    std::string word = sql.substr(i, j - i);
+                    for (char& ch : word) ch = (char)std::tolower((unsigned char)ch);
+                    tokens.push_back({ token_kind::word, std::move(word) });
+                    i = j;
+                }
+                else if (std::isdigit((unsigned char)c)) {
+                    std::size_t j = i;
+                    while (j < n && (std::isdigit((unsigned char)sql[j]) || sql[j] == '.')) ++j;
+                    tokens.push_back({ token_kind::number, sql.substr(i, j - i) });
+                    i = j;
+                }
+                else if (c == '\'' || c == '"') {
+                    std::string text;
+                    for (++i; ; ++i) {
+                        if (i == n) throw db_query_exception{ "unterminated quote" };
+                        if (sql[i] == c) {
+                            // a doubled quote is a quote
+                            if (i + 1 < n && sql[i + 1] == c) ++i;
+                            else break;
+                        }
+                        text += sql[i];
+                    }
+                    ++i;
+                    tokens.push_back({ c == '\'' ? token_kind::string : token_kind::name, std::move(text) });
+                }
+                else {
+                    std::string symbol(1, c);
+                    if (i + 1 < n && ((c == '<' && (sql[i + 1] == '=' || sql[i + 1] == '>'))
+                        || ((c == '>' || c == '!') && sql[i + 1] == '=')))
+                        symbol += sql[i + 1];
+                    else if (std::string{ "(),;*=<>+-." }.find(c) == std::string::npos)
+                        throw db_query_exception{ "unexpected '" + symbol + "'" };
+                    tokens.push_back({ token_kind::symbol, symbol });
+                    i += symbol.size();
+                }
+            }
+            tokens.push_back({ token_kind::end, "" });
+            return tokens;
+        }
+
+        bool is_reserved(const std::string& word) {
+            static const std::set<std::string> words = {
+                "all", "and", "as", "asc", "by", "desc", "distinct", "false", "from",
+                "group", "having", "in", "into", "is", "limit", "not", "null", "offset",
+                "or", "order", "select", "set", "true", "values", "where"
+            };
+            return words.count(word) != 0;
+        }
+
+        // statements -----------------------------------------------------------
+
+        // a column, or a value
+        struct operand {
+            bool is_column = false;
+            // the table (or its alias) of the column, which may be omitted
+            std::string table;
+            std::string column;
+            value_type value;
+        };
+
+        struct select_statement;
+
+        struct condition {
+            operand left;
+            compare_op op;
+            operand right;
+            // the values of `in`
+            std::shared_ptr<select_statement> subquery;
+        };
+
+        struct select_item {
+            enum kind_type { star, field, count, sum } kind;
+            operand column;
+        };
+
+        struct having_clause {
+            // count(*) or sum(column)
+            select_item aggregate;
+            compare_op op;
+            // compared with all the values of `subquery`, or with `value`
+            std::shared_ptr<select_statement> subquery;
+            operand value;
+        };
+
+        struct table_ref {
+            std::string table;
+            std::string alias;
+        };
+
+        struct select_statement {
+            bool distinct = false;
+            std::vector<select_item> items;
+            std::vector<table_ref> from;
+            std::vector<condition> where;
+            std::optional<operand> group_by;
+            std::optional<having_clause> having;
+            std::optional<operand> order_by;
+            bool descending = false;
+            std::optional<std::size_t> limit;
+            std::size_t offset = 0;
+        };
+
+        // the tables of `from`
+        struct binding {
+            std::vector<memory_table*> tables;
+            std::vector<table_ref> refs;
+        };
+
+        // the rows of the tables of a binding
+        using joined_row = std::vector<const memory_row*>;
+
+        // a column of a binding (`table` is its index), or a value (`table` < 0)
+        struct bound_operand {
+            int table = -1;
+            std::size_t column = 0;
+            value_type value;
+            const value_type& eval(const joined_row& row) const {
+                return table < 0 ? value : row[table]->values[column];
+            }
+        };
+
+        struct bound_condition {
+            bound_operand left;
+            compare_op op;
+            bound_operand right;
+            std::vector<value_type> in;
+            // it is tested once the rows of the tables up to this one are chosen
+            int last_table;
+            bool test(const joined_row& row) const {
+                const value_type& x = left.eval(row);
+                switch (op) {
+                case compare_op::is_null: return !x.has_value();
+                case compare_op::is_not_null: return x.has_value();
+                case compare_op::in:
+                    for (const value_type& y : in) {
+                        std::optional<int> c = compare_values(x, y);
+                        if (c.has_value() && *c == 0) return true;
+                    }
+                    return false;
+                default: {
+                    std::optional<int> c = compare_values(x, right.eval(row));
+                    return c.has_value() && satisfies(op, *c);
+                }
+                }
+            }
+        };
+
+        // parses and runs the statements of a query
+        class memory_query {
+        private:
+            memory_database& db_;
+            // the changes are not recorded if it is null
+            std::vector<memory_change>* changes_;
+            std::vector<token> tokens_;
+            std::size_t pos_ = 0;
+
+            const token& peek(std::size_t ahead = 0) const {
+                return tokens_[std::min(pos_ + ahead, tokens_.size() - 1)];
+            }
+            bool at_end() const { return peek().kind == token_kind::end; }
+            bool is_word(const char* word, std::size_t ahead = 0) const {
+                return peek(ahead).kind == token_kind::word && peek(ahead).text == word;
+            }
+            bool is_symbol(const char* symbol, std::size_t ahead = 0) const {
+                return peek(ahead).kind == token_kind::symbol && peek(ahead).text == symbol;
+            }
+            bool accept_word(const char* word) {
+                if (!is_word(word)) return false;
+                ++pos_;
+                return true;
+            }
+            bool accept_symbol(const char* symbol) {
+                if (!is_symbol(symbol)) return false;
+                ++pos_;
+                return true;
+            }
+            [[noreturn]] void unexpected() const {
+                if (at_end()) throw db_query_exception{ "unexpected end of query" };
+                throw db_query_exception{ "unexpected '" + peek().text + "'" };
+            }
+            void expect_word(const char* word) {
+                if (!accept_word(word)) unexpected();
+            }
+            void expect_symbol(const char* symbol) {
+                if (!accept_symbol(symbol)) unexpected();
+            }
+            // the name of a table or a column
+            std::string parse_name() {
+                if (peek().kind != token_kind::word && peek().kind != token_kind::name) unexpected();
+                return tokens_[pos_++].text;
+            }
+            std::size_t parse_count() {
+                if (peek().kind != token_kind::number) unexpected();
+                return (std::size_t)std::stoull(tokens_[pos_++].text);
+            }
+            compare_op parse_compare_op() {
+                if (accept_symbol("=")) return compare_op::eq;
+                if (accept_symbol("<>") || accept_symbol("!=")) return compare_op::ne;
+                if (accept_symbol("<")) return compare_op::lt;
+                if (accept_symbol("<=")) return compare_op::le;
+                if (accept_symbol(">")) return compare_op::gt;
+                if (accept_symbol(">=")) return compare_op::ge;
+                unexpected();
+            }
+            operand parse_operand() {
+                operand res;
+                if (peek().kind == token_kind::string || peek().kind == token_kind::number) {
+                    res.value = tokens_[pos_++].text;
+                }
+                else if (accept_symbol("-")) {
+                    if (peek().kind != token_kind::number) unexpected();
+                    res.value = "-" + tokens_[pos_++].text;
+                }
+                else if (accept_word("true")) res.value = "t";
+                else if (accept_word("false")) res.value = "f";
+                else if (accept_word("null")) {}
+                else {
+                    if (peek().kind == token_kind::word && is_reserved(peek().text)) unexpected();
+                    res.is_column = true;
+                    res.column = parse_name();
+                    if (accept_symbol(".")) {
+                        res.table = std::move(res.column);
+                        res.column = parse_name();
+                    }
+                }
+                return res;
+            }
+            operand parse_column() {
+                operand res = parse_operand();
+                if (!res.is_column) throw db_query_exception{ "a column is expected" };
+                return res;
+            }
+            operand parse_value() {
+                operand res = parse_operand();
+                if (res.is_column) throw db_query_exception{ "a value is expected" };
+                return res;
+            }
+            select_item parse_select_item() {
+                select_item item;
+                if (accept_symbol("*")) {
+                    item.kind = select_item::star;
+                }
+                else if (is_word("count") && is_symbol("(", 1)) {
+                    pos_ += 2;
+                    expect_symbol("*");
+                    expect_symbol(")");
+                    item.kind = select_item::count;
+                }
+                else if (is_word("sum") && is_symbol("(", 1)) {
+                    pos_ += 2;
+                    item.column = parse_column();
+                    expect_symbol(")");
+                    item.kind = select_item::sum;
+                }
+                else {
+                    item.kind = select_item::field;
+                    item.column = parse_column();
+                }
+                return item;
+            }
+            std::shared_ptr<select_statement> parse_subquery() {
+                expect_symbol("(");
+                auto subquery = std::make_shared<select_statement>(parse_select());
+                expect_symbol(")");
+                return subquery;
+            }
+            std::vector<condition> parse_conditions() {
+                std::vector<condition> conditions;
+                do {
+                    condition c;
+                    c.left = parse_operand();
+                    if (accept_word("is")) {
+                        c.op = accept_word("not") ? compare_op::is_not_null : compare_op::is_null;
+                        expect_word("null");
+                    }
+                    else if (accept_word("in")) {
+                        c.op = compare_op::in;
+                        c.subquery = parse_subquery();
+                    }
+                    else {
+                        c.op = parse_compare_op();
+                        c.right = parse_operand();
+                    }
+                    conditions.push_back(std::move(c));
+                } while (accept_word("and"));
+                if (is_word("or")) throw db_query_exception{ "`or` is not supported" };
+                return conditions;
+            }
+            select_statement parse_select() {
+                select_statement s;
+                expect_word("select");
+                s.distinct = accept_word("distinct");
+                do s.items.push_back(parse_select_item());
+                while (accept_symbol(","));
+                expect_word("from");
+                do {
+                    table_ref ref;
+                    ref.table = parse_name();
+                    if (accept_word("as")
+                        || peek().kind == token_kind::name
+                        || (peek().kind == token_kind::word && !is_reserved(peek().text)))
+                        ref.alias = parse_name();
+                    s.from.push_back(std::move(ref));
+                } while (accept_symbol(","));
+                if (accept_word("where")) s.where = parse_conditions();
+                if (accept_word("group")) {
+                    expect_word("by");
+                    s.group_by = parse_column();
+                }
+                if (accept_word("having")) {
+                    having_clause having;
+                    having.aggregate = parse_select_item();
+                    if (having.aggregate.kind != select_item::count
+                        && having.aggregate.kind != select_item::sum)
+                        throw db_query_exception{ "`having` needs count(*) or sum(column)" };
+                    having.op = parse_compare_op();
+                    if (accept_word("all")) having.subquery = parse_subquery();
+                    else having.value = parse_value();
+                    s.having = std::move(having);
+                }
+                if (accept_word("order")) {
+                    expect_word("by");
+                    s.order_by = parse_column();
+                    if (accept_word("desc")) s.descending = true;
+                    else accept_word("asc");
+                }
+                while (true) {
+                    if (accept_word("limit")) s.limit = parse_count();
+                    else if (accept_word("offset")) s.offset = parse_count();
+                    else break;
+                }
+                return s;
+            }
+            // skips a definition of `create table`
+            void skip_definition() {
+                int depth = 0;
+                while (!at_end()) {
+                    if (depth == 0 && (is_symbol(",") || is_symbol(")"))) return;
+                    if (is_symbol("(")) ++depth;
+                    else if (is_symbol(")")) --depth;
+                    ++pos_;
+                }
+            }
+
+            memory_table& find_table(const std::string& name) {
+                auto it = db_.tables.find(name);
+                if (it == db_.tables.end())
+                    throw db_query_exception{ "relation \"" + name + "\" does not exist" };
+                return it->second;
+            }
+            static std::size_t find_column(const memory_table& table, const std::string& name) {
+                auto it = std::find(table.columns.begin(), table.columns.end(), name);
+                if (it == table.columns.end())
+                    throw db_query_exception{ "column \"" + name + "\" does not exist" };
+                return it - table.columns.begin();
+            }
+            binding bind_tables(const std::vector<table_ref>& refs) {
+                binding b;
+                for (const table_ref& ref : refs) {
+                    b.tables.push_back(&find_table(ref.table));
+                    b.refs.push_back(ref);
+                }
+                return b;
+            }
+            static bound_operand bind(const binding& b, const operand& op) {
+                bound_operand res;
+                if (!op.is_column) {
+                    res.value = op.value;
+                    return res;
+                }
+                for (std::size_t i = 0; i < b.tables.size(); ++i) {
+                    if (!op.table.empty() && op.table != b.refs[i].alias
+                        && op.table != b.refs[i].table) continue;
+                    const std::vector<std::string>& columns = b.tables[i]->columns;
+                    auto it = std::find(columns.begin(), columns.end(), op.column);
+                    if (it == columns.end()) continue;
+                    if (res.table >= 0)
+                        throw db_query_exception{ "column reference \"" + op.column + "\" is ambiguous" };
+                    res.table = (int)i;
+                    res.column = it - columns.begin();
+                }
+                if (res.table < 0)
+                    throw db_query_exception{ "column \""
+                        + (op.table.empty() ? "" : op.table + ".") + op.column + "\" does not exist" };
+                return res;
+            }
+            // the values of the first column of the subquery
+            std::vector<value_type> run_subquery(const select_statement& s) {
+                db_table table = run_select(s);
+                if (table.columns.size() != 1)
+                    throw db_query_exception{ "subquery must return only one column" };
+                std::vector<value_type> values;
+                for (auto& row : table.rows) values.push_back(std::move(row[0]));
+                return values;
+            }
+            std::vector<bound_condition> bind_conditions(
+                const binding& b, const std::vector<condition>& conditions) {
+                std::vector<bound_condition> res;
+                for (const condition& c : conditions) {
+                    bound_condition bc;
+                    bc.left = bind(b, c.left);
+                    bc.op = c.op;
+                    bc.right = bind(b, c.right);
+                    if (c.subquery != nullptr) bc.in = run_subquery(*c.subquery);
+                    bc.last_table = std::max(bc.left.table, bc.right.table);
+                    res.push_back(std::move(bc));
+                }
+                return res;
+            }
+            // the rows of the tables of `b` (joined in nested loops)
+            // which satisfy the conditions
+            static void scan(
+                const binding& b, const std::vector<bound_condition>& conditions,
+                std::size_t depth, joined_row& row, std::vector<joined_row>& rows) {
+                if (depth == b.tables.size()) {
+                    rows.push_back(row);
+                    return;
+                }
+                for (const memory_row& r : b.tables[depth]->rows) {
+                    row[depth] = &r;
+                    bool matched = true;
+                    for (const bound_condition& c : conditions) {
+                        if (c.last_table == (int)depth && !c.test(row)) {
+                            matched = false;
+                            break;
+                        }
+                    }
+                    if (matched) scan(b, conditions, depth + 1, row, rows);
+                }
+            }
+            std::vector<joined_row> find_rows(
+                const binding& b, const std::vector<bound_condition>& conditions) {
+                std::vector<joined_row> rows;
+                joined_row row(b.tables.size());
+                for (const bound_condition& c : conditions)
+                    if (c.last_table < 0 && !c.test(row)) return rows;
+                scan(b, conditions, 0, row, rows);
+                return rows;
+            }
+            static value_type aggregate(
+                const select_item& item, const bound_operand& column,
+                const std::vector<const joined_row*>& rows) {
+                if (item.kind == select_item::count) return std::to_string(rows.size());
+                std::vector<const std::string*> values;
+                for (const joined_row* row : rows) {
+                    const value_type& value = column.eval(*row);
+                    if (value.has_value()) values.push_back(&*value);
+                }
+                if (values.empty()) return std::nullopt;
+                std::int64_t sum = 0, n;
+                bool integral = true;
+                for (const std::string* value : values) {
+                    if (!to_integer(*value, n)) {
+                        integral = false;
+                        break;
+                    }
+                    sum += n;
+                }
+                if (integral) return std::to_string(sum);
+                double real_sum = 0, x;
+                for (const std::string* value : values) {
+                    if (!to_number(*value, x))
+                        throw db_query_exception{ "sum of a value which is not a number" };
+                    real_sum += x;
+                }
+                return number_to_string(real_sum);
+            }
+
+            db_table run_select(const select_statement& s) {
+                binding b = bind_tables(s.from);
+                std::vector<joined_row> rows = find_rows(b, bind_conditions(b, s.where));
+                db_table res;
+                std::vector<bound_operand> columns;
+                bool grouped = s.group_by.has_value() || s.having.has_value();
+                for (const select_item& item : s.items) {
+                    switch (item.kind) {
+                    case select_item::star:
+                        for (std::size_t i = 0; i < b.tables.size(); ++i) {
+                            for (std::size_t j = 0; j < b.tables[i]->columns.size(); ++j) {
+                                res.columns.push_back(b.tables[i]->columns[j]);
+                                columns.push_back({ (int)i, j, std::nullopt });
+                            }
+                        }
+                        break;
+                    case select_item::field:
+                        res.columns.push_back(item.column.column);
+                        columns.push_back(bind(b, item.column));
+                        break;
+                    case select_item::count:
+                        res.columns.push_back("count");
+                        columns.emplace_back();
+                        grouped = true;
+                        break;
+                    case select_item::sum:
+                        res.columns.push_back("sum");
+                        columns.push_back(bind(b, item.column));
+                        grouped = true;
+                        break;
+                    }
+                }
+                if (!grouped) {
+                    if (s.order_by.has_value()) {
+                        bound_operand key = bind(b, *s.order_by);
+                        // the nulls are larger than the other values
+                        std::stable_sort(rows.begin(), rows.end(),
+                            [&](const joined_row& x, const joined_row& y) {
+                                const value_type& a = key.eval(s.descending ? y : x);
+                                const value_type& c = key.eval(s.descending ? x : y);
+                                if (!a.has_value() || !c.has_value())
+                                    return a.has_value() && !c.has_value();
+                                return *compare_values(a, c) < 0;
+                            });
+                    }
+                    for (const joined_row& row : rows) {
+                        std::vector<value_type>& values = res.rows.emplace_back();
+                        for (const bound_operand& column : columns)
+                            values.push_back(column.eval(row));
+                    }
+                }
+                else {
+                    if (s.order_by.has_value())
+                        throw db_query_exception{ "`order by` with aggregates is not supported" };
+                    // the groups are in the order of their first rows
+                    std::vector<std::vector<const joined_row*>> groups;
+                    if (!s.group_by.has_value()) {
+                        groups.emplace_back();
+                        for (const joined_row& row : rows) groups[0].push_back(&row);
+                    }
+                    else {
+                        bound_operand key = bind(b, *s.group_by);
+                        std::map<value_type, std::size_t> index;
+                        for (const joined_row& row : rows) {
+                            auto [it, inserted] = index.try_emplace(key.eval(row), groups.size());
+                            if (inserted) groups.emplace_back();
+                            groups[it->second].push_back(&row);
+                        }
+                    }
+                    std::vector<value_type> having_values;
+                    bound_operand having_column;
+                    if (s.having.has_value()) {
+                        if (s.having->subquery != nullptr)
+                            having_values = run_subquery(*s.having->subquery);
+                        else having_values.push_back(s.having->value.value);
+                        if (s.having->aggregate.kind == select_item::sum)
+                            having_column = bind(b, s.having->aggregate.column);
+                    }
+                    for (const auto& group : groups) {
+                        if (s.having.has_value()) {
+                            value_type value = aggregate(s.having->aggregate, having_column, group);
+                            bool matched = true;
+                            for (const value_type& other : having_values) {
+                                std::optional<int> c = compare_values(value, other);
+                                if (!c.has_value() || !satisfies(s.having->op, *c)) {
+                                    matched = false;
+                                    break;
+                                }
+                            }
+                            if (!matched) continue;
+                        }
+                        std::vector<value_type>& values = res.rows.emplace_back();
+                        for (std::size_t i = 0; i < s.items.size(); ++i) {
+                            const select_item& item = s.items[i];
+                            if (item.kind == select_item::star)
+                                throw db_query_exception{ "`*` with aggregates is not supported" };
+                            if (item.kind == select_item::field)
+                                values.push_back(group.empty() ? std::nullopt : columns[i].eval(*group[0]));
+                            else values.push_back(aggregate(item, columns[i], group));
+                        }
+                    }
+                }
+                if (s.distinct) {
+                    std::set<std::vector<value_type>> seen;
+                    std::vector<std::vector<value_type>> distinct_rows;
+                    for (auto& row : res.rows)
+                        if (seen.insert(row).second) distinct_rows.push_back(std::move(row));
+                    res.rows = std::move(distinct_rows);
+                }
+                std::size_t begin = std::min(s.offset, res.rows.size());
+                std::size_t end = s.limit.has_value()
+                    ? std::min(res.rows.size(), begin + *s.limit) : res.rows.size();
+                res.rows.erase(res.rows.begin() + end, res.rows.end());
+                res.rows.erase(res.rows.begin(), res.rows.begin() + begin);
+                return res;
+            }
+
+            void record(memory_change::kind_type kind, const std::string& table, memory_row row) {
+                if (changes_ != nullptr)
+                    changes_->push_back({ kind, table, std::move(row) });
+            }
+
+            void run_insert() {
+                expect_word("into");
+                std::string name = parse_name();
+                memory_table& table = find_table(name);
+                std::vector<std::size_t> columns;
+                if (accept_symbol("(")) {
+                    do columns.push_back(find_column(table, parse_name()));
+                    while (accept_symbol(","));
+                    expect_symbol(")");
+                }
+                else {
+                    for (std::size_t i = 0; i < table.columns.size(); ++i) columns.push_back(i);
+                }
+                expect_word("values");
+                do {
+                    memory_row row{ db_.next_row_id++, std::vector<value_type>(table.columns.size()) };
+                    std::vector<bool> given(table.columns.size());
+                    expect_symbol("(");
+                    for (std::size_t i = 0; i < columns.size(); ++i) {
+                        if (i > 0) expect_symbol(",");
+                        row.values[columns[i]] = parse_value().value;
+                        given[columns[i]] = true;
+                    }
+                    expect_symbol(")");
+                    for (std::size_t i = 0; i < table.columns.size(); ++i) {
+                        if (!table.serial[i]) continue;
+                        std::int64_t n;
+                        if (!given[i]) row.values[i] = std::to_string(table.next_serial++);
+                        else if (row.values[i].has_value() && to_integer(*row.values[i], n))
+                            table.next_serial = std::max(table.next_serial, n + 1);
+                    }
+                    record(memory_change::inserted, name, { row.id, {} });
+                    table.rows.push_back(std::move(row));
+                } while (accept_symbol(","));
+            }
+
+            // column = value | column [+|- value] | not column
+            struct assignment {
+                std::size_t column;
+                bool negate = false;
+                bound_operand left;
+                char op = 0;
+                bound_operand right;
+                value_type eval(const joined_row& row) const {
+                    const value_type& x = left.eval(row);
+                    if (!x.has_value()) return std::nullopt;
+                    if (negate) {
+                        if (*x == "t" || *x == "true") return "f";
+                        if (*x == "f" || *x == "false") return "t";
+                        throw db_query_exception{ "`not` of a value which is not a boolean" };
+                    }
+                    if (op == 0) return x;
+                    const value_type& y = right.eval(row);
+                    if (!y.has_value()) return std::nullopt;
+                    std::int64_t a, b;
+                    if (to_integer(*x, a) && to_integer(*y, b))
+                        return std::to_string(op == '+' ? a + b : a - b);
+                    double c, d;
+                    if (!to_number(*x, c) || !to_number(*y, d))
+                        throw db_query_exception{ "arithmetic on a value which is not a number" };
+                    return number_to_string(op == '+' ? c + d : c - d);
+                }
+            };
+
+            void run_update() {
+                std::string name = parse_name();
+                memory_table& table = find_table(name);
+                binding b = bind_tables({ { name, "" } });
+                expect_word("set");
+                std::vector<assignment> assignments;
+                do {
+                    assignment a;
+                    a.column = find_column(table, parse_name());
+                    expect_symbol("=");
+                    a.negate = accept_word("not");
+                    a.left = bind(b, parse_operand());
+                    if (!a.negate && (is_symbol("+") || is_symbol("-"))) {
+                        a.op = tokens_[pos_++].text[0];
+                        a.right = bind(b, parse_operand());
+                    }
+                    assignments.push_back(std::move(a));
+                } while (accept_symbol(","));
+                std::vector<bound_condition> conditions;
+                if (accept_word("where")) conditions = bind_conditions(b, parse_conditions());
+                joined_row row(1);
+                for (memory_row& r : table.rows) {
+                    row[0] = &r;
+                    if (!std::all_of(conditions.begin(), conditions.end(),
+                        [&](const bound_condition& c) { return c.test(row); })) continue;
+                    // all the new values are computed from the old ones
+                    std::vector<value_type> values = r.values;
+                    for (const assignment& a : assignments) values[a.column] = a.eval(row);
+                    record(memory_change::updated, name, r);
+                    r.values = std::move(values);
+                }
+            }
+
+            void run_delete() {
+                expect_word("from");
+                std::string name = parse_name();
+                memory_table& table = find_table(name);
+                binding b = bind_tables({ { name, "" } });
+                std::vector<bound_condition> conditions;
+                if (accept_word("where")) conditions = bind_conditions(b, parse_conditions());
+                std::vector<memory_row> kept;
+                joined_row row(1);
+                for (memory_row& r : table.rows) {
+                    row[0] = &r;
+                    if (std::all_of(conditions.begin(), conditions.end(),
+                        [&](const bound_condition& c) { return c.test(row); }))
+                        record(memory_change::deleted, name, std::move(r));
+                    else kept.push_back(std::move(r));
+                }
+                table.rows = std::move(kept);
+            }
+
+            // the types, defaults and constraints are ignored,
+            // except that the serial columns are numbered
+            void run_create() {
+                expect_word("table");
+                bool if_not_exists = false;
+                if (accept_word("if")) {
+                    expect_word("not");
+                    expect_word("exists");
+                    if_not_exists = true;
+                }
+                std::string name = parse_name();
+                memory_table table;
+                expect_symbol("(");
+                do {
+                    if (is_word("primary") || is_word("unique") || is_word("foreign")
+                        || is_word("constraint") || is_word("check")) {
+                        skip_definition();
+                        continue;
+                    }
+                    table.columns.push_back(parse_name());
+                    table.serial.push_back(is_word("serial") || is_word("bigserial") || is_word("smallserial"));
+                    skip_definition();
+                } while (accept_symbol(","));
+                expect_symbol(")");
+                if (db_.tables.count(name) != 0) {
+                    if (if_not_exists) return;
+                    throw db_query_exception{ "relation \"" + name + "\" already exists" };
+                }
+                db_.tables.emplace(name, std::move(table));
+            }
+
+            void run_drop() {
+                expect_word("table");
+                bool if_exists = false;
+                if (accept_word("if")) {
+                    expect_word("exists");
+                    if_exists = true;
+                }
+                do {
+                    std::string name = parse_name();
+                    if (db_.tables.erase(name) == 0 && !if_exists)
+                        throw db_query_exception{ "relation \"" + name + "\" does not exist" };
+                } while (accept_symbol(","));
+                accept_word("cascade");
+            }
+
+            db_table run_statement() {
+                if (is_word("select")) return run_select(parse_select());
+                if (accept_word("insert")) run_insert();
+                else if (accept_word("update")) run_update();
+                else if (accept_word("delete")) run_delete();
+                else if (accept_word("create")) run_create();
+                else if (accept_word("drop")) run_drop();
+                else if (peek().kind == token_kind::word)
+                    throw db_query_exception{ "unsupported statement: " + peek().text };
+                else unexpected();
+                return {};
+            }
+        public:
+            memory_query(memory_database& db, const std::string& sql,
+                std::vector<memory_change>* changes)
+                : db_{ db }, changes_{ changes }, tokens_{ tokenize(sql) } {}
+            // runs the statements, and returns the result of the last one
+            db_table run() {
+                db_table res;
+                while (!at_end()) {
+                    if (accept_symbol(";")) continue;
+                    res = run_statement();
+                    if (!at_end()) expect_symbol(";");
+                }
+                return res;
+            }
+        };
+
+        void undo(memory_database& db, std::vector<memory_change>& changes) {
+            for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+                auto table = db.tables.find(it->table);
+                if (table == db.tables.end()) continue;
+                std::vector<memory_row>& rows = table->second.rows;
+                auto pos = std::lower_bound(rows.begin(), rows.end(), it->row.id,
+                    [](const memory_row& row, std::uint64_t id) { return row.id < id; });
+                bool found = pos != rows.end() && pos->id == it->row.id;
+                switch (it->kind) {
+                case memory_change::inserted:
+                    if (found) rows.erase(pos);
+                    break;
+                case memory_change::updated:
+                    if (found) pos->values = std::move(it->row.values);
+                    break;
+                case memory_change::deleted:
+                    rows.insert(pos, std::move(it->row));
+                    break;
+                }
+            }
+            changes.clear();
+        }
+
+        class memory_transaction : public db_backend_transaction {
+        private:
+            std::shared_ptr<memory_database> db_;
+            std::vector<memory_change> changes_;
+        public:
+            memory_transaction(std::shared_ptr<memory_database> db) : db_{ std::move(db) } {}
+            ~memory_transaction() { abort(); }
+            std::string quote(const std::string& value) { return quote_text(value, '\''); }
+            std::string quote_name(const std::string& name) { return quote_text(name, '"'); }
+            db_result exec(const std::string& query) {
+                std::lock_guard<std::mutex> lg{ db_->lock };
+                auto table = std::make_shared<db_table>(
+                    memory_query{ *db_, query, &changes_ }.run());
+                table->query = query;
+                return db_result{ std::move(table) };
+            }
+            void commit() { changes_.clear(); }
+            void abort() {
+                if (changes_.empty()) return;
+                std::lock_guard<std::mutex> lg{ db_->lock };
+                undo(*db_, changes_);
+            }
+        };
+
+        class memory_connection : public db_backend_connection {
+        private:
+            std::shared_ptr<memory_database> db_;
+        public:
+            memory_connection(std::shared_ptr<memory_database> db) : db_{ std::move(db) } {}
+            std::unique_ptr<db_backend_transaction> begin() {
+                return std::make_unique<memory_transaction>(db_);
+            }
+        };
+
+    }  // namespace
+
+    memory_backend::memory_backend()
+        : db_{ std::make_shared<memory_database>() } {}
+
+    void memory_backend::run_script(const std::string& script) {
+        std::lock_guard<std::mutex> lg{ db_->lock };
+        memory_query{ *db_, script, nullptr }.run();
+    }
+
+    void memory_backend::load_script(const std::string& path) {
+        std::ifstream file{ path, std::ios::binary };
+        if (!file) throw std::runtime_error{ "cannot open '" + path + "'" };
+        std::ostringstream script;
+        script << file.rdbuf();
+        run_script(script.str());
+    }
+
+    std::shared_ptr<db_backend_connection> memory_backend::connect() {
+        return std::make_shared<memory_connection>(db_);
+    }
+
+    // **************************************************************************
+
+    namespace {
+
+        class record_transaction : public db_backend_transaction {
+        private:
+            std::shared_ptr<record_backend> backend_;
+            std::unique_ptr<db_backend_transaction> tx_;
+        public:
+            record_transaction(
+                std::shared_ptr<record_backend> backend,
+                std::unique_ptr<db_backend_transaction> tx)
+                : backend_{ std::move(backend) }, tx_{ std::move(tx) } {}
+            std::string quote(const std::string& value) { return tx_->quote(value); }
+            std::string quote_name(const std::string& name) { return tx_->quote_name(name); }
+            db_result exec(const std::string& query) {
+                db_result result = tx_->exec(query);
+                db_table table = result.to_table();
+                table.query = query;
+                backend_->record(table);
+                return result;
+            }
+            void commit() { tx_->commit(); }
+            void abort() { tx_->abort(); }
+        };
+
+        class record_connection : public db_backend_connection {
+        private:
+            std::shared_ptr<record_backend> backend_;
+            std::shared_ptr<db_backend_connection> conn_;
+        public:
+            record_connection(
+                std::shared_ptr<record_backend> backend,
+                std::shared_ptr<db_backend_connection> conn)
+                : backend_{ std::move(backend) }, conn_{ std::move(conn) } {}
+            std::unique_ptr<db_backend_transaction> begin() {
+                return std::make_unique<record_transaction>(backend_, conn_->begin());
+            }
+        };
+
+        boost::json::string_view to_json(const std::string& s) {
+            return { s.data(), s.size() };
+        }
+
+    }  // namespace
+
+    record_backend::record_backend(
+        std::shared_ptr<db_backend> backend, const std::string& path)
+        : backend_{ std::move(backend) } {
+        file_.open(path, std::ios::binary | std::ios::app);
+        if (!file_) throw std::runtime_error{ "cannot open '" + path + "'" };
+    }
+
+    void record_backend::record(const db_table& table) {
+        boost::json::array columns;
+        for (const std::string& column : table.columns)
+            columns.emplace_back(to_json(column));
+        boost::json::array rows;
+        for (const auto& row : table.rows) {
+            boost::json::array values;
+            for (const auto& value : row) {
+                if (value.has_value()) values.emplace_back(to_json(*value));
+                else values.emplace_back(nullptr);
+            }
+            rows.emplace_back(std::move(values));
+        }
+        boost::json::object obj;
+        obj["query"] = to_json(table.query);
+        obj["columns"] = std::move(columns);
+        obj["rows"] = std::move(rows);
+        std::string line = boost::json::serialize(obj);
+        line += '\n';
+        std::lock_guard<std::mutex> lg{ file_lock_ };
+        file_.write(line.data(), line.size());
+        file_.flush();
+    }
+
+    std::shared_ptr<db_backend_connection> record_backend::connect() {
+        return std::make_shared<record_connection>(shared_from_this(), backend_->connect());
+    }
+
+    // **************************************************************************
+
+    namespace {
+
+        class replay_transaction : public db_backend_transaction {
+        private:
+            std::shared_ptr<replay_backend> backend_;
+        public:
+            replay_transaction(std::shared_ptr<replay_backend> backend)
+                : backend_{ std::move(backend) } {}
+            // as postgresql quotes them, so that the queries are the same as those recorded
+            std::string quote(const std::string& value) { return quote_text(value, '\''); }
+            std::string quote_name(const std::string& name) { return quote_text(name, '"'); }
+            db_result exec(const std::string& query) { return backend_->find(query); }
+            void commit() {}
+            void abort() {}
+        };
+
+        class replay_connection : public db_backend_connection {
+        private:
+            std::shared_ptr<replay_backend> backend_;
+        public:
+            replay_connection(std::shared_ptr<replay_backend> backend)
+                : backend_{ std::move(backend) } {}
+            std::unique_ptr<db_backend_transaction> begin() {
+                return std::make_unique<replay_transaction>(backend_);
+            }
+        };
+
+    }  // namespace
+
+    replay_backend::replay_backend(const std::string& path) {
+        std::ifstream file{ path, std::ios::binary };
+        if (!file) throw std::runtime_error{ "cannot open '" + path + "'" };
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty()) continue;
+            const boost::json::value value = boost::json::parse(line);
+            const boost::json::object& record = value.as_object();
+            auto table = std::make_shared<db_table>();
+            table->query = std::string{ record.at("query").as_string() };
+            for (const auto& column : record.at("columns").as_array())
+                table->columns.emplace_back(std::string{ column.as_string() });
+            for (const auto& row : record.at("rows").as_array()) {
+                std::vector<std::optional<std::string>>& values = table->rows.emplace_back();
+                for (const auto& field : row.as_array()) {
+                    if (field.is_null()) values.emplace_back();
+                    else values.emplace_back(std::string{ field.as_string() });
+                }
+            }
+            std::string query = table->query;
+            results_[query].results.push_back(std::move(table));
+        }
+    }
+
+    db_result replay_backend::find(const std::string& query) {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        auto it = results_.find(query);
+        if (it == results_.end())
+            throw db_query_exception{ "the query is not recorded: " + query };
+        recorded_results& recorded = it->second;
+        std::shared_ptr<const db_table> table = recorded.results[recorded.next];
+        if (recorded.next + 1 < recorded.results.size()) ++recorded.next;
+        return db_result{ std::move(table) };
+    }
+
+    std::shared_ptr<db_backend_connection> replay_backend::connect() {
+        return std::make_shared<replay_connection>(shared_from_this());
+    }
+
+    // **************************************************************************
+
+    namespace {
+
+        class delayed_transaction : public db_backend_transaction {
+        private:
+            std::unique_ptr<db_backend_transaction> tx_;
+            std::chrono::microseconds latency_;
+        public:
+            delayed_transaction(
+                std::unique_ptr<db_backend_transaction> tx,
+                std::chrono::microseconds latency)
+                : tx_{ std::move(tx) }, latency_{ latency } {}
+            std::string quote(const std::string& value) { return tx_->quote(value); }
+            std::string quote_name(const std::string& name) { return tx_->quote_name(name); }
+            db_result exec(const std::string& query) {
+                std::this_thread::sleep_for(latency_);
+                return tx_->exec(query);
+            }
+            void commit() { tx_->commit(); }
+            void abort() { tx_->abort(); }
+        };
+
+        class delayed_connection : public db_backend_connection {
+        private:
+            std::shared_ptr<db_backend_connection> conn_;
+            std::chrono::microseconds latency_;
+        public:
+            delayed_connection(
+                std::shared_ptr<db_backend_connection> conn,
+                std::chrono::microseconds latency)
+                : conn_{ std::move(conn) }, latency_{ latency } {}
+            std::unique_ptr<db_backend_transaction> begin() {
+                return std::make_unique<delayed_transaction>(conn_->begin(), latency_);
+            }
+        };
+
+    }  // namespace
+
+    std::shared_ptr<db_backend_connection> delayed_backend::connect() {
+        return std::make_shared<delayed_connection>(backend_->connect(), latency_);
+    }
+
+}  // bserv
@@ -0,0 +1,316 @@
+#include "pch.h"
+#include "bserv/handoff.hpp"
+
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+
+#ifdef BSERV_HAS_HANDOFF
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "bserv/config.hpp"
+#include "bserv/logging.hpp"
+
+namespace bserv {
+
+#ifdef BSERV_HAS_HANDOFF
+
+    namespace {
+
+        // the first socket passed by systemd
+        constexpr int LISTEN_FDS_START = 3;
+
+        using local = asio::local::stream_protocol;
+
+        // whether the peer of a unix socket is a process of this user
+        bool same_user(int fd) {
+#ifdef SO_PEERCRED
+            ucred cred{};
+            socklen_t len = sizeof(cred);
+            return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+                && cred.uid == geteuid();
+#else
+            uid_t uid;
+            gid_t gid;
+            return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+        }
+
+        // the sockets are passed along with a single byte
+        bool send_sockets(int fd, const std::vector<native_socket>& sockets) {
+            char byte = 0;
+            iovec iov{ &byte, 1 };
+            std::vector<char> control(CMSG_SPACE(sizeof(int) * sockets.size()));
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data();
+            msg.msg_controllen = control.size();
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * sockets.size());
+            std::memcpy(CMSG_DATA(cmsg), sockets.data(), sizeof(int) * sockets.size());
+            ssize_t n;
+            do n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            while (n < 0 && errno == EINTR);
+            return n == 1;
+        }
+
+        std::vector<native_socket> receive_sockets(int fd) {
+            char byte;
+            iovec iov{ &byte, 1 };
+            std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKETS));
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data();
+            msg.msg_controllen = control.size();
+            int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+            flags |= MSG_CMSG_CLOEXEC;
+#endif
+            ssize_t n;
+            do n = recvmsg(fd, &msg, flags);
+            while (n < 0 && errno == EINTR);
+            std::vector<native_socket> sockets;
+            if (n != 1) return sockets;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                    continue;
+                std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                std::size_t offset = sockets.size();
+                sockets.resize(offset + count);
+                std::memcpy(sockets.data() + offset, CMSG_DATA(cmsg), sizeof(int) * count);
+            }
+            if (msg.msg_flags & MSG_CTRUNC)
+                lgwarning << "handoff: some of the listening sockets are dropped" << std::endl;
+            for (native_socket socket : sockets)
+                fcntl(socket, F_SETFD, FD_CLOEXEC);
+            return sockets;
+        }
+
+    }  // namespace
+
+    std::vector<native_socket> inherited_sockets() {
+        std::vector<native_socket> sockets;
+        const char* pid = std::getenv("LISTEN_PID");
+        const char* fds = std::getenv("LISTEN_FDS");
+        if (pid == nullptr || fds == nullptr) return sockets;
+        // they are meant for another process
+        if (std::strtol(pid, nullptr, 10) != getpid()) return sockets;
+        long count = std::strtol(fds, nullptr, 10);
+        for (long i = 0; i < count; ++i) {
+            native_socket socket = LISTEN_FDS_START + static_cast<int>(i);
+            fcntl(socket, F_SETFD, FD_CLOEXEC);
+            sockets.push_back(socket);
+        }
+        // so that the child processes do not take them as well
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        unsetenv("LISTEN_FDNAMES");
+        return sockets;
+    }
+
+    std::vector<native_socket> take_sockets(const std::string& path) {
+        asio::io_context ioc;
+        local::socket socket{ ioc };
+        boost::system::error_code ec;
+        socket.connect(local::endpoint{ path }, ec);
+        if (ec) {
+            lgdebug << "handoff: no running server at " << path << ": " << ec.message();
+            return {};
+        }
+        // the sockets are only passed when they are asked for
+        char request = 0;
+        asio::write(socket, asio::buffer(&request, 1), ec);
+        if (ec) {
+            lgwarning << "handoff: failed to ask " << path << " for the listening sockets: "
+                << ec.message() << std::endl;
+            return {};
+        }
+        int fd = socket.native_handle();
+        timeval timeout{ HANDOFF_TIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::vector<native_socket> sockets = receive_sockets(fd);
+        if (sockets.empty()) {
+            lgwarning << "handoff: no listening sockets are received from " << path << std::endl;
+            return sockets;
+        }
+        // the previous process closes the connection after it stops
+        // serving the path, which can then be replaced (see `handoff_server::run`)
+        char byte;
+        ssize_t n;
+        do n = recv(fd, &byte, 1, 0);
+        while (n > 0 || (n < 0 && errno == EINTR));
+        return sockets;
+    }
+
+    tcp socket_protocol(native_socket socket) {
+        sockaddr_storage addr{};
+        socklen_t len = sizeof(addr);
+        if (getsockname(socket, reinterpret_cast<sockaddr*>(&addr), &len) == 0
+            && addr.ss_family == AF_INET6)
+            return tcp::v6();
+        return tcp::v4();
+    }
+
+    native_socket duplicate_socket(native_socket socket) {
+        return fcntl(socket, F_DUPFD_CLOEXEC, 0);
+    }
+
+    void close_socket(native_socket socket) {
+        close(socket);
+    }
+
+    handoff_server::handoff_server(
+        asio::io_context& ioc, const std::string& path,
+        std::vector<native_socket> sockets,
+        std::function<void()> on_handoff)
+        : acceptor_{ asio::make_strand(ioc) },
+        path_{ path },
+        sockets_{ std::move(sockets) },
+        on_handoff_{ std::move(on_handoff) } {}
+
+    void handoff_server::run() {
+        boost::system::error_code ec;
+        local::endpoint endpoint{ path_ };
+        // the path is only replaced if no process serves it, i.e. the
+        // previous process has handed over (or has exited). connecting
+        // does not take the sockets of a running server, as they are
+        // not asked for.
+        {
+            local::socket probe{ acceptor_.get_executor() };
+            probe.connect(endpoint, ec);
+            if (!ec) {
+                lgerror << "handoff: " << path_
+                    << " is served by another process, the sockets are not passed" << std::endl;
+                return;
+            }
+        }
+        unlink(path_.c_str());
+        acceptor_.open(endpoint.protocol(), ec);
+        if (!ec) acceptor_.bind(endpoint, ec);
+        // only this user may connect to it. it is set before listening, as
+        // no process can connect to it until then. (the umask is not changed,
+        // as it is shared by the threads, which may be creating files.)
+        if (!ec && chmod(path_.c_str(), S_IRUSR | S_IWUSR) != 0)
+            ec.assign(errno, boost::system::system_category());
+        if (!ec) acceptor_.listen(1, ec);
+        if (ec) {
+            fail(ec, "handoff_server listen");
+            return;
+        }
+        do_accept();
+    }
+
+    void handoff_server::do_accept() {
+        acceptor_.async_accept(
+            [self = shared_from_this()](
+                const boost::system::error_code& ec, local::socket socket) {
+                self->on_accept(ec, std::move(socket));
+            });
+    }
+
+    void handoff_server::on_accept(
+        const boost::system::error_code& ec, local::socket socket) {
+        // it is stopped
+        if (!acceptor_.is_open()) return;
+        if (ec) {
+            fail(ec, "handoff_server async_accept");
+            do_accept();
+            return;
+        }
+        if (!same_user(socket.native_handle())) {
+            lgwarning << "handoff: a process of another user is refused" << std::endl;
+            do_accept();
+            return;
+        }
+        // waits for the request of the new process
+        auto peer = std::make_shared<local::socket>(std::move(socket));
+        auto request = std::make_shared<char>();
+        asio::async_read(
+            *peer, asio::buffer(request.get(), 1),
+            [self = shared_from_this(), peer, request](
+                const boost::system::error_code& ec, std::size_t) {
+                self->on_request(ec, *peer);
+            });
+        do_accept();
+    }
+
+    void handoff_server::on_request(
+        const boost::system::error_code& ec, local::socket& socket) {
+        // it is stopped (or has handed over to another process)
+        if (!acceptor_.is_open()) return;
+        // it is closed without asking for the sockets,
+        // e.g. by a process checking whether the path is served
+        if (ec) return;
+        if (!send_sockets(socket.native_handle(), sockets_)) {
+            lgerror << "handoff: failed to pass the listening sockets: "
+                << std::strerror(errno) << std::endl;
+            return;
+        }
+        lginfo << "handoff: the listening sockets are passed to a new process";
+        do_stop();
+        // tells the new process that the path is no longer served
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        on_handoff_();
+    }
+
+    void handoff_server::do_stop() {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+    }
+
+    void handoff_server::stop() {
+        asio::post(
+            acceptor_.get_executor(),
+            [self = shared_from_this()] { self->do_stop(); });
+    }
+
+#else
+
+    std::vector<native_socket> inherited_sockets() {
+        return {};
+    }
+
+    std::vector<native_socket> take_sockets(const std::string&) {
+        return {};
+    }
+
+    tcp socket_protocol(native_socket) {
+        return tcp::v4();
+    }
+
+    // there are no inherited sockets to duplicate or close
+    native_socket duplicate_socket(native_socket socket) {
+        return socket;
+    }
+
+    void close_socket(native_socket) {}
+
+    handoff_server::handoff_server(
+        asio::io_context&, const std::string& path,
+        std::vector<native_socket> sockets,
+        std::function<void()> on_handoff)
+        : path_{ path },
+        sockets_{ std::move(sockets) },
+        on_handoff_{ std::move(on_handoff) } {}
+
+    void handoff_server::run() {
+        lgwarning << "the handoff of the listening sockets is not supported" << std::endl;
+    }
+
+    void handoff_server::stop() {}
+
+#endif
+
+}  // bserv
@@ -0,0 +1,61 @@
+#ifndef _ACCESS_LOG_HPP
+#define _ACCESS_LOG_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace bserv {
+
+	// the access log has a record of each request (or of a sample of them),
+	// one JSON object per line:
+	//
+	// {"ts":1700000000123456,"route":"/list/<int>","method":"GET",
+	//  "status":200,"us":1530,"db_us":870,"in":412,"out":5120}
+	//
+	// - ts: when the response was written (microseconds since the epoch)
+	// - route: the url of the path that was matched, or "(unmatched)"
+	// - us: the time from reading the request to writing the response
+	// - db_us: the time the handler of the request spent in the database
+	//   (taking a connection from the pool, and executing queries). the
+	//   queries of other requests which run on the thread while it is
+	//   suspended (see `trace_guard`) are not counted.
+	// - in, out: the bytes read and written
+	//
+	// the records are formatted on the I/O threads, and are written to
+	// the file (in batches) by a thread of its own. records written by
+	// different threads may not be in order of time.
+	// `tools/access_log_summary` summarizes them by route.
+
+	struct access_record {
+		std::string_view route;
+		std::string_view method;
+		unsigned status;
+		std::chrono::steady_clock::duration latency;
+		std::chrono::steady_clock::duration db_time;
+		std::size_t bytes_in;
+		std::size_t bytes_out;
+	};
+
+	// starts writing the records to `path` (appending to it).
+	// one request in `sample` is logged. returns false
+	// if the file cannot be opened.
+	bool open_access_log(const std::string& path, int sample);
+
+	// writes the records that are left and closes the file
+	void close_access_log();
+
+	// whether the request being answered on this thread is to be logged.
+	// it is false if the access log is closed.
+	bool access_log_sampled();
+
+	void log_access(const access_record& record);
+
+	// the records that are dropped, because the buffer is full
+	std::uint64_t access_log_dropped();
+
+}  // bserv
+
+#endif  // _ACCESS_LOG_HPP
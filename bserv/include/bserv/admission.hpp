@@ -0,0 +1,102 @@
+#ifndef _ADMISSION_HPP
+#define _ADMISSION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+
+namespace bserv {
+
+	// the request is rejected because the server is overloaded.
+	// it is answered with 503 and `Retry-After`.
+	class service_unavailable_exception : public std::exception {
+	public:
+		service_unavailable_exception() = default;
+		const char* what() const noexcept { return "service unavailable"; }
+	};
+
+	struct admission_stats {
+		std::size_t connections;
+		std::size_t in_flight;
+		// whether the requests have been queued for too long (see below)
+		bool overloaded;
+		// the connections closed because there were too many of them
+		std::uint64_t rejected_connections;
+		// the requests rejected because too many were being handled
+		std::uint64_t rejected_requests;
+		// the requests shed because they had waited for too long
+		std::uint64_t shed_requests;
+	};
+
+	class admission_controller;
+
+	// one of the connections admitted by an `admission_controller`,
+	// which is given back when the ticket is destroyed
+	class connection_ticket {
+	private:
+		std::shared_ptr<admission_controller> controller_;
+	public:
+		connection_ticket() = default;
+		explicit connection_ticket(std::shared_ptr<admission_controller> controller)
+			: controller_{ std::move(controller) } {}
+		connection_ticket(connection_ticket&&) = default;
+		connection_ticket& operator=(connection_ticket&& other) noexcept;
+		~connection_ticket();
+		explicit operator bool() const { return controller_ != nullptr; }
+	};
+
+	// limits the work the server takes on, so that it degrades gracefully
+	// under overload instead of queuing without limit:
+	// - no more connections are accepted beyond `max_connections`;
+	// - requests beyond `max_in_flight` are answered with 503;
+	// - requests are shed by the time they wait to be handled (CoDel).
+	//   if no request waited less than `queue_target` during the last
+	//   `queue_interval`, there is a standing queue: the requests that
+	//   waited longer than `queue_target` are shed. otherwise only the
+	//   ones that waited longer than `queue_interval` are.
+	// a limit of 0 disables the check.
+	class admission_controller
+		: public std::enable_shared_from_this<admission_controller> {
+	private:
+		friend connection_ticket;
+		using clock = std::chrono::steady_clock;
+		const std::size_t max_connections_;
+		const std::size_t max_in_flight_;
+		const clock::duration queue_target_;
+		const clock::duration queue_interval_;
+		std::atomic<std::size_t> connections_{ 0 };
+		std::atomic<std::size_t> in_flight_{ 0 };
+		// the minimum queue delay in the current interval
+		std::atomic<std::int64_t> min_delay_ns_;
+		std::atomic<std::int64_t> interval_end_ns_;
+		std::atomic<bool> overloaded_{ false };
+		std::atomic<std::uint64_t> rejected_connections_{ 0 };
+		std::atomic<std::uint64_t> rejected_requests_{ 0 };
+		std::atomic<std::uint64_t> shed_requests_{ 0 };
+	public:
+		admission_controller(
+			std::size_t max_connections, std::size_t max_in_flight,
+			std::chrono::milliseconds queue_target,
+			std::chrono::milliseconds queue_interval);
+		admission_controller(const admission_controller&) = delete;
+		admission_controller& operator=(const admission_controller&) = delete;
+		// whether a new connection may be accepted
+		bool accepting() const;
+		// returns an empty ticket if there are too many connections
+		connection_ticket try_connect();
+		// returns false if there are too many requests being handled,
+		// otherwise `end_request` should be called for the request
+		bool try_begin_request();
+		void end_request();
+		// called when a request, which was received at `received`,
+		// is about to be handled. returns false if it should be shed.
+		bool admit(clock::time_point received);
+		admission_stats stats() const;
+	};
+
+}  // bserv
+
+#endif  // _ADMISSION_HPP
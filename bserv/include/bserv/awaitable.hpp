@@ -0,0 +1,155 @@
+#ifndef _AWAITABLE_HPP
+#define _AWAITABLE_HPP
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio.hpp>
+
+// handlers can be C++20 coroutines (returning `bserv::awaitable<...>`)
+// if the compiler supports them, e.g. g++ 10+ with -std=c++20.
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+#define BSERV_HAS_CO_AWAIT
+#endif
+
+#ifdef BSERV_HAS_CO_AWAIT
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "tracing.hpp"
+
+namespace bserv {
+
+	namespace asio = boost::asio;
+
+	template <typename Type>
+	using awaitable = asio::awaitable<Type>;
+
+	constexpr asio::use_awaitable_t<> use_awaitable;
+
+	template <typename Type>
+	struct is_awaitable : std::false_type {};
+
+	template <typename Type, typename Executor>
+	struct is_awaitable<asio::awaitable<Type, Executor>> : std::true_type {};
+
+	template <typename Type>
+	constexpr bool is_awaitable_v = is_awaitable<Type>::value;
+
+	// runs the functions of `Executor` with the trace of a request set
+	// (see `trace_scope`). a coroutine spawned on it is resumed with the
+	// trace set whenever it is resumed, on any thread, and the trace is
+	// cleared when it suspends, whatever it is waiting for.
+	template <typename Executor>
+	class traced_executor {
+	private:
+		Executor inner_;
+		std::uint64_t trace_;
+		std::chrono::steady_clock::duration* db_time_;
+	public:
+		traced_executor(Executor inner, std::uint64_t trace,
+			std::chrono::steady_clock::duration* db_time = nullptr)
+			: inner_{ std::move(inner) }, trace_{ trace }, db_time_{ db_time } {}
+		// the properties are those of `Executor`
+		template <typename Property>
+		auto query(const Property& p) const
+			-> decltype(asio::query(std::declval<const Executor&>(), p)) {
+			return asio::query(inner_, p);
+		}
+		template <typename Property>
+		auto require(const Property& p) const
+			-> traced_executor<std::decay_t<decltype(
+				asio::require(std::declval<const Executor&>(), p))>> {
+			return { asio::require(inner_, p), trace_, db_time_ };
+		}
+		template <typename Property>
+		auto prefer(const Property& p) const
+			-> traced_executor<std::decay_t<decltype(
+				asio::prefer(std::declval<const Executor&>(), p))>> {
+			return { asio::prefer(inner_, p), trace_, db_time_ };
+		}
+		template <typename Function>
+		void execute(Function&& fn) const {
+			inner_.execute(
+				[fn = std::forward<Function>(fn), trace = trace_, db_time = db_time_]() mutable {
+					trace_scope scope{ trace, db_time };
+					std::move(fn)();
+				});
+		}
+		friend bool operator==(const traced_executor& a, const traced_executor& b) noexcept {
+			return a.inner_ == b.inner_ && a.trace_ == b.trace_ && a.db_time_ == b.db_time_;
+		}
+		friend bool operator!=(const traced_executor& a, const traced_executor& b) noexcept {
+			return !(a == b);
+		}
+	};
+
+	namespace awaitable_internal {
+
+		// the value of `aw`, which is only constructed if it completes
+		template <typename Type>
+		awaitable<std::optional<Type>> to_optional(awaitable<Type> aw) {
+			co_return std::optional<Type>{ co_await std::move(aw) };
+		}
+
+		// runs `aw` on `ioc` and suspends the stackful coroutine of `yield`
+		// until it completes. `done` is called with the exception (if any)
+		// and the value of `aw` before the coroutine is resumed.
+		template <typename Type, typename Done>
+		void spawn_and_wait(
+			asio::io_context& ioc, awaitable<Type> aw,
+			asio::yield_context& yield, Done done) {
+			asio::async_initiate<asio::yield_context&, void()>(
+				[&](auto handler) {
+					asio::co_spawn(
+						ioc, std::move(aw),
+						[&done, handler = std::move(handler)](
+							auto&& ...results) mutable {
+								done(std::forward<decltype(results)>(results)...);
+								// resumes the stackful coroutine on its own strand
+								auto ex = asio::get_associated_executor(handler);
+								asio::dispatch(ex, std::move(handler));
+						});
+				}, yield);
+		}
+
+	}  // awaitable_internal
+
+	// runs `aw` to completion from a stackful coroutine
+	template <typename Type>
+	Type run_awaitable(
+		asio::io_context& ioc, awaitable<Type> aw,
+		asio::yield_context& yield) {
+		const trace_guard guard;
+		std::exception_ptr error;
+		std::optional<Type> result;
+		awaitable_internal::spawn_and_wait(
+			ioc, awaitable_internal::to_optional(std::move(aw)), yield,
+			[&](std::exception_ptr e, std::optional<Type> value) {
+				error = e;
+				if (!error) result = std::move(value);
+			});
+		if (error) std::rethrow_exception(error);
+		return std::move(*result);
+	}
+
+	template <>
+	inline void run_awaitable<void>(
+		asio::io_context& ioc, awaitable<void> aw,
+		asio::yield_context& yield) {
+		const trace_guard guard;
+		std::exception_ptr error;
+		awaitable_internal::spawn_and_wait(
+			ioc, std::move(aw), yield,
+			[&](std::exception_ptr e) { error = e; });
+		if (error) std::rethrow_exception(error);
+	}
+
+}  // bserv
+
+#endif  // BSERV_HAS_CO_AWAIT
+
+#endif  // _AWAITABLE_HPP
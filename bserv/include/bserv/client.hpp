@@ -8,8 +8,12 @@
 
 #include <iostream>
 #include <string>
+#include <chrono>
 #include <exception>
 
+#include "awaitable.hpp"
+#include "config.hpp"
+
 namespace bserv {
 
 	namespace beast = boost::beast;
@@ -30,12 +34,26 @@ namespace bserv {
 		const char* what() const noexcept { return msg_.c_str(); }
 	};
 
+	// `timeout` applies to the connection, and to the request and
+	// the response together
 	http::response<http::string_body> http_client_send(
 		asio::io_context& ioc,
 		asio::yield_context& yield,
 		const std::string& host,
 		const std::string& port,
-		const http::request<http::string_body>& req);
+		const http::request<http::string_body>& req,
+		std::chrono::steady_clock::duration timeout =
+			std::chrono::seconds(CLIENT_TIMEOUT));
+
+#ifdef BSERV_HAS_CO_AWAIT
+	awaitable<http::response<http::string_body>> co_http_client_send(
+		asio::io_context& ioc,
+		const std::string& host,
+		const std::string& port,
+		const http::request<http::string_body>& req,
+		std::chrono::steady_clock::duration timeout =
+			std::chrono::seconds(CLIENT_TIMEOUT));
+#endif
 
 	request_type get_request(
 		const std::string& host,
@@ -43,18 +61,33 @@ namespace bserv {
 		const http::verb& method,
 		const boost::json::value& val);
 
+	// the blocking-style functions suspend the stackful coroutine of the
+	// handler; the `co_` functions are used by C++20 coroutine handlers.
 	class http_client {
 	private:
 		asio::io_context& ioc_;
-		asio::yield_context& yield_;
+		// null if the handler is a C++20 coroutine
+		asio::yield_context* yield_;
+		const std::chrono::steady_clock::duration timeout_;
 	public:
-		http_client(asio::io_context& ioc, asio::yield_context& yield)
-			: ioc_{ ioc }, yield_{ yield } {}
+		http_client(
+			asio::io_context& ioc, asio::yield_context& yield,
+			std::chrono::steady_clock::duration timeout =
+				std::chrono::seconds(CLIENT_TIMEOUT))
+			: ioc_{ ioc }, yield_{ &yield }, timeout_{ timeout } {}
+		explicit http_client(
+			asio::io_context& ioc,
+			std::chrono::steady_clock::duration timeout =
+				std::chrono::seconds(CLIENT_TIMEOUT))
+			: ioc_{ ioc }, yield_{ nullptr }, timeout_{ timeout } {}
 		http::response<http::string_body> request(
 			const std::string& host,
 			const std::string& port,
 			const http::request<http::string_body>& req) {
-			return http_client_send(ioc_, yield_, host, port, req);
+			if (yield_ == nullptr)
+				throw request_failed_exception{
+					"http_client: a coroutine handler should use the co_ functions" };
+			return http_client_send(ioc_, *yield_, host, port, req, timeout_);
 		}
 		boost::json::value request_for_value(
 			const std::string& host,
@@ -138,6 +171,99 @@ namespace bserv {
 			const boost::json::value& val) {
 			return send_for_value(host, port, target, http::verb::delete_, val);
 		}
+
+#ifdef BSERV_HAS_CO_AWAIT
+		// the arguments should live until the result is awaited
+		awaitable<response_type> co_request(
+			const std::string& host,
+			const std::string& port,
+			const request_type& req) {
+			co_return co_await co_http_client_send(ioc_, host, port, req, timeout_);
+		}
+		awaitable<boost::json::value> co_request_for_value(
+			const std::string& host,
+			const std::string& port,
+			const request_type& req) {
+			response_type res = co_await co_request(host, port, req);
+			co_return boost::json::parse(res.body());
+		}
+
+		awaitable<response_type> co_send(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const http::verb& method,
+			const boost::json::value& val) {
+			request_type req = get_request(host, target, method, val);
+			co_return co_await co_request(host, port, req);
+		}
+		awaitable<boost::json::value> co_send_for_value(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const http::verb& method,
+			const boost::json::value& val) {
+			request_type req = get_request(host, target, method, val);
+			co_return co_await co_request_for_value(host, port, req);
+		}
+
+		awaitable<response_type> co_get(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send(host, port, target, http::verb::get, val);
+		}
+		awaitable<boost::json::value> co_get_for_value(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send_for_value(host, port, target, http::verb::get, val);
+		}
+		awaitable<response_type> co_put(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send(host, port, target, http::verb::put, val);
+		}
+		awaitable<boost::json::value> co_put_for_value(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send_for_value(host, port, target, http::verb::put, val);
+		}
+		awaitable<response_type> co_post(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send(host, port, target, http::verb::post, val);
+		}
+		awaitable<boost::json::value> co_post_for_value(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send_for_value(host, port, target, http::verb::post, val);
+		}
+		awaitable<response_type> co_delete_(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send(host, port, target, http::verb::delete_, val);
+		}
+		awaitable<boost::json::value> co_delete_for_value(
+			const std::string& host,
+			const std::string& port,
+			const std::string& target,
+			const boost::json::value& val) {
+			co_return co_await co_send_for_value(host, port, target, http::verb::delete_, val);
+		}
+#endif
 	};
 
 }  // bserv
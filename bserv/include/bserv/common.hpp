@@ -5,13 +5,19 @@
 #define _WIN32_WINNT 0x0601
 #endif
 
+#include "admission.hpp"
+#include "awaitable.hpp"
 #include "client.hpp"
+#include "compute.hpp"
 #include "config.hpp"
 #include "database.hpp"
+#include "db_backend.hpp"
 #include "logging.hpp"
+#include "metrics.hpp"
 #include "router.hpp"
 #include "server.hpp"
 #include "session.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 #include "websocket.hpp"
 
@@ -0,0 +1,188 @@
+#ifndef _COMPUTE_HPP
+#define _COMPUTE_HPP
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "awaitable.hpp"
+#include "tracing.hpp"
+
+namespace bserv {
+
+	namespace asio = boost::asio;
+
+	struct compute_stats {
+		// the tasks waiting for a thread
+		std::size_t queued;
+		// the tasks being run
+		std::size_t running;
+		// the maximum of `queued` so far
+		std::size_t max_queued;
+		std::uint64_t completed;
+		// the tasks run by the caller, because the queue was full
+		std::uint64_t ran_inline;
+		// the total time the completed tasks waited for a thread
+		std::chrono::nanoseconds total_wait;
+	};
+
+	// a pool of threads for CPU-bound work (password hashing, rendering,
+	// serialization of large values, ...), so that the I/O threads are
+	// not blocked by it. the queue is bounded: if it is full, a task is
+	// run by the caller instead.
+	class compute_pool {
+	private:
+		asio::thread_pool pool_;
+		const std::size_t queue_limit_;
+		std::atomic<std::size_t> queued_{ 0 };
+		std::atomic<std::size_t> running_{ 0 };
+		std::atomic<std::size_t> max_queued_{ 0 };
+		std::atomic<std::uint64_t> completed_{ 0 };
+		std::atomic<std::uint64_t> ran_inline_{ 0 };
+		std::atomic<std::int64_t> total_wait_ns_{ 0 };
+	public:
+		compute_pool(int num_threads, std::size_t queue_limit);
+		compute_pool(const compute_pool&) = delete;
+		compute_pool& operator=(const compute_pool&) = delete;
+		// waits for the queued tasks
+		~compute_pool();
+		// runs `task()` on a thread of the pool (or on the caller)
+		template <typename Task>
+		void submit(Task&& task) {
+			std::size_t queued = ++queued_;
+			if (queued > queue_limit_) {
+				--queued_;
+				++ran_inline_;
+				task();
+				return;
+			}
+			std::size_t max_queued = max_queued_.load(std::memory_order_relaxed);
+			while (queued > max_queued
+				&& !max_queued_.compare_exchange_weak(max_queued, queued)) {}
+			asio::post(pool_,
+				[this, start = std::chrono::steady_clock::now(),
+				task = std::forward<Task>(task)]() mutable {
+					--queued_;
+					++running_;
+					total_wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+						std::chrono::steady_clock::now() - start).count();
+					task();
+					--running_;
+					++completed_;
+				});
+		}
+		compute_stats stats() const;
+	};
+
+	namespace compute_internal {
+
+		// the result of a function, or the exception it throws
+		template <typename Result>
+		struct outcome {
+			std::optional<Result> value;
+			std::exception_ptr error;
+			template <typename Function>
+			void run(Function& fn) {
+				try { value.emplace(fn()); }
+				catch (...) { error = std::current_exception(); }
+			}
+			Result get() {
+				if (error) std::rethrow_exception(error);
+				return std::move(*value);
+			}
+		};
+
+		template <>
+		struct outcome<void> {
+			std::exception_ptr error;
+			template <typename Function>
+			void run(Function& fn) {
+				try { fn(); }
+				catch (...) { error = std::current_exception(); }
+			}
+			void get() {
+				if (error) std::rethrow_exception(error);
+			}
+		};
+
+	}  // compute_internal
+
+	// runs `fn()` on `pool`, suspending the stackful coroutine of `yield`
+	// until it completes. the result (or exception) of `fn` is returned.
+	template <typename Function>
+	std::invoke_result_t<Function&> offload(
+		compute_pool& pool, asio::yield_context& yield, Function&& fn) {
+		const trace_guard guard;
+		compute_internal::outcome<std::invoke_result_t<Function&>> result;
+		asio::async_initiate<asio::yield_context&, void()>(
+			[&](auto handler) {
+				pool.submit([&, handler = std::move(handler)]() mutable {
+					result.run(fn);
+					// resumes the coroutine on its own strand
+					auto ex = asio::get_associated_executor(handler);
+					asio::post(ex, std::move(handler));
+				});
+			}, yield);
+		return result.get();
+	}
+
+#ifdef BSERV_HAS_CO_AWAIT
+	// the same as `offload`, for C++20 coroutines
+	template <typename Function>
+	awaitable<std::invoke_result_t<Function&>> co_offload(
+		compute_pool& pool, Function fn) {
+		const trace_guard guard;
+		compute_internal::outcome<std::invoke_result_t<Function&>> result;
+		co_await asio::async_initiate<const asio::use_awaitable_t<>&, void()>(
+			[&](auto handler) {
+				pool.submit([&, handler = std::move(handler)]() mutable {
+					result.run(fn);
+					auto ex = asio::get_associated_executor(handler);
+					asio::post(ex, std::move(handler));
+				});
+			}, use_awaitable);
+		co_return result.get();
+	}
+#endif
+
+	// the blocking-style `run` suspends the stackful coroutine of the
+	// handler; `co_run` is used by C++20 coroutine handlers.
+	class offloader {
+	private:
+		compute_pool& pool_;
+		// null if the handler is a C++20 coroutine
+		asio::yield_context* yield_;
+	public:
+		offloader(compute_pool& pool, asio::yield_context& yield)
+			: pool_{ pool }, yield_{ &yield } {}
+		explicit offloader(compute_pool& pool)
+			: pool_{ pool }, yield_{ nullptr } {}
+		template <typename Function>
+		std::invoke_result_t<Function&> run(Function&& fn) {
+			if (yield_ == nullptr)
+				throw std::logic_error{
+					"offloader: a coroutine handler should use co_run" };
+			return offload(pool_, *yield_, std::forward<Function>(fn));
+		}
+#ifdef BSERV_HAS_CO_AWAIT
+		template <typename Function>
+		awaitable<std::invoke_result_t<Function&>> co_run(Function fn) {
+			return co_offload(pool_, std::move(fn));
+		}
+#endif
+		compute_stats stats() const { return pool_.stats(); }
+	};
+
+}  // bserv
+
+#endif  // _COMPUTE_HPP
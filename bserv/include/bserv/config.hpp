@@ -4,8 +4,10 @@
 #include <iostream>
 #include <string>
 #include <cstddef>
+#include <chrono>
 #include <optional>
 #include <thread>
+#include <vector>
 
 namespace bserv {
 
@@ -14,21 +16,150 @@ namespace bserv {
 	const unsigned short PORT = 8080;
 	const int NUM_THREADS =
 		std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+	// if it is enabled, each thread runs its own io_context on its own cpu,
+	// with its own acceptor (SO_REUSEPORT) and, with the "memory" session
+	// backend, sessions of its own (see `per_core_session_manager`).
+	const bool PER_CORE = false;
 
+	// the limit of a request body, unless the route sets its own
 	const std::size_t PAYLOAD_LIMIT = 8 * 1024 * 1024;
 	const int EXPIRY_TIME = 30;  // seconds
 
+	// the timeouts of an http session, in seconds (0 disables one).
+	// the header of a request should be received within
+	// `HEADER_TIMEOUT` after its first byte, which is kept short
+	// so that slow clients cannot hold the sessions (slowloris).
+	const int HEADER_TIMEOUT = 10;
+	// the body should be received within `BODY_TIMEOUT` after the header
+	const int BODY_TIMEOUT = 60;
+	// the connection is closed if a handler takes longer than this
+	const int HANDLER_TIMEOUT = 60;
+	// the connection is closed if it is idle for `IDLE_TIMEOUT`
+	const int IDLE_TIMEOUT = EXPIRY_TIME;
+	const int WRITE_TIMEOUT = EXPIRY_TIME;
+	// the timeout of each step of a request made by `http_client`
+	const int CLIENT_TIMEOUT = EXPIRY_TIME;
+	// the number of requests served on a connection before it is closed
+	// (0: unlimited)
+	const int KEEP_ALIVE_REQUESTS = 0;
+
+	// on shutdown, the requests being handled are given `DRAIN_TIMEOUT`
+	// to be answered, before the connections are closed
+	const int DRAIN_TIMEOUT = 30;  // seconds
+	const auto DRAIN_TICK = std::chrono::milliseconds(50);
+
+	// a new process can take the listening sockets over from the running one
+	// through this unix socket (see `take_sockets`). it is disabled if empty.
+	const std::string HANDOFF_PATH = "";
+	const std::size_t MAX_HANDOFF_SOCKETS = 64;
+	const int HANDOFF_TIMEOUT = 5;  // seconds
+
+	// the number of shards of the metrics (see `latency_histogram`)
+	// and of the buffers of the traces
+	const std::size_t METRICS_SHARDS = 16;
+
+	// the spans kept by each thread (see `tracing.hpp`). 0 disables the tracing.
+	const std::size_t TRACE_BUFFER_SIZE = 0;
+	// the traces are written to this file (in the Chrome trace format)
+	// when the server exits, if it is not empty
+	const std::string TRACE_PATH = "";
+
+	// a record of each request is written to this file (JSON lines,
+	// see `access_log.hpp`), if it is not empty
+	const std::string ACCESS_LOG_PATH = "";
+	// one request in `ACCESS_LOG_SAMPLE` (chosen at random) is logged
+	const int ACCESS_LOG_SAMPLE = 1;
+	// the records waiting to be written. if it is full,
+	// the records are dropped (and counted in the metrics).
+	const std::size_t ACCESS_LOG_BUFFER_SIZE = 4 * 1024 * 1024;  // bytes
+	const auto ACCESS_LOG_FLUSH_INTERVAL = std::chrono::milliseconds(200);
+
+	// the number of requests an http session reads ahead (pipelining)
+	// and handles concurrently. responses are sent in order.
+	const std::size_t HTTP_PIPELINE_LIMIT = 8;
+	// the read buffer of an http session never grows beyond this size
+	const std::size_t HTTP_BUFFER_LIMIT = 64 * 1024;
+	// buffers and bodies larger than this are freed after a request,
+	// rather than being kept for the next one
+	const std::size_t HTTP_RETAINED_SIZE = 16 * 1024;
+	// the number of idle http objects each thread keeps for reuse
+	const std::size_t HTTP_POOL_SIZE = 256;
+
+	// admission control (0 disables a limit).
+	// no more connections are accepted beyond `MAX_CONNECTIONS`
+	// until some of them are closed.
+	const std::size_t MAX_CONNECTIONS = 10000;
+	// the requests beyond `MAX_IN_FLIGHT` are answered with 503
+	const std::size_t MAX_IN_FLIGHT = 1024;
+	// the requests are shed (503) by the time they wait to be handled:
+	// longer than `QUEUE_TARGET` if no request waited less than that
+	// during the last `QUEUE_INTERVAL`, otherwise longer than `QUEUE_INTERVAL`.
+	const int QUEUE_TARGET = 5;  // milliseconds
+	const int QUEUE_INTERVAL = 100;  // milliseconds
+	const int RETRY_AFTER = 1;  // seconds
+	// the delay before accepting again when there are too many connections
+	const int ACCEPT_PAUSE = 10;  // milliseconds
+
+	const int SESSION_EXPIRY_TIME = 20 * 60;  // seconds
+	// "memory", "file" or "db"
+	const std::string SESSION_BACKEND = "memory";
+	const std::string SESSION_FILE_PATH = "./bserv.sessions";
+	const int NUM_SESSION_DB_CONN = 2;
+	// a persistent session found in the local cache is used without asking
+	// the store for this long after it was last loaded or saved. after that,
+	// it is still used, and revalidated in the background, so the changes
+	// made by the other processes may be seen this late and a request later
+	// (0 asks the store on every lookup, before the session is used).
+	const int SESSION_REVALIDATE_TIME = 1000;  // milliseconds
+
 	const std::size_t LOG_ROTATION_SIZE = 8 * 1024 * 1024;
 	//const std::string LOG_PATH = "./log/" + NAME;
 	const std::string LOG_PATH = "";
+	// trace, debug, info, warning, error or fatal
+#if defined(_MSC_VER) && defined(_DEBUG)
+	const std::string LOG_LEVEL = "trace";
+#else
+	const std::string LOG_LEVEL = "info";
+#endif
+	// the records are written by a thread of their own. when its queue
+	// is full, they are dropped if `LOG_DROP` is set, otherwise
+	// the threads which log wait for room.
+	const std::size_t LOG_QUEUE_SIZE = 64 * 1024;
+	const bool LOG_DROP = false;
+	// the records are written in batches, at least this often
+	const auto LOG_FLUSH_INTERVAL = std::chrono::milliseconds(100);
+
+	// the threads for CPU-bound work, which is offloaded by the handlers
+	const int NUM_COMPUTE_THREADS =
+		std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() / 2 : 1;
+	// if more tasks are waiting for a compute thread,
+	// a task is run on the I/O thread which offloads it
+	const std::size_t COMPUTE_QUEUE_LIMIT = 1024;
 
 	const int NUM_DB_CONN = 10;
 	//const std::string DB_CONN_STR = "dbname=bserv";
 	const std::string DB_CONN_STR = "";
+	// "postgres", "memory", "record" or "replay" (see `db_backend.hpp`)
+	const std::string DB_BACKEND = "postgres";
+	// the script run by the "memory" backend when the server starts,
+	// or the file of the results which are recorded ("record") or replayed ("replay")
+	const std::string DB_FILE_PATH = "";
+	// added to the time of each query, to test without a database (0: none)
+	const int DB_LATENCY = 0;  // microseconds
+	// the read replicas (postgresql), which serve the read-only transactions
+	// (see `db_connection_manager::get_read_only_or_block`)
+	const std::vector<std::string> DB_REPLICA_CONN_STRS = {};
+	// the connections to each replica
+	const int NUM_REPLICA_DB_CONN = 10;
+	// after a request uses the primary, the reads of its session go to
+	// the primary for this long, so that they see its writes (0: never)
+	const int READ_YOUR_WRITES = 0;  // milliseconds
 
-#ifdef _MSC_VER
+	// the stack size of the (stackful) coroutines which handle the requests.
+	// the pages of a stack are only used as the stack grows.
 	const std::size_t STACK_SIZE = 1024 * 1024;
-#endif
+	// the number of coroutine stacks each thread keeps for reuse
+	const std::size_t STACK_POOL_SIZE = 64;
 
 #define decl_field(type, name, default_value) \
 private: \
@@ -41,10 +172,44 @@ public: \
 		decl_field(std::string, name, NAME)
 		decl_field(unsigned short, port, PORT)
 		decl_field(int, num_threads, NUM_THREADS)
+		decl_field(bool, per_core, PER_CORE)
+		decl_field(std::size_t, stack_size, STACK_SIZE)
+		decl_field(std::size_t, payload_limit, PAYLOAD_LIMIT)
+		decl_field(int, header_timeout, HEADER_TIMEOUT)
+		decl_field(int, body_timeout, BODY_TIMEOUT)
+		decl_field(int, handler_timeout, HANDLER_TIMEOUT)
+		decl_field(int, idle_timeout, IDLE_TIMEOUT)
+		decl_field(int, write_timeout, WRITE_TIMEOUT)
+		decl_field(int, client_timeout, CLIENT_TIMEOUT)
+		decl_field(int, keep_alive_requests, KEEP_ALIVE_REQUESTS)
+		decl_field(int, drain_timeout, DRAIN_TIMEOUT)
+		decl_field(std::string, handoff_path, HANDOFF_PATH)
+		decl_field(std::size_t, max_connections, MAX_CONNECTIONS)
+		decl_field(std::size_t, max_in_flight, MAX_IN_FLIGHT)
+		decl_field(int, queue_target, QUEUE_TARGET)
+		decl_field(int, queue_interval, QUEUE_INTERVAL)
 		decl_field(std::size_t, log_rotation_size, LOG_ROTATION_SIZE)
 		decl_field(std::string, log_path, LOG_PATH)
+		decl_field(std::string, log_level, LOG_LEVEL)
+		decl_field(bool, log_drop, LOG_DROP)
+		decl_field(std::size_t, trace_buffer_size, TRACE_BUFFER_SIZE)
+		decl_field(std::string, trace_path, TRACE_PATH)
+		decl_field(std::string, access_log_path, ACCESS_LOG_PATH)
+		decl_field(int, access_log_sample, ACCESS_LOG_SAMPLE)
+		decl_field(int, num_compute_threads, NUM_COMPUTE_THREADS)
 		decl_field(int, num_db_conn, NUM_DB_CONN)
 		decl_field(std::string, db_conn_str, DB_CONN_STR)
+		decl_field(std::string, db_backend, DB_BACKEND)
+		decl_field(std::string, db_file_path, DB_FILE_PATH)
+		decl_field(int, db_latency, DB_LATENCY)
+		decl_field(std::vector<std::string>, db_replica_conn_strs, DB_REPLICA_CONN_STRS)
+		decl_field(int, num_replica_db_conn, NUM_REPLICA_DB_CONN)
+		decl_field(int, read_your_writes, READ_YOUR_WRITES)
+		decl_field(int, session_expiry_time, SESSION_EXPIRY_TIME)
+		decl_field(std::string, session_backend, SESSION_BACKEND)
+		decl_field(std::string, session_file_path, SESSION_FILE_PATH)
+		decl_field(int, num_session_db_conn, NUM_SESSION_DB_CONN)
+		decl_field(int, session_revalidate_time, SESSION_REVALIDATE_TIME)
 	public:
 		server_config() = default;
 	};
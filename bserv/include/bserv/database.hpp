@@ -7,9 +7,16 @@
 #include <string>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <functional>
 #include <optional>
 #include <mutex>
+#include <condition_variable>
 #include <memory>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
 #include <initializer_list>
 
 #include <pqxx/pqxx>
@@ -19,54 +26,149 @@
 // including only pqxx is not enough
 #include <pqxx/result>
 
+#include "awaitable.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
+
 namespace bserv {
 
-	using raw_db_connection_type = pqxx::connection;
-	using raw_db_transaction_type = pqxx::work;
+	// the rows of a result which is not from postgresql (see `db_backend.hpp`).
+	// the values are in the text format of postgresql.
+	struct db_table {
+		std::string query;
+		std::vector<std::string> columns;
+		std::vector<std::vector<std::optional<std::string>>> rows;
+	};
+
+	// like `pqxx::field` and `pqxx::row`, they keep their result alive
 
 	class db_field {
 	private:
-		pqxx::field field_;
+		std::optional<pqxx::field> field_;
+		// if it is not from postgresql
+		std::shared_ptr<const db_table> table_;
+		std::size_t row_ = 0;
+		std::size_t column_ = 0;
+		const std::optional<std::string>& value() const {
+			return table_->rows[row_][column_];
+		}
 	public:
 		db_field(const pqxx::field& field) : field_{ field } {}
-		const char* c_str() const { return field_.c_str(); }
+		db_field(std::shared_ptr<const db_table> table, std::size_t row, std::size_t column)
+			: table_{ std::move(table) }, row_{ row }, column_{ column } {}
+		const char* c_str() const {
+			if (field_.has_value()) return field_->c_str();
+			return value().has_value() ? value()->c_str() : "";
+		}
 		template <typename Type>
-		Type as() const { return field_.as<Type>(); }
-		bool is_null() const { return field_.is_null(); }
+		Type as() const {
+			if (field_.has_value()) return field_->as<Type>();
+			if (!value().has_value())
+				throw pqxx::conversion_error{ "attempt to convert null to a value" };
+			return pqxx::from_string<Type>(*value());
+		}
+		bool is_null() const {
+			return field_.has_value() ? field_->is_null() : !value().has_value();
+		}
 	};
 
 	class db_row {
 	private:
-		pqxx::row row_;
+		std::optional<pqxx::row> row_;
+		// if it is not from postgresql
+		std::shared_ptr<const db_table> table_;
+		std::size_t idx_ = 0;
 	public:
 		db_row(const pqxx::row& row) : row_{ row } {}
-		std::size_t size() const { return row_.size(); }
-		db_field operator[](std::size_t idx) const { return row_[(pqxx::row::size_type)idx]; }
+		db_row(std::shared_ptr<const db_table> table, std::size_t idx)
+			: table_{ std::move(table) }, idx_{ idx } {}
+		std::size_t size() const {
+			return row_.has_value() ? row_->size() : table_->rows[idx_].size();
+		}
+		db_field operator[](std::size_t idx) const {
+			if (row_.has_value()) return (*row_)[(pqxx::row::size_type)idx];
+			return { table_, idx_, idx };
+		}
 	};
 
 	class db_result {
 	private:
 		pqxx::result result_;
+		// if it is not from postgresql
+		std::shared_ptr<const db_table> table_;
 	public:
 		class const_iterator {
 		private:
 			pqxx::result::const_iterator iterator_;
+			std::shared_ptr<const db_table> table_;
+			std::size_t idx_ = 0;
 		public:
 			const_iterator(
 				const pqxx::result::const_iterator& iterator
 			) : iterator_{ iterator } {}
-			const_iterator& operator++() { ++iterator_; return *this; }
-			bool operator==(const const_iterator& rhs) const { return iterator_ == rhs.iterator_; }
-			bool operator!=(const const_iterator& rhs) const { return iterator_ != rhs.iterator_; }
-			db_row operator*() const { return *iterator_; }
+			const_iterator(
+				std::shared_ptr<const db_table> table, std::size_t idx
+			) : table_{ std::move(table) }, idx_{ idx } {}
+			const_iterator& operator++() {
+				if (table_ != nullptr) ++idx_;
+				else ++iterator_;
+				return *this;
+			}
+			bool operator==(const const_iterator& rhs) const {
+				return table_ != nullptr ? idx_ == rhs.idx_ : iterator_ == rhs.iterator_;
+			}
+			bool operator!=(const const_iterator& rhs) const { return !(*this == rhs); }
+			db_row operator*() const {
+				if (table_ != nullptr) return { table_, idx_ };
+				return *iterator_;
+			}
 		};
 		db_result() = default;
 		db_result(const pqxx::result& result) : result_{ result } {}
-		const_iterator begin() const { return result_.begin(); }
-		const_iterator end() const { return result_.end(); }
-		std::string query() const { return result_.query(); }
+		db_result(std::shared_ptr<const db_table> table) : table_{ std::move(table) } {}
+		const_iterator begin() const {
+			if (table_ != nullptr) return { table_, 0 };
+			return result_.begin();
+		}
+		const_iterator end() const {
+			if (table_ != nullptr) return { table_, table_->rows.size() };
+			return result_.end();
+		}
+		std::string query() const { return table_ != nullptr ? table_->query : result_.query(); }
+		// a copy of the result (see `record_backend`)
+		db_table to_table() const;
+	};
+
+	// the interface of a database, so that the queries can be answered by
+	// something other than postgresql (see `db_backend.hpp`)
+
+	class db_backend_transaction {
+	public:
+		// the transaction is aborted if it is not committed
+		virtual ~db_backend_transaction() = default;
+		virtual std::string quote(const std::string& value) = 0;
+		virtual std::string quote_name(const std::string& name) = 0;
+		virtual db_result exec(const std::string& query) = 0;
+		virtual void commit() = 0;
+		virtual void abort() = 0;
+	};
+
+	class db_backend_connection {
+	public:
+		virtual ~db_backend_connection() = default;
+		virtual std::unique_ptr<db_backend_transaction> begin() = 0;
 	};
 
+	class db_backend {
+	public:
+		virtual ~db_backend() = default;
+		// called for each connection of a pool
+		virtual std::shared_ptr<db_backend_connection> connect() = 0;
+	};
+
+	using raw_db_connection_type = db_backend_connection;
+	using raw_db_transaction_type = db_backend_transaction;
+
 	class db_connection_manager;
 
 	class db_connection {
@@ -93,22 +195,68 @@ namespace bserv {
 		std::queue<std::shared_ptr<raw_db_connection_type>> queue_;
 		// this lock is for manipulating the `queue_`
 		mutable std::mutex queue_lock_;
-		// since C++ 17 doesn't provide the semaphore functionality,
-		// mutex is used to mimic it. (boost provides it)
-		// if there are no available connections, trying to lock on
-		// it will cause blocking.
-		mutable std::mutex counter_lock_;
+		// notified when a connection is put back to the `queue_`
+		std::condition_variable queue_ready_;
+		// the number of the requests blocked in `get_or_block`
+		int blocked_ = 0;
+		// the coroutines waiting for a connection (`co_get`), woken in order.
+		// a connection which is put back goes to the blocked requests first.
+		std::deque<std::function<void()>> waiters_;
+		// the requests which hold or wait for a connection of this pool
+		std::atomic<int> outstanding_{ 0 };
+		// the pools of the read replicas, which serve `get_read_only_or_block`
+		std::vector<std::shared_ptr<db_connection_manager>> replicas_;
+		std::atomic<std::size_t> next_replica_{ 0 };
+		// read-your-writes: after a write, the reads of the session
+		// go to this pool (the primary) until the replicas catch up
+		std::chrono::steady_clock::duration pin_duration_{ 0 };
+		std::mutex pins_lock_;
+		std::unordered_map<std::string, std::chrono::steady_clock::time_point> pins_;
+		// the expired pins are removed when the map doubles in size
+		std::size_t pins_cleanup_size_ = 64;
 		friend db_connection;
+		// takes a connection from `queue_`, or returns null if it is empty.
+		// `queue_lock_` must be held.
+		std::shared_ptr<raw_db_connection_type> try_pop();
 	public:
-		db_connection_manager(const std::string& conn_str, int n) {
+		// connects to postgresql
+		db_connection_manager(const std::string& conn_str, int n);
+		db_connection_manager(std::shared_ptr<db_backend> backend, int n) {
 			for (int i = 0; i < n; ++i)
-				queue_.emplace(
-					std::make_shared<raw_db_connection_type>(conn_str));
+				queue_.emplace(backend->connect());
 		}
 		// if there are no available database connections, this function
 		// blocks until there is any;
 		// otherwise, this function returns a pointer to `db_connection`.
 		std::shared_ptr<db_connection> get_or_block();
+		// returns a connection for a read-only transaction: from the replica
+		// with the least outstanding requests, or from this pool if there
+		// are no replicas or the reads of `session_id` are pinned to it.
+		// the replicas may lag behind, so the transactions which write,
+		// or must see the latest writes, should use `get_or_block`.
+		std::shared_ptr<db_connection> get_read_only_or_block(
+			const std::string& session_id = "");
+		// the pool which `get_read_only_or_block` takes a connection from
+		db_connection_manager& read_only_pool(const std::string& session_id = "");
+#ifdef BSERV_HAS_CO_AWAIT
+		// the same as `get_or_block`, for C++20 coroutines: the coroutine is
+		// suspended, instead of the thread, until a connection is available.
+		// the queries are still run synchronously (as `libpqxx` does).
+		awaitable<std::shared_ptr<db_connection>> co_get();
+#endif
+		// should be called before the manager is shared
+		void add_replica(std::shared_ptr<db_connection_manager> replica) {
+			replicas_.emplace_back(std::move(replica));
+		}
+		void set_read_your_writes(std::chrono::steady_clock::duration duration) {
+			pin_duration_ = duration;
+		}
+		// the reads of `session_id` go to this pool for the duration
+		// set by `set_read_your_writes` (if any).
+		void pin_to_primary(const std::string& session_id);
+		bool pinned_to_primary(const std::string& session_id);
+		bool has_replicas() const { return !replicas_.empty(); }
+		int outstanding() const { return outstanding_; }
 	};
 
 	// **************************************************************************
@@ -395,6 +543,38 @@ namespace bserv {
 		const char* what() const noexcept { return msg_.c_str(); }
 	};
 
+	namespace db_internal {
+
+		// replaces the placeholders in `s` with `params`, which are quoted
+		// already (see `db_transaction::exec`). the text between the
+		// placeholders is copied at once, into a string of the final size.
+		inline std::string build_query(
+			const std::string& s, const std::vector<std::string>& params) {
+			std::size_t length = s.size();
+			for (const std::string& param : params) length += param.size();
+			std::string query;
+			query.reserve(length);
+			std::size_t idx = 0, begin = 0, i;
+			while ((i = s.find('?', begin)) != std::string::npos) {
+				query.append(s, begin, i - begin);
+				if (i + 1 < s.length() && s[i + 1] == '?') {
+					query += '?';
+					++i;
+				}
+				else if (idx < params.size()) {
+					query += params[idx++];
+				}
+				else throw std::out_of_range{ "too few parameters" };
+				begin = i + 1;
+			}
+			query.append(s, begin, std::string::npos);
+			if (idx != params.size())
+				throw invalid_operation_exception{ "too many parameters" };
+			return query;
+		}
+
+	}  // db_internal
+
 	class db_relation_to_object {
 	private:
 		std::vector<std::shared_ptr<db_internal::db_field_holder>> fields_;
@@ -433,11 +613,11 @@ namespace bserv {
 
 	class db_transaction {
 	private:
-		raw_db_transaction_type tx_;
+		std::unique_ptr<raw_db_transaction_type> tx_;
 	public:
 		db_transaction(
 			std::shared_ptr<db_connection> connection_ptr
-		) : tx_{ connection_ptr->get() } {}
+		) : tx_{ connection_ptr->get().begin() } {}
 		// non-copiable, non-assignable
 		db_transaction(const db_transaction&) = delete;
 		db_transaction& operator=(const db_transaction&) = delete;
@@ -456,29 +636,15 @@ namespace bserv {
 		db_result exec(const std::string& s, const Params&... params) {
 			std::vector<std::string> param_vec =
 				db_internal::convert_parameters(
-					tx_, db_internal::convert_parameter(params)...);
-			std::size_t idx = 0;
-			std::string query;
-			for (std::size_t i = 0; i < s.length(); ++i) {
-				if (s[i] == '?') {
-					if (i + 1 < s.length() && s[i + 1] == '?') {
-						query += s[++i];
-					}
-					else {
-						if (idx < param_vec.size()) {
-							query += param_vec[idx++];
-						}
-						else throw std::out_of_range{ "too few parameters" };
-					}
-				}
-				else query += s[i];
-			}
-			if (idx != param_vec.size())
-				throw invalid_operation_exception{ "too many parameters" };
-			return tx_.exec(query);
+					*tx_, db_internal::convert_parameter(params)...);
+			std::string query = db_internal::build_query(s, param_vec);
+			scoped_latency timer{ metrics().db_query };
+			trace_span span{ "db_query" };
+			db_timer db_time;
+			return tx_->exec(query);
 		}
-		void commit() { tx_.commit(); }
-		void abort() { tx_.abort(); }
+		void commit() { tx_->commit(); }
+		void abort() { tx_->abort(); }
 	};
 
 
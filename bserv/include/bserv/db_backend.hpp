@@ -0,0 +1,132 @@
+#ifndef _DB_BACKEND_HPP
+#define _DB_BACKEND_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "database.hpp"
+
+namespace bserv {
+
+	// the backends of `db_connection_manager`:
+	// - postgres_backend: postgresql
+	// - memory_backend: tables in memory, for testing without postgresql
+	// - record_backend: records the results of another backend to a file
+	// - replay_backend: answers the queries with the recorded results
+	// - delayed_backend: adds a latency to the queries of another backend
+
+	class db_query_exception : public std::exception {
+	private:
+		std::string msg_;
+	public:
+		db_query_exception(const std::string& msg)
+			: msg_{ msg } {}
+		const char* what() const noexcept { return msg_.c_str(); }
+	};
+
+	class postgres_backend : public db_backend {
+	private:
+		std::string conn_str_;
+	public:
+		explicit postgres_backend(const std::string& conn_str)
+			: conn_str_{ conn_str } {}
+		std::shared_ptr<db_backend_connection> connect();
+	};
+
+	namespace db_internal {
+
+		struct memory_database;
+
+	}  // db_internal
+
+	// the tables are kept in memory, and the queries are answered by a small
+	// subset of SQL, which covers the queries of the sample project
+	// (`WebApp/db.sql` creates its tables):
+	//
+	// - create table t (column type ..., ...) / drop table [if exists] t
+	// - insert into t [(column, ...)] values (value, ...), ...
+	// - update t set column = value | column [+|- value] | not column, ... [where]
+	// - delete from t [where]
+	// - select [distinct] * | column | count(*) | sum(column), ...
+	//   from t [[as] alias], ... [where]
+	//   [group by column [having count(*) | sum(column) op [all] (select) | value]]
+	//   [order by column [asc|desc]] [limit n] [offset n]
+	//
+	// the conditions of `where` are joined by `and`, each of which is
+	// `x op y` (=, <>, !=, <, <=, >, >=), `x is [not] null` or `x in (select)`.
+	// the other queries throw `db_query_exception`.
+	//
+	// the values are kept as text, in the format of postgresql. the queries
+	// are run one at a time, and the changes of a transaction are seen by
+	// the others at once (there is no isolation). they are undone if the
+	// transaction is not committed.
+	class memory_backend : public db_backend {
+	private:
+		std::shared_ptr<db_internal::memory_database> db_;
+	public:
+		memory_backend();
+		// runs the statements of `script`, which are separated by `;`
+		void run_script(const std::string& script);
+		// runs the script in the file
+		void load_script(const std::string& path);
+		std::shared_ptr<db_backend_connection> connect();
+	};
+
+	// records the query and the result of each `exec` of `backend`
+	// (including those in transactions which are aborted) to a file,
+	// one JSON object per line:
+	//
+	// {"query":"select * from music where id = 1","columns":["id",...],"rows":[["1",...]]}
+	class record_backend : public db_backend,
+		public std::enable_shared_from_this<record_backend> {
+	private:
+		std::shared_ptr<db_backend> backend_;
+		std::mutex file_lock_;
+		std::ofstream file_;
+	public:
+		record_backend(std::shared_ptr<db_backend> backend, const std::string& path);
+		void record(const db_table& table);
+		std::shared_ptr<db_backend_connection> connect();
+	};
+
+	// answers the queries with the results recorded by `record_backend`.
+	// the results of the same query are returned in the order they were
+	// recorded, and the last one is repeated after that. queries which
+	// were not recorded throw `db_query_exception`.
+	class replay_backend : public db_backend,
+		public std::enable_shared_from_this<replay_backend> {
+	private:
+		struct recorded_results {
+			std::vector<std::shared_ptr<const db_table>> results;
+			std::size_t next = 0;
+		};
+		std::mutex lock_;
+		std::map<std::string, recorded_results> results_;
+	public:
+		explicit replay_backend(const std::string& path);
+		db_result find(const std::string& query);
+		std::shared_ptr<db_backend_connection> connect();
+	};
+
+	// each query of `backend` takes `latency` longer (the thread sleeps,
+	// as it would if it waited for the database)
+	class delayed_backend : public db_backend {
+	private:
+		std::shared_ptr<db_backend> backend_;
+		std::chrono::microseconds latency_;
+	public:
+		delayed_backend(std::shared_ptr<db_backend> backend,
+			std::chrono::microseconds latency)
+			: backend_{ std::move(backend) }, latency_{ latency } {}
+		std::shared_ptr<db_backend_connection> connect();
+	};
+
+}  // bserv
+
+#endif  // _DB_BACKEND_HPP
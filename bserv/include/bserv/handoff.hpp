@@ -0,0 +1,71 @@
+#ifndef _HANDOFF_HPP
+#define _HANDOFF_HPP
+
+#include <boost/asio.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32) && defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#define BSERV_HAS_HANDOFF
+#endif
+
+namespace bserv {
+
+	namespace asio = boost::asio;
+	using asio::ip::tcp;
+
+	using native_socket = tcp::acceptor::native_handle_type;
+
+	// the listening sockets passed by systemd (`LISTEN_FDS`), if any
+	std::vector<native_socket> inherited_sockets();
+
+	// takes the listening sockets of the process serving `path`, which
+	// then drains its connections. it is empty if there is no such process.
+	std::vector<native_socket> take_sockets(const std::string& path);
+
+	// the protocol of a listening socket
+	tcp socket_protocol(native_socket socket);
+
+	native_socket duplicate_socket(native_socket socket);
+
+	// closes a socket which is not owned by an acceptor
+	void close_socket(native_socket socket);
+
+	// passes the listening sockets to a new process (see `take_sockets`),
+	// so that a server can be restarted without refusing connections.
+	// only the processes of the same user can take them.
+	class handoff_server
+		: public std::enable_shared_from_this<handoff_server> {
+	private:
+#ifdef BSERV_HAS_HANDOFF
+		asio::local::stream_protocol::acceptor acceptor_;
+		void do_accept();
+		void on_accept(
+			const boost::system::error_code& ec,
+			asio::local::stream_protocol::socket socket);
+		void on_request(
+			const boost::system::error_code& ec,
+			asio::local::stream_protocol::socket& socket);
+		void do_stop();
+#endif
+		const std::string path_;
+		const std::vector<native_socket> sockets_;
+		// called after the sockets are passed
+		const std::function<void()> on_handoff_;
+	public:
+		handoff_server(
+			asio::io_context& ioc, const std::string& path,
+			std::vector<native_socket> sockets,
+			std::function<void()> on_handoff);
+		void run();
+		// stops accepting. the path is not removed, as it may
+		// be the one of the new process.
+		void stop();
+	};
+
+}  // bserv
+
+#endif  // _HANDOFF_HPP
@@ -11,17 +11,27 @@
 #include <boost/log/utility/setup.hpp>
 
 #include <iostream>
+#include <atomic>
 #include <cstddef>
 #include <string>
 
 #include "config.hpp"
 
-#define lgtrace BOOST_LOG_TRIVIAL(trace)
-#define lgdebug BOOST_LOG_TRIVIAL(debug)
-#define lginfo BOOST_LOG_TRIVIAL(info)
-#define lgwarning BOOST_LOG_TRIVIAL(warning)
-#define lgerror BOOST_LOG_TRIVIAL(error)
-#define lgfatal BOOST_LOG_TRIVIAL(fatal)
+// the level is checked before the record is made (and the message is
+// formatted), which is cheaper than the filter of Boost.Log.
+// it is a loop (as `BOOST_LOG_TRIVIAL` is), so it can be used
+// as the statement of an `if` that has an `else`.
+#define BSERV_LOG(level) \
+	for (bool bserv_log_enabled_ = ::bserv::log_enabled(::boost::log::trivial::level); \
+		bserv_log_enabled_; bserv_log_enabled_ = false) \
+		BOOST_LOG_TRIVIAL(level)
+
+#define lgtrace BSERV_LOG(trace)
+#define lgdebug BSERV_LOG(debug)
+#define lginfo BSERV_LOG(info)
+#define lgwarning BSERV_LOG(warning)
+#define lgerror BSERV_LOG(error)
+#define lgfatal BSERV_LOG(fatal)
 
 namespace bserv {
 
@@ -29,34 +39,25 @@ namespace bserv {
 	namespace keywords = boost::log::keywords;
 	namespace src = boost::log::sources;
 
-	// this function should be called before logging is used
-	inline void init_logging(const server_config& config) {
-		if (config.get_log_path() != "") {
-			std::string filename = config.get_log_path();
-			if (filename[filename.size() - 1] != '/') {
-				filename += '/';
-			}
-			filename += config.get_name();
-			logging::add_file_log(
-				keywords::file_name = filename + "_%Y%m%d_%H-%M-%S.%N.log",
-				keywords::rotation_size = config.get_log_rotation_size(),
-				keywords::format = "[%Severity%][%TimeStamp%][%ThreadID%]: %Message%"
-			);
-#if defined(_MSC_VER) && defined(_DEBUG)
-			// write to console as well
-			logging::add_console_log(std::cout);
-#endif
-		}
-		logging::core::get()->set_filter(
-#if defined(_MSC_VER) && defined(_DEBUG)
-			logging::trivial::severity >= logging::trivial::trace
-#else
-			logging::trivial::severity >= logging::trivial::info
-#endif
-		);
-		logging::add_common_attributes();
+	namespace logging_internal {
+
+		inline std::atomic<int> min_level{ logging::trivial::info };
+
+	}  // logging_internal
+
+	inline bool log_enabled(logging::trivial::severity_level level) {
+		return level >= logging_internal::min_level.load(std::memory_order_relaxed);
 	}
 
+	// this function should be called before logging is used.
+	// the records are written to the file (or the console) by a thread
+	// of their own, so the threads which log do not wait for the file.
+	void init_logging(const server_config& config);
+
+	// writes the records which are queued, and stops the thread.
+	// the records after it are written to the console at once.
+	void flush_logging();
+
 	inline void fail(const boost::system::error_code& ec, const char* what) {
 		lgerror << what << ": " << ec.message() << std::endl;
 	}
@@ -0,0 +1,126 @@
+#ifndef _METRICS_HPP
+#define _METRICS_HPP
+
+#include <boost/beast.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+
+namespace bserv {
+
+	namespace beast = boost::beast;
+	namespace http = beast::http;
+
+	// the buckets of a histogram are log-linear (as in HdrHistogram):
+	// each power of two (in microseconds) is divided into
+	// `HISTOGRAM_SUB_BUCKETS`, so the relative error is at most 1/8.
+	const std::size_t HISTOGRAM_SUB_BUCKETS = 8;
+	// up to 2^31 us (about 35 minutes)
+	const std::size_t HISTOGRAM_OCTAVES = 28;
+	const std::size_t HISTOGRAM_BUCKETS =
+		HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_OCTAVES + 1);
+
+	struct histogram_snapshot {
+		std::array<std::uint64_t, HISTOGRAM_BUCKETS> counts;
+		std::uint64_t count;
+		std::chrono::nanoseconds sum;
+		// the lower bound of bucket `i`
+		static std::chrono::microseconds lower_bound(std::size_t i);
+		// the value at quantile `q` (0 <= q <= 1), which is
+		// the upper bound of the bucket it falls in
+		std::chrono::microseconds quantile(double q) const;
+	};
+
+	// records durations without locking. the counters are sharded by
+	// thread, so that the threads do not contend for them.
+	class latency_histogram {
+	private:
+		struct alignas(64) shard {
+			std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS> counts;
+			std::atomic<std::uint64_t> sum_ns;
+		};
+		std::array<shard, METRICS_SHARDS> shards_{};
+	public:
+		latency_histogram() = default;
+		latency_histogram(const latency_histogram&) = delete;
+		latency_histogram& operator=(const latency_histogram&) = delete;
+		void record(std::chrono::steady_clock::duration d);
+		histogram_snapshot snapshot() const;
+	};
+
+	// records the time from its construction to its destruction
+	class scoped_latency {
+	private:
+		latency_histogram& histogram_;
+		const std::chrono::steady_clock::time_point start_;
+	public:
+		explicit scoped_latency(latency_histogram& histogram)
+			: histogram_{ histogram },
+			start_{ std::chrono::steady_clock::now() } {}
+		scoped_latency(const scoped_latency&) = delete;
+		scoped_latency& operator=(const scoped_latency&) = delete;
+		~scoped_latency() {
+			histogram_.record(std::chrono::steady_clock::now() - start_);
+		}
+	};
+
+	// the metrics of the server, which are exported
+	// in the Prometheus text format (see `serve_metrics`)
+	class metrics_registry {
+	private:
+		static constexpr unsigned MIN_STATUS = 100;
+		static constexpr unsigned MAX_STATUS = 599;
+		struct alignas(64) status_shard {
+			std::array<std::atomic<std::uint64_t>, MAX_STATUS - MIN_STATUS + 1> counts;
+		};
+		std::array<status_shard, METRICS_SHARDS> statuses_{};
+		mutable std::mutex lock_;
+		std::map<std::string, std::shared_ptr<latency_histogram>> routes_;
+		std::vector<std::function<void(std::string&)>> collectors_;
+	public:
+		// the requests that match no route
+		latency_histogram unmatched;
+		// the time to take a connection from the pool
+		latency_histogram db_acquire;
+		latency_histogram db_query;
+		latency_histogram render;
+		// the time to serialize the value returned by a handler
+		latency_histogram serialize;
+		metrics_registry() = default;
+		metrics_registry(const metrics_registry&) = delete;
+		metrics_registry& operator=(const metrics_registry&) = delete;
+		// the histogram of the time to handle the requests of the route
+		// `url`, which is shared by the routes with the same url
+		std::shared_ptr<latency_histogram> route(const std::string& url);
+		void record_status(unsigned status);
+		// `collector` appends its own metrics (in the Prometheus
+		// text format) to the export
+		void add_collector(std::function<void(std::string&)> collector);
+		// the Prometheus text format
+		std::string format() const;
+	};
+
+	// shared by all the servers in the process
+	metrics_registry& metrics();
+
+	// exports the metrics in the Prometheus text format:
+	// bserv::make_path("/metrics", &bserv::serve_metrics,
+	//     bserv::placeholders::response)
+	std::nullopt_t serve_metrics(
+		http::response<http::string_body>& response);
+
+}  // bserv
+
+#endif  // _METRICS_HPP
@@ -13,11 +13,17 @@
 #include <memory>
 #include <initializer_list>
 #include <optional>
+#include <tuple>
+#include <utility>
 
 #include <pqxx/pqxx>
 
+#include "awaitable.hpp"
 #include "client.hpp"
+#include "compute.hpp"
 #include "database.hpp"
+#include "metrics.hpp"
+#include "tracing.hpp"
 #include "session.hpp"
 #include "utils.hpp"
 #include "config.hpp"
@@ -32,13 +38,17 @@ namespace bserv {
 	struct server_resources {
 		std::shared_ptr<session_manager_base> session_mgr;
 		std::shared_ptr<db_connection_manager> db_conn_mgr;
+		std::shared_ptr<compute_pool> compute_pool_ptr;
+		// the timeout of `http_client`
+		std::chrono::seconds client_timeout{ CLIENT_TIMEOUT };
 	};
 
 	struct request_resources {
 		server_resources& resources;
 
 		asio::io_context& ioc;
-		asio::yield_context& yield;
+		// null if the handler is a C++20 coroutine
+		asio::yield_context* yield;
 		std::shared_ptr<websocket_session> ws_session;
 		const std::vector<std::string>& url_params;
 		request_type& request;
@@ -46,8 +56,14 @@ namespace bserv {
 
 		std::shared_ptr<session_type> session_ptr;
 		std::shared_ptr<db_connection> db_connection_ptr;
+		std::shared_ptr<db_connection> db_read_connection_ptr;
 		std::shared_ptr<http_client> http_client_ptr;
 		std::shared_ptr<websocket_server> websocket_server_ptr;
+		std::shared_ptr<offloader> offloader_ptr;
+		// whether the handler takes the connections itself (`db_connection_mgr`)
+		bool db_conn_mgr_used = false;
+
+		std::string session_id;
 	};
 
 	namespace placeholders {
@@ -83,6 +99,15 @@ namespace bserv {
 		constexpr placeholder<-6> http_client_ptr;
 		// std::shared_ptr<bserv::websocket_server>
 		constexpr placeholder<-7> websocket_server_ptr;
+		// std::shared_ptr<bserv::offloader>
+		constexpr placeholder<-8> offloader_ptr;
+		// std::shared_ptr<bserv::db_connection>, for read-only transactions
+		// (from a read replica, if there are any)
+		constexpr placeholder<-9> db_read_connection_ptr;
+		// std::shared_ptr<bserv::db_connection_manager>, for handlers which
+		// take and put back the connections themselves (e.g. so that they
+		// do not hold one while suspended by `offloader`)
+		constexpr placeholder<-10> db_connection_mgr;
 
 	}  // placeholders
 
@@ -92,6 +117,12 @@ namespace bserv {
 		const char* what() const noexcept { return "bad request"; }
 	};
 
+	class payload_too_large_exception : public std::exception {
+	public:
+		payload_too_large_exception() = default;
+		const char* what() const noexcept { return "payload too large"; }
+	};
+
 	namespace router_internal {
 
 		template <typename ...Types>
@@ -159,27 +190,24 @@ namespace bserv {
 			placeholders::placeholder<-1>) {
 			if (resources.session_ptr != nullptr)
 				return resources.session_ptr;
-			std::string cookie_str{ resources.request[http::field::cookie] };
-			auto&& [cookie_dict, cookie_list]
-				= utils::parse_params(cookie_str, 0, ';');
-			boost::ignore_unused(cookie_list);
-			std::string session_id;
+			trace_span span{ "session" };
+			// the first session id which refers to an existing session is used.
+			// session ids consist of [A-Za-z0-9] only, so they are not decoded.
+			auto cookie_str = resources.request[http::field::cookie];
+			utils::cookie_scanner cookies{
+				{ cookie_str.data(), cookie_str.size() }, SESSION_NAME };
 			std::shared_ptr<session_type> session_ptr;
-			if (cookie_dict.count(SESSION_NAME) != 0) {
-				session_id = cookie_dict[SESSION_NAME];
-			}
-			else if (cookie_list.count(SESSION_NAME) != 0) {
-				std::vector<std::string>& session_ids = cookie_list[SESSION_NAME];
-				for (auto& sess_id : session_ids) {
-					if (resources.resources.session_mgr->try_get(sess_id, session_ptr)) {
-						session_id = sess_id;
-						break;
-					}
+			while (auto session_id = cookies.next()) {
+				if (resources.resources.session_mgr->try_get(*session_id, session_ptr)) {
+					resources.session_id = *session_id;
+					break;
 				}
 			}
-			if (session_ptr == nullptr
-				&& resources.resources.session_mgr->get_or_create(session_id, session_ptr)) {
-				resources.response.set(http::field::set_cookie, SESSION_NAME + "=" + session_id + "; Path=/");
+			if (session_ptr == nullptr) {
+				std::string session_id;
+				if (resources.resources.session_mgr->get_or_create(session_id, session_ptr))
+					resources.response.set(http::field::set_cookie, SESSION_NAME + "=" + session_id + "; Path=/");
+				resources.session_id = std::move(session_id);
 			}
 			resources.session_ptr = session_ptr;
 			return session_ptr;
@@ -270,8 +298,11 @@ namespace bserv {
 			request_resources& resources,
 			placeholders::placeholder<-6>) {
 			if (resources.http_client_ptr == nullptr)
-				resources.http_client_ptr =
-				std::make_shared<http_client>(resources.ioc, resources.yield);
+				resources.http_client_ptr = resources.yield != nullptr
+					? std::make_shared<http_client>(
+						resources.ioc, *resources.yield, resources.resources.client_timeout)
+					: std::make_shared<http_client>(
+						resources.ioc, resources.resources.client_timeout);
 			return resources.http_client_ptr;
 		}
 
@@ -279,11 +310,64 @@ namespace bserv {
 			request_resources& resources,
 			placeholders::placeholder<-7>) {
 			if (resources.websocket_server_ptr == nullptr)
-				resources.websocket_server_ptr =
-				std::make_shared<websocket_server>(*resources.ws_session, resources.yield);
+				resources.websocket_server_ptr = resources.yield != nullptr
+					? std::make_shared<websocket_server>(*resources.ws_session, *resources.yield)
+					: std::make_shared<websocket_server>(*resources.ws_session);
 			return resources.websocket_server_ptr;
 		}
 
+		inline std::shared_ptr<offloader> get_parameter_data(
+			request_resources& resources,
+			placeholders::placeholder<-8>) {
+			if (resources.offloader_ptr == nullptr)
+				resources.offloader_ptr = resources.yield != nullptr
+					? std::make_shared<offloader>(*resources.resources.compute_pool_ptr, *resources.yield)
+					: std::make_shared<offloader>(*resources.resources.compute_pool_ptr);
+			return resources.offloader_ptr;
+		}
+
+		// the session ids in the cookie of the request, for the handlers
+		// which do not take the session (it is not looked up or created)
+		inline utils::cookie_scanner session_cookies(request_resources& resources) {
+			auto cookie_str = resources.request[http::field::cookie];
+			return { { cookie_str.data(), cookie_str.size() }, SESSION_NAME };
+		}
+
+		// whether the reads of the session of the request are pinned to the primary
+		// (see `db_connection_manager::pin_to_primary`)
+		inline bool pinned_to_primary(request_resources& resources) {
+			db_connection_manager& mgr = *resources.resources.db_conn_mgr;
+			if (!mgr.has_replicas()) return false;
+			if (resources.session_id != "")
+				return mgr.pinned_to_primary(resources.session_id);
+			utils::cookie_scanner cookies = session_cookies(resources);
+			while (auto session_id = cookies.next())
+				if (mgr.pinned_to_primary(std::string{ *session_id }))
+					return true;
+			return false;
+		}
+
+		inline std::shared_ptr<db_connection> get_parameter_data(
+			request_resources& resources,
+			placeholders::placeholder<-9>) {
+			// a request which writes reads from the primary as well
+			if (resources.db_connection_ptr != nullptr)
+				return resources.db_connection_ptr;
+			if (resources.db_read_connection_ptr == nullptr) {
+				db_connection_manager& mgr = *resources.resources.db_conn_mgr;
+				resources.db_read_connection_ptr = pinned_to_primary(resources)
+					? mgr.get_or_block() : mgr.get_read_only_or_block();
+			}
+			return resources.db_read_connection_ptr;
+		}
+
+		inline std::shared_ptr<db_connection_manager> get_parameter_data(
+			request_resources& resources,
+			placeholders::placeholder<-10>) {
+			resources.db_conn_mgr_used = true;
+			return resources.resources.db_conn_mgr;
+		}
+
 		template <int Idx, typename Func, typename Params, typename ...Args>
 		struct path_handler;
 
@@ -345,6 +429,13 @@ namespace bserv {
 		}
 
 		struct path_holder : std::enable_shared_from_this<path_holder> {
+			// the limit of the request body, instead of the one of the server
+			std::optional<std::size_t> body_limit;
+			// the time to handle the requests, by url (see `metrics`)
+			std::shared_ptr<latency_histogram> latency;
+			// the url it is made with (e.g. "/list/<int>"), which
+			// identifies it in the access log
+			std::string route;
 			path_holder() = default;
 			virtual ~path_holder() = default;
 			virtual bool match(
@@ -352,6 +443,12 @@ namespace bserv {
 				std::vector<std::string>&) const = 0;
 			virtual std::optional<boost::json::value> invoke(
 				request_resources&) = 0;
+			// whether the handler returns `bserv::awaitable<...>`
+			virtual bool is_coroutine() const = 0;
+#ifdef BSERV_HAS_CO_AWAIT
+			virtual awaitable<std::optional<boost::json::value>> co_invoke(
+				request_resources&) = 0;
+#endif
 		};
 
 		template <typename Func, typename Params>
@@ -368,7 +465,10 @@ namespace bserv {
 		public:
 			path(const std::string& url, Ret(*pf)(Args ...), Params&& ...params)
 				: re_{ get_re_url(url) }, pf_{ pf },
-				params_{ static_cast<Params&&>(params)... } {}
+				params_{ static_cast<Params&&>(params)... } {
+				latency = metrics().route(url);
+				route = url;
+			}
 			bool match(const std::string& url, std::vector<std::string>& result) const {
 				std::smatch r;
 				bool matched = std::regex_match(url, r, re_);
@@ -381,9 +481,65 @@ namespace bserv {
 			}
 			std::optional<boost::json::value> invoke(
 				request_resources& resources) {
-				return handler_.invoke(
-					resources, pf_, params_);
+#ifdef BSERV_HAS_CO_AWAIT
+				// the coroutine is run to completion from the stackful one
+				if constexpr (is_awaitable_v<Ret>) {
+					asio::yield_context& yield = *resources.yield;
+					return run_awaitable(resources.ioc, co_invoke(resources), yield);
+				}
+				else
+#endif
+					return handler_.invoke(
+						resources, pf_, params_);
+			}
+			bool is_coroutine() const {
+#ifdef BSERV_HAS_CO_AWAIT
+				return is_awaitable_v<Ret>;
+#else
+				return false;
+#endif
+			}
+#ifdef BSERV_HAS_CO_AWAIT
+		private:
+			// the arguments are kept in the coroutine frame until the
+			// handler completes, so that the handler may take references.
+			template <std::size_t ...Idx>
+			awaitable<std::optional<boost::json::value>> co_call(
+				request_resources& resources, std::index_sequence<Idx...>) {
+				if constexpr (is_awaitable_v<Ret>) {
+					// the connections are acquired before the arguments,
+					// so that the thread is not blocked while waiting for them
+					if constexpr ((std::is_same_v<std::decay_t<Params>,
+						placeholders::placeholder<-5>> || ...)) {
+						if (resources.db_connection_ptr == nullptr)
+							resources.db_connection_ptr =
+							co_await resources.resources.db_conn_mgr->co_get();
+					}
+					else if constexpr ((std::is_same_v<std::decay_t<Params>,
+						placeholders::placeholder<-9>> || ...)) {
+						db_connection_manager& mgr = *resources.resources.db_conn_mgr;
+						if (resources.db_read_connection_ptr == nullptr)
+							resources.db_read_connection_ptr = co_await (pinned_to_primary(resources)
+								? mgr : mgr.read_only_pool()).co_get();
+					}
+					std::tuple<decltype(get_parameter_data(resources,
+						get_parameter_value<Idx>(params_)))...> args{
+						get_parameter_data(resources,
+							get_parameter_value<Idx>(params_))... };
+					co_return co_await std::apply(pf_, std::move(args));
+				}
+				else co_return invoke(resources);
+			}
+		public:
+			// it is not a coroutine itself, which saves a frame
+			awaitable<std::optional<boost::json::value>> co_invoke(
+				request_resources& resources) {
+				// the handler must not suspend the stackful coroutine
+				// (if any) that is waiting for it
+				resources.yield = nullptr;
+				return co_call(resources, std::index_sequence_for<Params...>{});
 			}
+#endif
 		};
 
 	} // router_internal
@@ -408,6 +564,15 @@ namespace bserv {
 			>(url, pf, static_cast<Params&&>(params)...);
 	}
 
+	// sets the limit of the request body of `path` (e.g. for uploads):
+	// bserv::with_body_limit(bserv::make_path(...), 64 * 1024 * 1024)
+	template <typename Path>
+	std::shared_ptr<Path> with_body_limit(
+		std::shared_ptr<Path> path, std::size_t limit) {
+		path->body_limit = limit;
+		return path;
+	}
+
 	class url_not_found_exception : public std::exception {
 	public:
 		url_not_found_exception() = default;
@@ -419,39 +584,108 @@ namespace bserv {
 		using path_holder_type = std::shared_ptr<router_internal::path_holder>;
 		std::vector<path_holder_type> paths_;
 		std::shared_ptr<server_resources> resources_;
+		// called after the handler of a request returns
+		void finish(request_resources& resources) {
+			if (resources.session_ptr != nullptr)
+				resources_->session_mgr->commit(
+					resources.session_id, resources.session_ptr);
+			// the handlers which use the primary are taken to write,
+			// so the next reads of the session see their changes
+			if ((resources.db_connection_ptr != nullptr || resources.db_conn_mgr_used)
+				&& resources_->db_conn_mgr->has_replicas()) {
+				if (resources.session_id != "")
+					resources_->db_conn_mgr->pin_to_primary(resources.session_id);
+				else if (auto session_id = router_internal::session_cookies(resources).next())
+					resources_->db_conn_mgr->pin_to_primary(std::string{ *session_id });
+			}
+		}
 	public:
 		router(const std::initializer_list<path_holder_type>& paths)
 			: paths_{ paths } {}
 		void set_resources(std::shared_ptr<server_resources> resources) {
 			resources_ = resources;
 		}
+		// returns the path that matches `url`, or nullptr
+		router_internal::path_holder* find(
+			const std::string& url, std::vector<std::string>& url_params) const {
+			for (auto& ptr : paths_)
+				if (ptr->match(url, url_params))
+					return ptr.get();
+			return nullptr;
+		}
+		// `yield` is null if the path is invoked from a C++20 coroutine
+		std::optional<boost::json::value> invoke(
+			router_internal::path_holder& path,
+			asio::io_context& ioc, asio::yield_context* yield,
+			std::shared_ptr<websocket_session> ws_session,
+			const std::vector<std::string>& url_params,
+			request_type& request, response_type& response) {
+			request_resources resources{
+				*resources_,
+
+				ioc,
+				yield,
+				ws_session,
+				url_params,
+				request,
+				response,
+
+				nullptr,
+				nullptr,
+				nullptr,
+				nullptr,
+				nullptr,
+				nullptr,
+				false,
+
+				{}
+			};
+			std::optional<boost::json::value> val = path.invoke(resources);
+			finish(resources);
+			return val;
+		}
+#ifdef BSERV_HAS_CO_AWAIT
+		awaitable<std::optional<boost::json::value>> co_invoke(
+			router_internal::path_holder& path,
+			asio::io_context& ioc,
+			std::shared_ptr<websocket_session> ws_session,
+			const std::vector<std::string>& url_params,
+			request_type& request, response_type& response) {
+			request_resources resources{
+				*resources_,
+
+				ioc,
+				nullptr,
+				ws_session,
+				url_params,
+				request,
+				response,
+
+				nullptr,
+				nullptr,
+				nullptr,
+				nullptr,
+				nullptr,
+				nullptr,
+				false,
+
+				{}
+			};
+			std::optional<boost::json::value> val = co_await path.co_invoke(resources);
+			finish(resources);
+			co_return val;
+		}
+#endif
 		std::optional<boost::json::value> operator()(
 			asio::io_context& ioc, asio::yield_context& yield,
 			std::shared_ptr<websocket_session> ws_session,
 			const std::string& url, request_type& request, response_type& response) {
 			std::vector<std::string> url_params;
-			for (auto& ptr : paths_) {
-				if (ptr->match(url, url_params)) {
-					lgtrace << "router: received request: " << url;
-					request_resources resources{
-						*resources_,
-
-						ioc,
-						yield,
-						ws_session,
-						url_params,
-						request,
-						response,
-
-						nullptr,
-						nullptr,
-						nullptr,
-						nullptr
-					};
-					return ptr->invoke(resources);
-				}
-			}
-			throw url_not_found_exception{};
+			router_internal::path_holder* path = find(url, url_params);
+			if (path == nullptr)
+				throw url_not_found_exception{};
+			lgtrace << "router: received request: " << url;
+			return invoke(*path, ioc, &yield, ws_session, url_params, request, response);
 		}
 	};
 
@@ -21,11 +21,14 @@
 #include <boost/json.hpp>
 
 #include <memory>
+#include <vector>
 
+#include "admission.hpp"
 #include "config.hpp"
 #include "router.hpp"
 #include "database.hpp"
 #include "session.hpp"
+#include "session_store.hpp"
 
 namespace bserv {
 
@@ -38,12 +41,15 @@ namespace bserv {
 
 	class server {
 	private:
-		// io_context for all I/O
-		asio::io_context ioc_;
+		// io_contexts for all I/O: one shared by all the threads,
+		// or one for each thread in the per-core mode.
+		std::vector<std::unique_ptr<asio::io_context>> iocs_;
 		router routes_;
 		router ws_routes_;
 		std::shared_ptr<session_manager_base> session_mgr_;
 		std::shared_ptr<db_connection_manager> db_conn_mgr_;
+		std::shared_ptr<compute_pool> compute_pool_;
+		std::shared_ptr<admission_controller> admission_;
 	public:
 		server(const server_config& config, router&& routes, router&& ws_routes = {});
 	};
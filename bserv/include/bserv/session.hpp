@@ -5,23 +5,103 @@
 
 #include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
-#include <set>
+#include <functional>
 #include <mutex>
 #include <memory>
+#include <atomic>
 #include <chrono>
-#include <random>
-#include <limits>
+#include <cstdint>
+#include <cstring>
 
+#include "config.hpp"
 #include "utils.hpp"
+#include "timer_wheel.hpp"
 
 namespace bserv {
 
 	const std::string SESSION_NAME = "bsessionid";
 
-	// using session_type = std::map<std::string, boost::json::value>;
-	using session_type = boost::json::object;
+	const std::size_t NUM_SESSION_SHARDS = 64;
+
+	// the granularity of session expiry
+	const auto SESSION_EXPIRY_TICK = std::chrono::seconds(1);
+
+	// the user who has logged in.
+	// it is immutable, and replaced as a whole when it changes.
+	struct session_user {
+		std::int64_t id;
+		std::string username;
+		bool is_superuser;
+		// the user object the fields above are taken from
+		boost::json::object object;
+		// `id`, `username` and `is_superuser` are optional in `object`.
+		explicit session_user(boost::json::object obj);
+	};
+
+	// a session, which may be used by concurrent requests.
+	// - the user is read and replaced atomically (copy-on-write),
+	//   so the result of reading it is a consistent snapshot.
+	// - the other fields are accessed under the session's lock, and
+	//   they are copied out rather than referenced.
+	class session_object {
+	private:
+		mutable std::mutex lock_;
+		boost::json::object data_;
+		// `std::atomic_load` and `std::atomic_store` on a `shared_ptr` are
+		// deprecated in C++20, which provides `std::atomic<std::shared_ptr>`.
+		// without it, the pointer is guarded by a lock of its own, which is
+		// only held while it is copied.
+#ifdef __cpp_lib_atomic_shared_ptr
+		std::atomic<std::shared_ptr<const session_user>> user_;
+#else
+		mutable std::mutex user_lock_;
+		std::shared_ptr<const session_user> user_;
+#endif
+	public:
+		session_object() = default;
+		session_object(const session_object&) = delete;
+		session_object& operator=(const session_object&) = delete;
+		// `nullptr` if no user has logged in
+		std::shared_ptr<const session_user> user() const {
+#ifdef __cpp_lib_atomic_shared_ptr
+			return user_.load();
+#else
+			std::lock_guard<std::mutex> lg{ user_lock_ };
+			return user_;
+#endif
+		}
+		void set_user(std::shared_ptr<const session_user> user) {
+#ifdef __cpp_lib_atomic_shared_ptr
+			user_.store(std::move(user));
+#else
+			// the previous user is released after the lock
+			std::lock_guard<std::mutex> lg{ user_lock_ };
+			user_.swap(user);
+#endif
+		}
+		bool contains(std::string_view key) const;
+		// returns `null` if `key` does not exist.
+		boost::json::value get(std::string_view key) const;
+		void set(std::string_view key, boost::json::value value);
+		bool erase(std::string_view key);
+		// adds `delta` to the integer field `key` (`0` if it does not exist),
+		// and returns the result.
+		std::int64_t increment(std::string_view key, std::int64_t delta = 1);
+		// calls `func(data)` under the session's lock,
+		// for updating several fields at once.
+		template <typename Func>
+		decltype(auto) update(Func&& func) {
+			std::lock_guard<std::mutex> lg{ lock_ };
+			return func(data_);
+		}
+		// the user is stored as the field "user"
+		boost::json::object to_json() const;
+		void from_json(const boost::json::object& obj);
+	};
+
+	using session_type = session_object;
 
 	struct session_manager_base
 		: std::enable_shared_from_this<session_manager_base> {
@@ -41,36 +121,151 @@ namespace bserv {
 		// `session_ptr` and this function will return `true`. otherwise, `false`.
 		// NOTE: a `shared_ptr` is returned instead of a reference.
 		virtual bool try_get(
-			const std::string& key,
+			std::string_view key,
 			std::shared_ptr<session_type>& session_ptr) = 0;
+		// it is called after a request that used the session `key` is handled,
+		// so that the changes to the session can be saved.
+		virtual void commit(
+			std::string_view /*key*/,
+			const std::shared_ptr<session_type>& /*session_ptr*/) {}
+		// removes the expired sessions.
+		// it is called by the server every `SESSION_EXPIRY_TICK`.
+		virtual void collect_expired() {}
+		// writes back the pending changes, if any.
+		// it is also called by the server before exiting.
+		virtual void flush() {}
 	};
 
+	namespace session_internal {
+
+		using time_point = std::chrono::steady_clock::time_point;
+
+		// session ids are random, so 16 of their bytes are mixed as the hash.
+		// (the ids from the cookies may be forged, but they are only looked up,
+		//  and never inserted.)
+		inline std::size_t hash_session_id(std::string_view key) {
+			if (key.size() < 16) return std::hash<std::string_view>{}(key);
+			std::uint64_t a, b;
+			std::memcpy(&a, key.data(), sizeof(a));
+			std::memcpy(&b, key.data() + sizeof(a), sizeof(b));
+			std::uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+			return (std::size_t)(h ^ (h >> 31));
+		}
+
+		struct session_entry {
+			std::size_t hash;
+			std::string key;
+			std::shared_ptr<session_type> session;
+			time_point expiry;
+		};
+
+		// an open addressing (linear probing) hash table,
+		// which maps session ids (`key`) to sessions.
+		// NOTE: it is not thread-safe, and the pointers returned by
+		//       `find` and `insert` are invalidated by `insert`.
+		class session_table {
+		private:
+			enum class slot_state : unsigned char { empty, deleted, occupied };
+			std::vector<session_entry> entries_;
+			std::vector<slot_state> states_;
+			// the number of occupied slots
+			std::size_t size_;
+			// the number of occupied and deleted slots
+			std::size_t used_;
+			void rehash(std::size_t capacity);
+		public:
+			session_table() : size_{ 0 }, used_{ 0 } {}
+			std::size_t size() const { return size_; }
+			// returns `nullptr` if `key` is not in the table.
+			session_entry* find(std::string_view key, std::size_t hash);
+			// `key` should not be in the table.
+			session_entry* insert(std::string&& key, std::size_t hash);
+			void erase(session_entry* entry);
+		};
+
+	}  // session_internal
+
+	// the sessions are distributed to a number of shards by the hash
+	// of their ids, and each shard has its own lock, so that requests
+	// with different sessions rarely contend with each other.
+	// each shard has a timer wheel with a timer for each of its sessions.
+	// when the timer fires, the session is removed if it has expired,
+	// otherwise (the expiry has been extended) the timer is re-scheduled.
 	class memory_session_manager : public session_manager_base {
 	private:
-		using time_point = std::chrono::steady_clock::time_point;
-		std::mt19937 rng_;
-		std::uniform_int_distribution<std::size_t> dist_;
-		std::map<std::string, std::size_t> str_to_int_;
-		std::map<std::size_t, std::string> int_to_str_;
-		std::map<std::size_t, std::shared_ptr<session_type>> sessions_;
-		// `expiry` stores <key, expiry> tuple sorted by key
-		std::map<std::size_t, time_point> expiry_;
-		// `queue` functions as a priority queue
-		// (the front element is the smallest)
-		// and stores <expiry, key> tuple sorted by
-		// expiry first and then key.
-		std::set<std::pair<time_point, std::size_t>> queue_;
-		mutable std::mutex lock_;
+		using time_point = session_internal::time_point;
+		struct shard {
+			std::mutex lock_;
+			session_internal::session_table table_;
+			timer_wheel<std::string> wheel_;
+		};
+		std::chrono::seconds expiry_time_;
+		// the first character of the ids of the new sessions, unless it is '\0'
+		char key_tag_;
+		// the ticks of the timer wheels are counted from `epoch_`
+		time_point epoch_;
+		std::size_t shard_mask_;
+		std::unique_ptr<shard[]> shards_;
+		shard& get_shard(std::size_t hash) {
+			// the lower bits are used by `session_table`
+			return shards_[(hash >> (sizeof(std::size_t) * 4)) & shard_mask_];
+		}
+		// the first tick not earlier than `t`
+		std::uint64_t to_tick(time_point t) const {
+			return (t - epoch_ + SESSION_EXPIRY_TICK - time_point::duration{ 1 })
+				/ SESSION_EXPIRY_TICK;
+		}
+	public:
+		// `num_shards` is rounded up to a power of 2.
+		explicit memory_session_manager(
+			std::chrono::seconds expiry_time = std::chrono::seconds{ SESSION_EXPIRY_TIME },
+			std::size_t num_shards = NUM_SESSION_SHARDS,
+			char key_tag = '\0');
+		bool get_or_create(
+			std::string& key,
+			std::shared_ptr<session_type>& session_ptr);
+		bool try_get(
+			std::string_view key,
+			std::shared_ptr<session_type>& session_ptr);
+		void collect_expired();
+	};
+
+	// the sessions of the per-core mode. each core (`io_context`) has its own
+	// `memory_session_manager`, in which it creates the sessions, and which it
+	// collects, so that the cores rarely touch each other's sessions.
+	// the connections of a client may still be accepted on different cores
+	// (SO_REUSEPORT spreads them by their addresses and ports), so the first
+	// character of a session id tells the core it belongs to, and a request
+	// on another core looks it up there.
+	class per_core_session_manager : public session_manager_base {
+	private:
+		std::vector<std::shared_ptr<memory_session_manager>> cores_;
+		// the core which owns the session `key`, or `cores_.size()`
+		std::size_t owner(std::string_view key) const;
 	public:
-		memory_session_manager()
-			: rng_{ utils::internal::get_rd_value() },
-			dist_{ 0, std::numeric_limits<std::size_t>::max() } {}
+		// at most as many cores as there are characters for the session ids
+		// have sessions of their own; the others use the sessions of those.
+		// each core has `num_shards / num_cores` shards (at least 1).
+		explicit per_core_session_manager(
+			std::size_t num_cores,
+			std::chrono::seconds expiry_time = std::chrono::seconds{ SESSION_EXPIRY_TIME },
+			std::size_t num_shards = NUM_SESSION_SHARDS);
+		// sets the core of this thread (0 by default)
+		static void set_current_core(std::size_t core);
+		// the number of the cores which have sessions of their own
+		std::size_t num_cores() const { return cores_.size(); }
+		// the sessions of core `i`, which should be collected on that core
+		std::shared_ptr<memory_session_manager> core(std::size_t i) const {
+			return cores_[i];
+		}
 		bool get_or_create(
 			std::string& key,
 			std::shared_ptr<session_type>& session_ptr);
 		bool try_get(
-			const std::string& key,
+			std::string_view key,
 			std::shared_ptr<session_type>& session_ptr);
+		// collects the sessions of all the cores
+		void collect_expired();
 	};
 
 }  // bserv
@@ -0,0 +1,214 @@
+#ifndef _SESSION_STORE_HPP
+#define _SESSION_STORE_HPP
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <chrono>
+
+#include "config.hpp"
+#include "database.hpp"
+#include "session.hpp"
+
+namespace bserv {
+
+	const std::size_t SESSION_FILE_SLOTS = 64 * 1024;
+	const std::size_t SESSION_FILE_SLOT_SIZE = 1024;
+
+	// a session as it is stored.
+	struct stored_session {
+		// serialized `session_type`
+		std::string data;
+		// it changes whenever `data` is saved.
+		std::uint64_t version;
+		// unix time, in seconds
+		std::int64_t expiry;
+	};
+
+	enum class session_load_result { missing, unchanged, loaded };
+
+	// where the sessions are persisted, shared by the server processes.
+	// the functions may be called concurrently.
+	struct session_store {
+		virtual ~session_store() = default;
+		// if the version of the session `key` is `version`,
+		// `unchanged` is returned and only `session.expiry` is set.
+		// NOTE: expired sessions may be returned.
+		virtual session_load_result load(
+			std::string_view key, std::uint64_t version,
+			stored_session& session) = 0;
+		// inserts or replaces the session `key`, and returns its new version.
+		// `0` is returned if the session cannot be stored.
+		virtual std::uint64_t save(
+			std::string_view key, const std::string& data,
+			std::int64_t expiry) = 0;
+		// extends the expiries of the sessions.
+		virtual void touch(
+			const std::vector<std::pair<std::string, std::int64_t>>& expiries) = 0;
+		// removes the sessions which expired before `now`.
+		virtual void remove_expired(std::int64_t now) = 0;
+	};
+
+	// stores the sessions in a memory-mapped file of fixed-size slots,
+	// which can be shared by the processes on the same machine.
+	// the sessions larger than a slot are not stored.
+	class file_session_store : public session_store {
+	private:
+		boost::interprocess::file_mapping file_;
+		boost::interprocess::mapped_region region_;
+		std::size_t num_slots_;
+		std::size_t slot_size_;
+		char* get_slot(std::size_t idx) const;
+		// returns the slot of `key`, or `num_slots_` if it is not found.
+		// `free_slot` is set to the first slot that can be reused.
+		std::size_t find(std::string_view key, std::uint64_t hash,
+			std::int64_t now, std::size_t* free_slot) const;
+	public:
+		// the file is created if it does not exist.
+		// if it exists, the numbers of slots and their size are read from it.
+		explicit file_session_store(
+			const std::string& path,
+			std::size_t num_slots = SESSION_FILE_SLOTS,
+			std::size_t slot_size = SESSION_FILE_SLOT_SIZE);
+		session_load_result load(
+			std::string_view key, std::uint64_t version,
+			stored_session& session);
+		std::uint64_t save(
+			std::string_view key, const std::string& data,
+			std::int64_t expiry);
+		void touch(
+			const std::vector<std::pair<std::string, std::int64_t>>& expiries);
+		void remove_expired(std::int64_t now);
+	};
+
+	// stores the sessions in the table `bserv_session`,
+	// which is created if it does not exist.
+	// it has its own connections, so that loading a session never waits for
+	// the connections held by the requests.
+	class db_session_store : public session_store {
+	private:
+		db_connection_manager db_conn_mgr_;
+	public:
+		db_session_store(const std::string& conn_str, int num_conn);
+		session_load_result load(
+			std::string_view key, std::uint64_t version,
+			stored_session& session);
+		std::uint64_t save(
+			std::string_view key, const std::string& data,
+			std::int64_t expiry);
+		void touch(
+			const std::vector<std::pair<std::string, std::int64_t>>& expiries);
+		void remove_expired(std::int64_t now);
+	};
+
+	// keeps a local cache of the sessions in a `session_store`.
+	// the store is only used by a thread of its own (`writer_`), except when
+	// a session is not cached here, so that the I/O threads do not wait for it.
+	// - the new sessions and the changes to a session (`commit`) are written
+	//   behind as soon as the writer gets to them. the other processes see
+	//   them that much later, and a change is lost if the process is killed
+	//   before it is written (`flush` writes them when the server exits).
+	// - a session is read through to the store when it is not cached, or
+	//   seems expired here. a cached entry older than `revalidate_time` is
+	//   still used, and revalidated by the writer (it is only transferred
+	//   and parsed again if its version has changed), so the changes made by
+	//   the other processes may be seen a request later. with a
+	//   `revalidate_time` of 0, it is revalidated before it is used instead.
+	// - the extended expiries, which change on every request, are written
+	//   behind in batches every `SESSION_EXPIRY_TICK`, and the sessions
+	//   expired in the store are removed.
+	class persistent_session_manager : public session_manager_base {
+	private:
+		struct cache_entry {
+			std::shared_ptr<session_type> session;
+			// the data last committed or loaded from the store, and
+			// the version last saved to or loaded from the store
+			std::string data;
+			std::uint64_t version;
+			std::int64_t expiry;
+			// whether the expiry should be written back
+			bool touched;
+			// when the version was last loaded from or saved to the store
+			std::chrono::steady_clock::time_point validated;
+			// whether `data` should be written back
+			bool dirty = false;
+			// whether the entry is to be revalidated by the writer
+			bool stale = false;
+		};
+		struct shard {
+			std::mutex lock_;
+			std::unordered_map<std::string, cache_entry> entries_;
+			// the keys of the touched, dirty and stale entries
+			std::vector<std::string> touched_;
+			std::vector<std::string> dirty_;
+			std::vector<std::string> stale_;
+		};
+		std::shared_ptr<session_store> store_;
+		std::chrono::seconds expiry_time_;
+		std::chrono::milliseconds revalidate_time_;
+		std::size_t shard_mask_;
+		std::unique_ptr<shard[]> shards_;
+		// `next_removal_` is only used by `writer_`
+		std::int64_t next_removal_;
+		std::int64_t next_eviction_;
+		std::mutex writer_lock_;
+		std::condition_variable cv_;
+		bool stopped_;
+		// whether there are dirty or stale entries for the writer
+		bool pending_;
+		std::thread writer_;
+		shard& get_shard(std::string_view key);
+		// extends the expiry of `entry`, which is written back later
+		void touch(
+			shard& s, const std::string& key,
+			cache_entry& entry, std::int64_t now);
+		// `s.lock_` must be held
+		void mark_dirty(shard& s, const std::string& key, cache_entry& entry);
+		void wake_writer();
+		// writes back the data of the dirty entries
+		void save_dirty();
+		// revalidates the stale entries against the store
+		void revalidate_stale();
+		// writes back the dirty entries and revalidates the stale ones when
+		// they are queued, and writes back the expiries and removes the
+		// expired sessions from the store once in `SESSION_EXPIRY_TICK`,
+		// until stopped.
+		void run();
+	public:
+		// `num_shards` is rounded up to a power of 2.
+		explicit persistent_session_manager(
+			std::shared_ptr<session_store> store,
+			std::chrono::seconds expiry_time = std::chrono::seconds{ SESSION_EXPIRY_TIME },
+			std::chrono::milliseconds revalidate_time = std::chrono::milliseconds{ SESSION_REVALIDATE_TIME },
+			std::size_t num_shards = NUM_SESSION_SHARDS);
+		persistent_session_manager(const persistent_session_manager&) = delete;
+		persistent_session_manager& operator=(const persistent_session_manager&) = delete;
+		~persistent_session_manager();
+		bool get_or_create(
+			std::string& key,
+			std::shared_ptr<session_type>& session_ptr);
+		bool try_get(
+			std::string_view key,
+			std::shared_ptr<session_type>& session_ptr);
+		void commit(
+			std::string_view key,
+			const std::shared_ptr<session_type>& session_ptr);
+		// removes the expired sessions from the cache.
+		void collect_expired();
+		void flush();
+	};
+
+}  // bserv
+
+#endif  // _SESSION_STORE_HPP
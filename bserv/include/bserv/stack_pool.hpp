@@ -0,0 +1,130 @@
+#ifndef _STACK_POOL_HPP
+#define _STACK_POOL_HPP
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio.hpp>
+#include <boost/version.hpp>
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace bserv {
+
+	namespace asio = boost::asio;
+
+	// a per-thread pool of the stacks of stackful coroutines. each stack
+	// has a guard page below it, so that an overflow faults rather than
+	// corrupting the memory next to it. the stacks are reused instead of
+	// being mapped and unmapped for each request.
+	class stack_pool {
+	private:
+		struct stack {
+			// the lowest address, where the guard page is
+			void* limit;
+			// the size of the mapping, including the guard page
+			std::size_t size;
+		};
+		std::vector<stack> free_;
+		stack_pool() = default;
+	public:
+		stack_pool(const stack_pool&) = delete;
+		stack_pool& operator=(const stack_pool&) = delete;
+		~stack_pool();
+		static stack_pool& local();
+		// returns the top of a stack of at least `size` usable bytes.
+		// `size` is set to the actual usable size.
+		void* allocate(std::size_t& size);
+		// `sp` and `size` are the ones returned by `allocate`
+		void deallocate(void* sp, std::size_t size);
+	};
+
+	// allocates the stacks of `asio::spawn` from `stack_pool::local()`
+	class pooled_stack_allocator {
+	private:
+		std::size_t size_;
+	public:
+		explicit pooled_stack_allocator(std::size_t size) : size_{ size } {}
+		// the interface of Boost.Coroutine (`asio::spawn` before Boost 1.80)
+		void allocate(boost::coroutines::stack_context& ctx, std::size_t size) {
+			ctx.size = size;
+			ctx.sp = stack_pool::local().allocate(ctx.size);
+		}
+		void deallocate(boost::coroutines::stack_context& ctx) {
+			stack_pool::local().deallocate(ctx.sp, ctx.size);
+		}
+#if BOOST_VERSION >= 108000
+		// the interface of Boost.Context (`asio::spawn` since Boost 1.80)
+		boost::context::stack_context allocate() {
+			boost::context::stack_context ctx;
+			ctx.size = size_;
+			ctx.sp = stack_pool::local().allocate(ctx.size);
+			return ctx;
+		}
+		void deallocate(boost::context::stack_context& ctx) {
+			stack_pool::local().deallocate(ctx.sp, ctx.size);
+		}
+#endif
+		std::size_t size() const { return size_; }
+	};
+
+#if BOOST_VERSION < 108000
+	namespace stack_pool_internal {
+
+		// the same as `asio::detail::spawn_helper`, except that
+		// the stack is allocated by `pooled_stack_allocator`
+		template <typename Handler, typename Function>
+		struct spawn_helper {
+			using executor_type = typename asio::associated_executor<Handler>::type;
+			executor_type get_executor() const noexcept {
+				return asio::get_associated_executor(data_->handler_);
+			}
+			void operator()() {
+				using callee_type = typename asio::basic_yield_context<Handler>::callee_type;
+				asio::detail::coro_entry_point<Handler, Function> entry_point{ data_ };
+				std::shared_ptr<callee_type> coro{ new callee_type(
+					entry_point,
+					boost::coroutines::attributes{ allocator_.size() },
+					allocator_) };
+				data_->coro_ = coro;
+				(*coro)();
+			}
+			std::shared_ptr<asio::detail::spawn_data<Handler, Function>> data_;
+			pooled_stack_allocator allocator_;
+		};
+
+		inline void default_spawn_handler() {}
+
+	}  // stack_pool_internal
+#endif
+
+	// the same as `asio::spawn(strand, function)`, with a
+	// stack of `stack_size` bytes from the pool of this thread
+	template <typename Executor, typename Function>
+	void spawn(
+		const asio::strand<Executor>& strand,
+		Function&& function, std::size_t stack_size) {
+#if BOOST_VERSION >= 108000
+		asio::spawn(
+			strand, std::allocator_arg,
+			pooled_stack_allocator{ stack_size },
+			std::forward<Function>(function),
+			[](std::exception_ptr e) { if (e) std::rethrow_exception(e); });
+#else
+		auto handler = asio::bind_executor(
+			strand, &stack_pool_internal::default_spawn_handler);
+		using handler_type = decltype(handler);
+		using function_type = std::decay_t<Function>;
+		stack_pool_internal::spawn_helper<handler_type, function_type> helper{
+			std::make_shared<asio::detail::spawn_data<handler_type, function_type>>(
+				std::move(handler), true, std::forward<Function>(function)),
+			pooled_stack_allocator{ stack_size } };
+		asio::dispatch(std::move(helper));
+#endif
+	}
+
+}  // bserv
+
+#endif  // _STACK_POOL_HPP
@@ -0,0 +1,87 @@
+#ifndef _TIMER_WHEEL_HPP
+#define _TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+
+namespace bserv {
+
+	// a hierarchical timer wheel.
+	// time is measured in ticks, and a timer fires when the wheel is
+	// advanced past its deadline (not earlier). each level has 64 slots,
+	// and a slot at level `l` covers 64^l ticks, so scheduling and firing
+	// a timer are O(1), no matter how many timers there are.
+	// timers that are due later than 64^LEVELS ticks are put in the top
+	// level and re-scheduled whenever their slot is reached.
+	// NOTE: it is not thread-safe.
+	template <typename Value>
+	class timer_wheel {
+	private:
+		static constexpr int LEVELS = 4;
+		static constexpr int SLOT_BITS = 6;
+		static constexpr std::uint64_t SLOTS = 1 << SLOT_BITS;
+		using timer = std::pair<std::uint64_t, Value>;
+		std::vector<timer> slots_[LEVELS][SLOTS];
+		// the timers whose deadline is earlier than `current_` have fired
+		std::uint64_t current_;
+		std::size_t size_;
+		void place(timer&& t) {
+			std::uint64_t delta = t.first - current_;
+			int level = 0;
+			while (level + 1 < LEVELS
+				&& delta >= (std::uint64_t{ 1 } << (SLOT_BITS * (level + 1))))
+				++level;
+			std::uint64_t slot = (t.first >> (SLOT_BITS * level)) & (SLOTS - 1);
+			slots_[level][slot].emplace_back(std::move(t));
+		}
+		// moves the timers in the current slot of `level` to lower levels.
+		void cascade(int level) {
+			std::vector<timer> timers;
+			timers.swap(slots_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+			for (auto& t : timers) place(std::move(t));
+		}
+	public:
+		explicit timer_wheel(std::uint64_t current = 0)
+			: current_{ current }, size_{ 0 } {}
+		std::uint64_t current() const { return current_; }
+		std::size_t size() const { return size_; }
+		// a deadline in the past fires at the next `advance`.
+		void schedule(std::uint64_t deadline, Value value) {
+			if (deadline < current_) deadline = current_;
+			place(timer{ deadline, std::move(value) });
+			++size_;
+		}
+		// fires (calls `fire(value)` for) every timer whose deadline is
+		// not later than `now`. `fire` may schedule new timers.
+		template <typename Fire>
+		void advance(std::uint64_t now, Fire&& fire) {
+			while (current_ <= now) {
+				// the higher levels are cascaded first,
+				// because their timers may go to the lower levels' current slots.
+				int level = 0;
+				while (level + 1 < LEVELS
+					&& (current_ & ((std::uint64_t{ 1 } << (SLOT_BITS * (level + 1))) - 1)) == 0)
+					++level;
+				for (; level > 0; --level) cascade(level);
+				std::vector<timer> timers;
+				timers.swap(slots_[0][current_ & (SLOTS - 1)]);
+				// the timers scheduled by `fire` belong to the later ticks
+				std::uint64_t tick = current_++;
+				for (auto& t : timers) {
+					// (only happens to the timers at the top level)
+					if (t.first > tick) {
+						place(std::move(t));
+						continue;
+					}
+					--size_;
+					fire(std::move(t.second));
+				}
+			}
+		}
+	};
+
+}  // bserv
+
+#endif  // _TIMER_WHEEL_HPP
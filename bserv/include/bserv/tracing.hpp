@@ -0,0 +1,143 @@
+#ifndef _TRACING_HPP
+#define _TRACING_HPP
+
+#include <boost/beast.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bserv {
+
+	namespace beast = boost::beast;
+	namespace http = beast::http;
+
+	// a request is traced with the spans of its steps (routing, the
+	// session, the database, rendering, ...), which are kept in a ring
+	// buffer and exported in the Chrome trace format (chrome://tracing,
+	// Perfetto). each request is shown as a track of its own.
+	//
+	// the trace of the request being handled on a thread is kept in a
+	// thread-local variable: it is set when the handler starts. when bserv
+	// suspends the handler (`offloader`, `http_client`, `websocket_server`),
+	// it is cleared (by `trace_guard`), as other handlers may run on the
+	// thread in the meantime, and it is restored when the handler resumes.
+	// a C++20 coroutine handler runs on a `traced_executor`, which sets the
+	// trace only while the coroutine runs, whatever it waits for.
+
+	struct trace_event {
+		std::uint64_t trace;
+		const char* name;
+		// e.g. the target of the request
+		std::string detail;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::duration duration;
+		// the index of the thread which recorded it
+		std::uint32_t thread;
+	};
+
+	// each thread keeps its last `capacity` spans.
+	// a capacity of 0 disables the tracing.
+	void enable_tracing(std::size_t capacity);
+
+	// a new trace for a request, or 0 if the tracing is disabled
+	std::uint64_t new_trace_id();
+
+	// the trace of the request being handled on this thread (or 0)
+	std::uint64_t current_trace();
+
+	// adds `d` to the database time of the request being handled on
+	// this thread (see `trace_scope`), which is written to the access log
+	void add_db_time(std::chrono::steady_clock::duration d);
+
+	void record_span(
+		const char* name, std::uint64_t trace,
+		std::chrono::steady_clock::time_point start,
+		std::chrono::steady_clock::time_point end,
+		std::string detail = {});
+
+	// the recorded spans, ordered by their start
+	std::vector<trace_event> recorded_spans();
+
+	// the Chrome trace format (JSON)
+	std::string format_chrome_trace();
+
+	// returns false if the file cannot be written
+	bool write_chrome_trace(const std::string& path);
+
+	// exports the spans in the Chrome trace format:
+	// bserv::make_path("/trace", &bserv::serve_trace,
+	//     bserv::placeholders::response)
+	std::nullopt_t serve_trace(
+		http::response<http::string_body>& response);
+
+	// sets the trace of this thread (and the database time of its
+	// request, if `db_time` is not null) until it is destroyed
+	class trace_scope {
+	private:
+		const std::uint64_t previous_;
+		std::chrono::steady_clock::duration* const previous_db_time_;
+	public:
+		explicit trace_scope(std::uint64_t trace,
+			std::chrono::steady_clock::duration* db_time = nullptr);
+		trace_scope(const trace_scope&) = delete;
+		trace_scope& operator=(const trace_scope&) = delete;
+		~trace_scope();
+	};
+
+	// clears the trace of this thread (and the database time of its request)
+	// until it is destroyed, which is after the coroutine that created it
+	// has been resumed. it is created before the coroutine suspends.
+	class trace_guard {
+	private:
+		const std::uint64_t trace_;
+		std::chrono::steady_clock::duration* const db_time_;
+	public:
+		trace_guard();
+		trace_guard(const trace_guard&) = delete;
+		trace_guard& operator=(const trace_guard&) = delete;
+		~trace_guard();
+	};
+
+	// adds the time from its construction to its destruction
+	// to the database time of the request (see `add_db_time`)
+	class db_timer {
+	private:
+		const std::chrono::steady_clock::time_point start_;
+	public:
+		db_timer() : start_{ std::chrono::steady_clock::now() } {}
+		db_timer(const db_timer&) = delete;
+		db_timer& operator=(const db_timer&) = delete;
+		~db_timer() {
+			add_db_time(std::chrono::steady_clock::now() - start_);
+		}
+	};
+
+	// records the time from its construction to its destruction
+	// as a span of the trace of this thread (if any)
+	class trace_span {
+	private:
+		const char* const name_;
+		const std::uint64_t trace_;
+		std::chrono::steady_clock::time_point start_;
+	public:
+		explicit trace_span(const char* name)
+			: trace_span{ name, current_trace() } {}
+		trace_span(const char* name, std::uint64_t trace)
+			: name_{ name }, trace_{ trace } {
+			if (trace_ != 0) start_ = std::chrono::steady_clock::now();
+		}
+		trace_span(const trace_span&) = delete;
+		trace_span& operator=(const trace_span&) = delete;
+		~trace_span() {
+			if (trace_ != 0)
+				record_span(name_, trace_, start_, std::chrono::steady_clock::now());
+		}
+	};
+
+}  // bserv
+
+#endif  // _TRACING_HPP
@@ -6,19 +6,15 @@
 #include <tuple>
 #include <vector>
 #include <map>
-#include <random>
 #include <optional>
+#include <string_view>
 
 #include "client.hpp"
 
 namespace bserv::utils {
 
-	namespace internal {
-
-		std::random_device::result_type get_rd_value();
-
-	}  // internal
-
+	// generates a string of [A-Za-z0-9] from cryptographically secure
+	// random bytes. it takes no lock.
 	std::string generate_random_string(std::size_t len);
 
 	namespace security {
@@ -37,7 +33,7 @@ namespace bserv::utils {
 
 	}  // security
 
-	// there can be exceptions (std::stoi)!
+	// there can be exceptions (std::invalid_argument)!
 	std::string decode_url(const std::string& s);
 
 	std::string encode_url(const std::string& s);
@@ -60,6 +56,32 @@ namespace bserv::utils {
 		std::map<std::string, std::vector<std::string>>>
 		parse_url(std::string& s);
 
+	// this class scans the value of a `Cookie` header
+	// (in the form of k1=v1; k2=v2...) for the cookies named `name`.
+	// unlike `parse_params`, nothing is allocated or decoded:
+	// the values are returned as `string_view`s referring to `header`,
+	// one by one, so the scan can stop at the first useful match.
+	// the same cookie may be sent more than once (e.g. set with
+	// different paths), in which case `next` should be called again.
+	class cookie_scanner {
+	private:
+		std::string_view header_;
+		std::string_view name_;
+		std::size_t pos_;
+	public:
+		cookie_scanner(std::string_view header, std::string_view name)
+			: header_{ header }, name_{ name }, pos_{ 0 } {}
+		// returns the value of the next cookie named `name`,
+		// or `std::nullopt` if there are no more.
+		std::optional<std::string_view> next();
+	};
+
+	// returns the value of the first cookie named `name` in `header`.
+	inline std::optional<std::string_view> find_cookie(
+		std::string_view header, std::string_view name) {
+		return cookie_scanner{ header, name }.next();
+	}
+
 	namespace file {
 
 		class file_not_found : public std::exception {
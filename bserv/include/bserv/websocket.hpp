@@ -10,6 +10,8 @@
 #include <cstddef>
 #include <cstdlib>
 
+#include "awaitable.hpp"
+
 namespace bserv {
 
 	namespace beast = boost::beast;
@@ -47,17 +49,32 @@ namespace bserv {
 			ioc_{ ioc }, ws_{ std::move(socket) } {}
 	};
 
+	// the blocking-style functions suspend the stackful coroutine of the
+	// handler; the `co_` functions are used by C++20 coroutine handlers.
 	class websocket_server {
 	private:
 		websocket_session& session_;
-		asio::yield_context& yield_;
+		// null if the handler is a C++20 coroutine
+		asio::yield_context* yield_;
 	public:
 		websocket_server(websocket_session& session, asio::yield_context& yield)
-			: session_{ session }, yield_{ yield } {}
+			: session_{ session }, yield_{ &yield } {}
+		explicit websocket_server(websocket_session& session)
+			: session_{ session }, yield_{ nullptr } {}
 		std::string read();
 		boost::json::value read_json() { return boost::json::parse(read()); }
 		void write(const std::string& data);
 		void write_json(const boost::json::value& val) { write(boost::json::serialize(val)); }
+#ifdef BSERV_HAS_CO_AWAIT
+		awaitable<std::string> co_read();
+		awaitable<boost::json::value> co_read_json() {
+			co_return boost::json::parse(co_await co_read());
+		}
+		awaitable<void> co_write(std::string data);
+		awaitable<void> co_write_json(boost::json::value val) {
+			co_await co_write(boost::json::serialize(val));
+		}
+#endif
 	};
 
 }  // bserv
@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "bserv/logging.hpp"
+
+#include <boost/core/null_deleter.hpp>
+#include <boost/log/sinks.hpp>
+#include <boost/log/utility/setup/formatter_parser.hpp>
+#include <boost/make_shared.hpp>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace bserv {
+
+    namespace {
+
+        namespace sinks = boost::log::sinks;
+
+        const char* const LOG_FORMAT = "[%Severity%][%TimeStamp%][%ThreadID%]: %Message%";
+
+        class log_writer_base {
+        public:
+            virtual ~log_writer_base() = default;
+            virtual void stop() = 0;
+        };
+
+        // feeds the records of `sink` to its backend on a thread of its own.
+        // each batch (all the records which are queued) is flushed once,
+        // instead of after each record.
+        template <typename Backend, typename Overflow>
+        class log_writer : public log_writer_base {
+        private:
+            using sink_type = sinks::asynchronous_sink<
+                Backend, sinks::bounded_fifo_queue<LOG_QUEUE_SIZE, Overflow>>;
+            // keeps the core alive until the sink is removed from it,
+            // as the writer is destroyed when the process exits
+            const boost::shared_ptr<logging::core> core_;
+            boost::shared_ptr<sink_type> sink_;
+            std::mutex lock_;
+            std::condition_variable cv_;
+            bool stopped_ = false;
+            std::thread thread_;
+            void run() {
+                std::unique_lock<std::mutex> lock{ lock_ };
+                while (!stopped_) {
+                    lock.unlock();
+                    sink_->feed_records();
+                    sink_->locked_backend()->flush();
+                    lock.lock();
+                    cv_.wait_for(lock, LOG_FLUSH_INTERVAL, [this] { return stopped_; });
+                }
+            }
+        public:
+            explicit log_writer(boost::shared_ptr<Backend> backend)
+                : core_{ logging::core::get() },
+                sink_{ boost::make_shared<sink_type>(backend, false) } {
+                sink_->set_formatter(logging::parse_formatter(LOG_FORMAT));
+                core_->add_sink(sink_);
+                thread_ = std::thread{ [this] { run(); } };
+            }
+            void stop() {
+                {
+                    std::lock_guard<std::mutex> lg{ lock_ };
+                    if (stopped_) return;
+                    stopped_ = true;
+                }
+                cv_.notify_one();
+                thread_.join();
+                core_->remove_sink(sink_);
+                // the records which are queued after the last batch
+                sink_->flush();
+            }
+            ~log_writer() {
+                stop();
+            }
+        };
+
+        template <typename Backend>
+        std::unique_ptr<log_writer_base> make_log_writer(
+            boost::shared_ptr<Backend> backend, bool drop) {
+            if (drop)
+                return std::make_unique<log_writer<Backend, sinks::drop_on_overflow>>(backend);
+            return std::make_unique<log_writer<Backend, sinks::block_on_overflow>>(backend);
+        }
+
+        // it is destroyed (and flushed) when the process exits
+        std::unique_ptr<log_writer_base> writer_;
+
+    }  // namespace
+
+    void init_logging(const server_config& config) {
+        logging::trivial::severity_level level;
+        const std::string& name = config.get_log_level();
+        if (!logging::trivial::from_string(name.c_str(), name.size(), level)) {
+            std::cerr << "unknown log level: " << name << std::endl;
+            level = logging::trivial::info;
+        }
+        logging_internal::min_level = level;
+        logging::core::get()->set_filter(logging::trivial::severity >= level);
+        logging::add_common_attributes();
+
+        if (writer_ != nullptr) writer_->stop();
+        if (config.get_log_path() != "") {
+            std::string filename = config.get_log_path();
+            if (filename[filename.size() - 1] != '/') {
+                filename += '/';
+            }
+            filename += config.get_name();
+            writer_ = make_log_writer(
+                boost::make_shared<sinks::text_file_backend>(
+                    keywords::file_name = filename + "_%Y%m%d_%H-%M-%S.%N.log",
+                    keywords::rotation_size = config.get_log_rotation_size()),
+                config.get_log_drop());
+#if defined(_MSC_VER) && defined(_DEBUG)
+            // write to console as well
+            logging::add_console_log(std::cout);
+#endif
+        }
+        else {
+            auto backend = boost::make_shared<sinks::text_ostream_backend>();
+            backend->add_stream(
+                boost::shared_ptr<std::ostream>(&std::clog, boost::null_deleter{}));
+            writer_ = make_log_writer(backend, config.get_log_drop());
+        }
+    }
+
+    void flush_logging() {
+        if (writer_ != nullptr) writer_->stop();
+    }
+
+}  // bserv
@@ -0,0 +1,209 @@
+#include "pch.h"
+#include "bserv/metrics.hpp"
+
+#include <cmath>
+#include <sstream>
+
+namespace bserv {
+
+    namespace {
+
+        // the shard of the calling thread
+        std::size_t this_shard() {
+            static std::atomic<std::size_t> next{ 0 };
+            thread_local const std::size_t shard =
+                next.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+            return shard;
+        }
+
+        constexpr std::size_t SUB_BUCKET_BITS = 3;
+        static_assert(std::size_t{ 1 } << SUB_BUCKET_BITS == HISTOGRAM_SUB_BUCKETS);
+
+        // the values below `HISTOGRAM_SUB_BUCKETS` have a bucket each,
+        // then octave k (k >= 1) is [8 << (k - 1), 16 << (k - 1)).
+        std::size_t bucket_of(std::uint64_t us) {
+            if (us < HISTOGRAM_SUB_BUCKETS) return static_cast<std::size_t>(us);
+            std::size_t msb = SUB_BUCKET_BITS;
+            while ((us >> (msb + 1)) != 0) ++msb;
+            std::size_t octave = msb - SUB_BUCKET_BITS + 1;
+            if (octave > HISTOGRAM_OCTAVES) return HISTOGRAM_BUCKETS - 1;
+            std::size_t sub = static_cast<std::size_t>(us >> (msb - SUB_BUCKET_BITS))
+                - HISTOGRAM_SUB_BUCKETS;
+            return octave * HISTOGRAM_SUB_BUCKETS + sub;
+        }
+
+        // the upper bounds of the buckets of the Prometheus histograms
+        const double EXPORTED_BOUNDS[] = {
+            0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+            0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+        };
+
+        std::string escape_label(const std::string& value) {
+            std::string escaped;
+            for (char c : value) {
+                if (c == '\\' || c == '"') escaped += '\\';
+                if (c == '\n') escaped += "\\n";
+                else escaped += c;
+            }
+            return escaped;
+        }
+
+        // a bucket is counted in a Prometheus bucket if its upper
+        // bound is within the bound, so the export is conservative
+        // within the precision of the histogram.
+        void format_histogram(
+            std::ostringstream& out, const std::string& name,
+            const std::string& labels, const latency_histogram& histogram) {
+            histogram_snapshot snapshot = histogram.snapshot();
+            std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+            std::size_t i = 0;
+            std::uint64_t cumulative = 0;
+            for (double bound : EXPORTED_BOUNDS) {
+                for (; i + 1 < HISTOGRAM_BUCKETS
+                    && histogram_snapshot::lower_bound(i + 1).count() <= bound * 1e6; ++i)
+                    cumulative += snapshot.counts[i];
+                out << name << "_bucket" << prefix << "le=\"" << bound << "\"} "
+                    << cumulative << '\n';
+            }
+            out << name << "_bucket" << prefix << "le=\"+Inf\"} " << snapshot.count << '\n';
+            std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+            out << name << "_sum" << suffix << ' '
+                << std::chrono::duration<double>(snapshot.sum).count() << '\n';
+            out << name << "_count" << suffix << ' ' << snapshot.count << '\n';
+        }
+
+        void format_header(
+            std::ostringstream& out, const std::string& name,
+            const std::string& type, const std::string& help) {
+            out << "# HELP " << name << ' ' << help << '\n'
+                << "# TYPE " << name << ' ' << type << '\n';
+        }
+
+    }  // namespace
+
+    std::chrono::microseconds histogram_snapshot::lower_bound(std::size_t i) {
+        if (i < HISTOGRAM_SUB_BUCKETS) return std::chrono::microseconds(i);
+        std::size_t octave = i / HISTOGRAM_SUB_BUCKETS;
+        std::size_t sub = i % HISTOGRAM_SUB_BUCKETS;
+        return std::chrono::microseconds(
+            static_cast<std::int64_t>(HISTOGRAM_SUB_BUCKETS + sub) << (octave - 1));
+    }
+
+    std::chrono::microseconds histogram_snapshot::quantile(double q) const {
+        if (count == 0) return std::chrono::microseconds(0);
+        std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(q * count));
+        if (rank == 0) rank = 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return i + 1 < HISTOGRAM_BUCKETS ? lower_bound(i + 1) : lower_bound(i);
+        }
+        return lower_bound(HISTOGRAM_BUCKETS - 1);
+    }
+
+    void latency_histogram::record(std::chrono::steady_clock::duration d) {
+        std::int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        if (ns < 0) ns = 0;
+        shard& s = shards_[this_shard()];
+        s.counts[bucket_of(static_cast<std::uint64_t>(ns) / 1000)]
+            .fetch_add(1, std::memory_order_relaxed);
+        s.sum_ns.fetch_add(static_cast<std::uint64_t>(ns), std::memory_order_relaxed);
+    }
+
+    histogram_snapshot latency_histogram::snapshot() const {
+        histogram_snapshot snapshot{};
+        std::uint64_t sum_ns = 0;
+        for (const shard& s : shards_) {
+            for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+                std::uint64_t n = s.counts[i].load(std::memory_order_relaxed);
+                snapshot.counts[i] += n;
+                snapshot.count += n;
+            }
+            sum_ns += s.sum_ns.load(std::memory_order_relaxed);
+        }
+        snapshot.sum = std::chrono::nanoseconds(sum_ns);
+        return snapshot;
+    }
+
+    std::shared_ptr<latency_histogram> metrics_registry::route(const std::string& url) {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        std::shared_ptr<latency_histogram>& histogram = routes_[url];
+        if (histogram == nullptr)
+            histogram = std::make_shared<latency_histogram>();
+        return histogram;
+    }
+
+    void metrics_registry::record_status(unsigned status) {
+        if (status < MIN_STATUS || status > MAX_STATUS) return;
+        statuses_[this_shard()].counts[status - MIN_STATUS]
+            .fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void metrics_registry::add_collector(std::function<void(std::string&)> collector) {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        collectors_.push_back(std::move(collector));
+    }
+
+    std::string metrics_registry::format() const {
+        std::ostringstream out;
+        std::vector<std::function<void(std::string&)>> collectors;
+        {
+            std::lock_guard<std::mutex> lg{ lock_ };
+            format_header(out, "bserv_request_duration_seconds", "histogram",
+                "The time from receiving a request to its response being ready.");
+            for (auto& [url, histogram] : routes_)
+                format_histogram(out, "bserv_request_duration_seconds",
+                    "route=\"" + escape_label(url) + "\"", *histogram);
+            collectors = collectors_;
+        }
+        format_histogram(out, "bserv_request_duration_seconds",
+            "route=\"(unmatched)\"", unmatched);
+
+        format_header(out, "bserv_responses_total", "counter",
+            "The responses, by status code.");
+        for (unsigned status = MIN_STATUS; status <= MAX_STATUS; ++status) {
+            std::uint64_t n = 0;
+            for (const status_shard& s : statuses_)
+                n += s.counts[status - MIN_STATUS].load(std::memory_order_relaxed);
+            if (n != 0)
+                out << "bserv_responses_total{code=\"" << status << "\"} " << n << '\n';
+        }
+
+        const struct {
+            const char* name;
+            const char* help;
+            const latency_histogram& histogram;
+        } histograms[] = {
+            { "bserv_db_acquire_seconds",
+                "The time to take a database connection from the pool.", db_acquire },
+            { "bserv_db_query_seconds", "The time to execute a query.", db_query },
+            { "bserv_render_seconds", "The time to render a template.", render },
+            { "bserv_serialize_seconds",
+                "The time to serialize the value returned by a handler.", serialize }
+        };
+        for (auto& h : histograms) {
+            format_header(out, h.name, "histogram", h.help);
+            format_histogram(out, h.name, "", h.histogram);
+        }
+
+        std::string text = out.str();
+        for (auto& collector : collectors)
+            collector(text);
+        return text;
+    }
+
+    metrics_registry& metrics() {
+        static metrics_registry registry;
+        return registry;
+    }
+
+    std::nullopt_t serve_metrics(
+        http::response<http::string_body>& response) {
+        response.set(http::field::content_type, "text/plain; version=0.0.4");
+        response.body() = metrics().format();
+        response.prepare_payload();
+        return std::nullopt;
+    }
+
+}  // bserv
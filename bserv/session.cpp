@@ -1,84 +1,267 @@
 #include "pch.h"
 #include "bserv/session.hpp"
 
+#include <algorithm>
+#include <string_view>
+
 namespace bserv {
 
+    namespace session_internal {
+
+        const std::size_t MIN_TABLE_CAPACITY = 16;
+
+        session_entry* session_table::find(
+            std::string_view key, std::size_t hash) {
+            if (size_ == 0) return nullptr;
+            std::size_t mask = states_.size() - 1;
+            for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+                if (states_[i] == slot_state::empty) return nullptr;
+                if (states_[i] == slot_state::occupied
+                    && entries_[i].hash == hash && entries_[i].key == key)
+                    return &entries_[i];
+            }
+        }
+
+        session_entry* session_table::insert(
+            std::string&& key, std::size_t hash) {
+            // the table is rehashed when more than 3/4 of the slots are used
+            if ((used_ + 1) * 4 > states_.size() * 3) {
+                // if most of the used slots are deleted ones,
+                // the capacity remains unchanged.
+                std::size_t capacity = MIN_TABLE_CAPACITY;
+                while ((size_ + 1) * 2 > capacity) capacity *= 2;
+                rehash(capacity);
+            }
+            std::size_t mask = states_.size() - 1;
+            std::size_t i = hash & mask;
+            while (states_[i] == slot_state::occupied) i = (i + 1) & mask;
+            if (states_[i] == slot_state::empty) ++used_;
+            states_[i] = slot_state::occupied;
+            ++size_;
+            entries_[i].hash = hash;
+            entries_[i].key = std::move(key);
+            return &entries_[i];
+        }
+
+        void session_table::erase(session_entry* entry) {
+            std::size_t i = entry - entries_.data();
+            states_[i] = slot_state::deleted;
+            // releases the memory now rather than on reuse
+            entries_[i] = session_entry{};
+            --size_;
+        }
+
+        void session_table::rehash(std::size_t capacity) {
+            std::vector<session_entry> entries(capacity);
+            std::vector<slot_state> states(capacity, slot_state::empty);
+            std::size_t mask = capacity - 1;
+            for (std::size_t i = 0; i < states_.size(); ++i) {
+                if (states_[i] != slot_state::occupied) continue;
+                std::size_t j = entries_[i].hash & mask;
+                while (states[j] == slot_state::occupied) j = (j + 1) & mask;
+                states[j] = slot_state::occupied;
+                entries[j] = std::move(entries_[i]);
+            }
+            entries_.swap(entries);
+            states_.swap(states);
+            used_ = size_;
+        }
+
+    }  // session_internal
+
+    session_user::session_user(boost::json::object obj)
+        : id{ 0 }, is_superuser{ false }, object{ std::move(obj) } {
+        if (auto* p = object.if_contains("id"); p != nullptr && p->is_int64())
+            id = p->as_int64();
+        if (auto* p = object.if_contains("username"); p != nullptr && p->is_string())
+            username = p->as_string().c_str();
+        if (auto* p = object.if_contains("is_superuser"); p != nullptr && p->is_bool())
+            is_superuser = p->as_bool();
+    }
+
+    bool session_object::contains(std::string_view key) const {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        return data_.contains(key);
+    }
+
+    boost::json::value session_object::get(std::string_view key) const {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        if (auto* p = data_.if_contains(key)) return *p;
+        return nullptr;
+    }
+
+    void session_object::set(std::string_view key, boost::json::value value) {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        data_[key] = std::move(value);
+    }
+
+    bool session_object::erase(std::string_view key) {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        return data_.erase(key) != 0;
+    }
+
+    std::int64_t session_object::increment(std::string_view key, std::int64_t delta) {
+        std::lock_guard<std::mutex> lg{ lock_ };
+        boost::json::value& value = data_[key];
+        std::int64_t result = (value.is_int64() ? value.as_int64() : 0) + delta;
+        value = result;
+        return result;
+    }
+
+    boost::json::object session_object::to_json() const {
+        boost::json::object obj;
+        {
+            std::lock_guard<std::mutex> lg{ lock_ };
+            obj = data_;
+        }
+        if (auto u = user()) obj["user"] = u->object;
+        return obj;
+    }
+
+    void session_object::from_json(const boost::json::object& obj) {
+        boost::json::object data = obj;
+        std::shared_ptr<const session_user> u;
+        if (auto* p = data.if_contains("user"); p != nullptr && p->is_object())
+            u = std::make_shared<const session_user>(p->as_object());
+        data.erase("user");
+        {
+            std::lock_guard<std::mutex> lg{ lock_ };
+            data_ = std::move(data);
+        }
+        set_user(std::move(u));
+    }
+
+    memory_session_manager::memory_session_manager(
+        std::chrono::seconds expiry_time, std::size_t num_shards, char key_tag)
+        : expiry_time_{ expiry_time },
+        key_tag_{ key_tag },
+        epoch_{ std::chrono::steady_clock::now() } {
+        std::size_t n = 1;
+        while (n < num_shards) n *= 2;
+        shard_mask_ = n - 1;
+        shards_ = std::make_unique<shard[]>(n);
+    }
+
     bool memory_session_manager::get_or_create(
         std::string& key,
         std::shared_ptr<session_type>& session_ptr) {
-        std::lock_guard<std::mutex> lg{ lock_ };
         time_point now = std::chrono::steady_clock::now();
-        // removes the expired sessions
-        while (!queue_.empty() && queue_.begin()->first < now) {
-            std::size_t another_key = queue_.begin()->second;
-            sessions_.erase(another_key);
-            expiry_.erase(another_key);
-            str_to_int_.erase(int_to_str_[another_key]);
-            int_to_str_.erase(another_key);
-            queue_.erase(queue_.begin());
-        }
         bool created = false;
-        std::size_t int_key;
-        if (key.empty() || str_to_int_.count(key) == 0) {
-            do {
+        std::size_t hash = session_internal::hash_session_id(key);
+        shard* s = &get_shard(hash);
+        std::unique_lock<std::mutex> lg{ s->lock_ };
+        session_internal::session_entry* entry =
+            key.empty() ? nullptr : s->table_.find(key, hash);
+        // the expired session will be removed when its timer fires
+        if (entry != nullptr && entry->expiry < now) entry = nullptr;
+        if (entry == nullptr) {
+            lg.unlock();
+            // the new session id decides the shard
+            while (true) {
                 key = utils::generate_random_string(32);
-            } while (str_to_int_.count(key) != 0);
-            do {
-                int_key = dist_(rng_);
-            } while (int_to_str_.count(int_key) != 0);
-            str_to_int_[key] = int_key;
-            int_to_str_[int_key] = key;
-            sessions_[int_key] = std::make_shared<session_type>();
+                if (key_tag_ != '\0') key[0] = key_tag_;
+                hash = session_internal::hash_session_id(key);
+                s = &get_shard(hash);
+                lg = std::unique_lock<std::mutex>{ s->lock_ };
+                if (s->table_.find(key, hash) == nullptr) break;
+                lg.unlock();
+            }
+            entry = s->table_.insert(std::string{ key }, hash);
+            entry->session = std::make_shared<session_type>();
+            s->wheel_.schedule(to_tick(now + expiry_time_), key);
             created = true;
         }
-        else {
-            int_key = str_to_int_[key];
-            queue_.erase(
-                queue_.lower_bound(
-                    std::make_pair(expiry_[int_key], int_key)));
-        }
-        // the expiry is set to be 20 minutes from now.
-        // if the session is re-visited within 20 minutes,
+        // if the session is re-visited before it expires,
         // the expiry will be extended.
-        expiry_[int_key] = now + std::chrono::minutes(20);
-        // pushes expiry-key tuple (pair) to the queue
-        queue_.emplace(expiry_[int_key], int_key);
-        session_ptr = sessions_[int_key];
+        entry->expiry = now + expiry_time_;
+        session_ptr = entry->session;
         return created;
     }
 
     bool memory_session_manager::try_get(
-        const std::string& key,
+        std::string_view key,
         std::shared_ptr<session_type>& session_ptr) {
-        std::lock_guard<std::mutex> lg{ lock_ };
+        if (key.empty()) return false;
         time_point now = std::chrono::steady_clock::now();
-        // removes the expired sessions
-        while (!queue_.empty() && queue_.begin()->first < now) {
-            std::size_t another_key = queue_.begin()->second;
-            sessions_.erase(another_key);
-            expiry_.erase(another_key);
-            str_to_int_.erase(int_to_str_[another_key]);
-            int_to_str_.erase(another_key);
-            queue_.erase(queue_.begin());
-        }
-        std::size_t int_key;
-        if (key.empty() || str_to_int_.count(key) == 0) {
-            return false;
-        }
-        else {
-            int_key = str_to_int_[key];
-            queue_.erase(
-                queue_.lower_bound(
-                    std::make_pair(expiry_[int_key], int_key)));
-        }
-        // the expiry is set to be 20 minutes from now.
-        // if the session is re-visited within 20 minutes,
+        std::size_t hash = session_internal::hash_session_id(key);
+        shard& s = get_shard(hash);
+        std::lock_guard<std::mutex> lg{ s.lock_ };
+        session_internal::session_entry* entry = s.table_.find(key, hash);
+        if (entry == nullptr || entry->expiry < now) return false;
+        // if the session is re-visited before it expires,
         // the expiry will be extended.
-        expiry_[int_key] = now + std::chrono::minutes(20);
-        // pushes expiry-key tuple (pair) to the queue
-        queue_.emplace(expiry_[int_key], int_key);
-        session_ptr = sessions_[int_key];
+        entry->expiry = now + expiry_time_;
+        session_ptr = entry->session;
         return true;
     }
 
-}  // bserv
\ No newline at end of file
+    void memory_session_manager::collect_expired() {
+        time_point now = std::chrono::steady_clock::now();
+        std::uint64_t tick = (now - epoch_) / SESSION_EXPIRY_TICK;
+        for (std::size_t i = 0; i <= shard_mask_; ++i) {
+            shard& s = shards_[i];
+            std::lock_guard<std::mutex> lg{ s.lock_ };
+            s.wheel_.advance(tick, [&](std::string&& key) {
+                std::size_t hash = session_internal::hash_session_id(key);
+                session_internal::session_entry* entry = s.table_.find(key, hash);
+                if (entry == nullptr) return;
+                if (entry->expiry < now) s.table_.erase(entry);
+                else s.wheel_.schedule(to_tick(entry->expiry), std::move(key));
+            });
+        }
+    }
+
+    namespace {
+
+        // the characters of the session ids (see `utils::generate_random_string`),
+        // the `i`th of which tags the sessions of core `i`
+        const std::string_view session_core_tags =
+            "abcdefghijklmnopqrstuvwxyz"
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+            "1234567890";
+
+        thread_local std::size_t current_core = 0;
+
+    }  // namespace
+
+    per_core_session_manager::per_core_session_manager(
+        std::size_t num_cores, std::chrono::seconds expiry_time,
+        std::size_t num_shards) {
+        num_cores = std::clamp<std::size_t>(num_cores, 1, session_core_tags.size());
+        std::size_t core_shards = std::max<std::size_t>(num_shards / num_cores, 1);
+        for (std::size_t i = 0; i < num_cores; ++i)
+            cores_.push_back(std::make_shared<memory_session_manager>(
+                expiry_time, core_shards, session_core_tags[i]));
+    }
+
+    void per_core_session_manager::set_current_core(std::size_t core) {
+        current_core = core;
+    }
+
+    std::size_t per_core_session_manager::owner(std::string_view key) const {
+        if (key.empty()) return cores_.size();
+        std::size_t i = session_core_tags.find(key[0]);
+        return i < cores_.size() ? i : cores_.size();
+    }
+
+    bool per_core_session_manager::get_or_create(
+        std::string& key,
+        std::shared_ptr<session_type>& session_ptr) {
+        if (try_get(key, session_ptr)) return false;
+        // the new session belongs to this core
+        key.clear();
+        return cores_[current_core % cores_.size()]->get_or_create(key, session_ptr);
+    }
+
+    bool per_core_session_manager::try_get(
+        std::string_view key,
+        std::shared_ptr<session_type>& session_ptr) {
+        std::size_t i = owner(key);
+        return i < cores_.size() && cores_[i]->try_get(key, session_ptr);
+    }
+
+    void per_core_session_manager::collect_expired() {
+        for (auto& core : cores_) core->collect_expired();
+    }
+
+}  // bserv
@@ -0,0 +1,744 @@
+#include "pch.h"
+#include "bserv/session_store.hpp"
+
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <stdexcept>
+
+#include "bserv/logging.hpp"
+
+namespace bserv {
+
+    namespace bip = boost::interprocess;
+
+    namespace {
+
+        // the sessions expired in the store are removed at most once per interval
+        const std::int64_t SESSION_REMOVAL_INTERVAL = 60;  // seconds
+
+        std::int64_t unix_time() {
+            return std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // FNV-1a, which is the same in every process
+        std::uint64_t stable_hash(std::string_view key) {
+            std::uint64_t hash = 14695981039346656037ull;
+            for (unsigned char c : key) {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        const char FILE_MAGIC[8] = { 'b', 's', 'e', 's', 's', 'i', 'o', 'n' };
+
+        struct file_header {
+            char magic[8];
+            std::uint64_t num_slots;
+            std::uint64_t slot_size;
+        };
+
+        const std::size_t FILE_HEADER_SIZE = 64;
+        const std::size_t MAX_KEY_SIZE = 64;
+        // the sessions are looked up by linear probing,
+        // in at most `MAX_PROBES` slots.
+        const std::size_t MAX_PROBES = 32;
+
+        // each slot starts with a `slot_header`, followed by the data.
+        // the slots are shared by processes, so only lock-free atomics are used:
+        // - the writers exclude each other with `lock`.
+        // - `seq` is odd while the slot is being written, and the readers retry
+        //   if it changes during the read (seqlock). it is also the version.
+        // - a slot which has never been used has `seq == 0`, and ends the probing.
+        //   a slot whose session has expired can be reused.
+        struct slot_header {
+            std::atomic<std::uint32_t> lock;
+            std::uint32_t key_size;
+            std::atomic<std::uint64_t> seq;
+            std::atomic<std::int64_t> expiry;
+            std::uint64_t data_size;
+            char key[MAX_KEY_SIZE];
+        };
+
+        static_assert(std::atomic<std::uint32_t>::is_always_lock_free
+            && std::atomic<std::uint64_t>::is_always_lock_free
+            && std::atomic<std::int64_t>::is_always_lock_free,
+            "the session file requires lock-free atomics");
+
+        // NOTE: a process that dies while holding the lock blocks the slot.
+        class slot_lock {
+        private:
+            slot_header& slot_;
+        public:
+            explicit slot_lock(slot_header& slot) : slot_{ slot } {
+                while (slot_.lock.exchange(1, std::memory_order_acquire) != 0)
+                    std::this_thread::yield();
+            }
+            ~slot_lock() { slot_.lock.store(0, std::memory_order_release); }
+            slot_lock(const slot_lock&) = delete;
+            slot_lock& operator=(const slot_lock&) = delete;
+        };
+
+        slot_header& get_header(char* slot) {
+            return *reinterpret_cast<slot_header*>(slot);
+        }
+
+        // waits until the slot is not being written, and returns `seq`.
+        std::uint64_t begin_read(const slot_header& slot) {
+            std::uint64_t seq;
+            while ((seq = slot.seq.load(std::memory_order_acquire)) & 1)
+                std::this_thread::yield();
+            return seq;
+        }
+
+        // whether the slot has not been written since `begin_read`
+        bool end_read(const slot_header& slot, std::uint64_t seq) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.seq.load(std::memory_order_relaxed) == seq;
+        }
+
+        bool key_equals(const slot_header& slot, std::string_view key) {
+            return slot.key_size == key.size()
+                && std::memcmp(slot.key, key.data(), key.size()) == 0;
+        }
+
+        // `slot.lock` should be acquired.
+        void begin_write(slot_header& slot) {
+            slot.seq.store(slot.seq.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        // returns the new `seq`
+        std::uint64_t end_write(slot_header& slot) {
+            std::uint64_t seq = slot.seq.load(std::memory_order_relaxed) + 1;
+            slot.seq.store(seq, std::memory_order_release);
+            return seq;
+        }
+
+    }
+
+    file_session_store::file_session_store(
+        const std::string& path, std::size_t num_slots, std::size_t slot_size) {
+        // creates the file if it does not exist
+        std::ofstream{ path, std::ios::app | std::ios::binary };
+        // the processes starting at the same time initialize the file one by one
+        bip::file_lock file_lock{ path.c_str() };
+        bip::scoped_lock<bip::file_lock> lg{ file_lock };
+        file_header header{};
+        std::ifstream in{ path, std::ios::binary };
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (in.gcount() == sizeof(header)
+            && std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0) {
+            num_slots = (std::size_t)header.num_slots;
+            slot_size = (std::size_t)header.slot_size;
+        }
+        else if (std::filesystem::file_size(path) != 0) {
+            throw std::runtime_error{ "'" + path + "' is not a session file" };
+        }
+        else {
+            std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+            header.num_slots = num_slots;
+            header.slot_size = slot_size;
+        }
+        in.close();
+        // the slots should be aligned for the atomics
+        if (num_slots == 0 || slot_size % 8 != 0
+            || slot_size <= sizeof(slot_header))
+            throw std::invalid_argument{ "invalid session file geometry" };
+        std::uintmax_t file_size = FILE_HEADER_SIZE + (std::uintmax_t)num_slots * slot_size;
+        if (std::filesystem::file_size(path) < file_size) {
+            // the new slots are zeros, i.e. never used
+            std::filesystem::resize_file(path, file_size);
+            std::fstream out{ path, std::ios::in | std::ios::out | std::ios::binary };
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        file_ = bip::file_mapping{ path.c_str(), bip::read_write };
+        region_ = bip::mapped_region{ file_, bip::read_write, 0, (std::size_t)file_size };
+        num_slots_ = num_slots;
+        slot_size_ = slot_size;
+    }
+
+    char* file_session_store::get_slot(std::size_t idx) const {
+        return static_cast<char*>(region_.get_address())
+            + FILE_HEADER_SIZE + idx * slot_size_;
+    }
+
+    std::size_t file_session_store::find(
+        std::string_view key, std::uint64_t hash,
+        std::int64_t now, std::size_t* free_slot) const {
+        if (free_slot != nullptr) *free_slot = num_slots_;
+        std::size_t num_probes = std::min(MAX_PROBES, num_slots_);
+        for (std::size_t i = 0; i < num_probes; ++i) {
+            std::size_t idx = (std::size_t)((hash + i) % num_slots_);
+            slot_header& slot = get_header(get_slot(idx));
+            bool matched, reusable;
+            std::uint64_t seq;
+            do {
+                seq = begin_read(slot);
+                matched = key_equals(slot, key);
+                reusable = slot.expiry.load(std::memory_order_relaxed) < now;
+            } while (!end_read(slot, seq));
+            if (matched && seq != 0) return idx;
+            if (free_slot != nullptr && *free_slot == num_slots_
+                && (seq == 0 || reusable))
+                *free_slot = idx;
+            if (seq == 0) break;
+        }
+        return num_slots_;
+    }
+
+    session_load_result file_session_store::load(
+        std::string_view key, std::uint64_t version,
+        stored_session& session) {
+        if (key.size() > MAX_KEY_SIZE) return session_load_result::missing;
+        std::size_t idx = find(key, stable_hash(key), 0, nullptr);
+        if (idx == num_slots_) return session_load_result::missing;
+        char* slot_ptr = get_slot(idx);
+        slot_header& slot = get_header(slot_ptr);
+        std::size_t max_data_size = slot_size_ - sizeof(slot_header);
+        while (true) {
+            std::uint64_t seq = begin_read(slot);
+            // the slot may have been reused since `find`
+            bool matched = key_equals(slot, key);
+            std::int64_t expiry = slot.expiry.load(std::memory_order_relaxed);
+            if (matched && seq != version) {
+                std::size_t data_size = (std::size_t)std::min<std::uint64_t>(
+                    slot.data_size, max_data_size);
+                session.data.assign(slot_ptr + sizeof(slot_header), data_size);
+            }
+            if (!end_read(slot, seq)) continue;
+            if (!matched) return session_load_result::missing;
+            session.expiry = expiry;
+            if (seq == version) return session_load_result::unchanged;
+            session.version = seq;
+            return session_load_result::loaded;
+        }
+    }
+
+    std::uint64_t file_session_store::save(
+        std::string_view key, const std::string& data, std::int64_t expiry) {
+        if (key.size() > MAX_KEY_SIZE
+            || data.size() > slot_size_ - sizeof(slot_header)) {
+            lgwarning << "file_session_store: the session is too large to be stored";
+            return 0;
+        }
+        std::uint64_t hash = stable_hash(key);
+        std::int64_t now = unix_time();
+        while (true) {
+            std::size_t free_slot;
+            std::size_t idx = find(key, hash, now, &free_slot);
+            bool found = idx != num_slots_;
+            if (!found) idx = free_slot;
+            if (idx == num_slots_) {
+                lgwarning << "file_session_store: there are no free slots";
+                return 0;
+            }
+            char* slot_ptr = get_slot(idx);
+            slot_header& slot = get_header(slot_ptr);
+            slot_lock lg{ slot };
+            // the slot may have changed before it is locked
+            bool matched = key_equals(slot, key)
+                && slot.seq.load(std::memory_order_relaxed) != 0;
+            if (found ? !matched
+                : slot.seq.load(std::memory_order_relaxed) != 0
+                && slot.expiry.load(std::memory_order_relaxed) >= now)
+                continue;
+            std::int64_t old_expiry = slot.expiry.load(std::memory_order_relaxed);
+            begin_write(slot);
+            slot.key_size = (std::uint32_t)key.size();
+            std::memcpy(slot.key, key.data(), key.size());
+            slot.data_size = data.size();
+            std::memcpy(slot_ptr + sizeof(slot_header), data.data(), data.size());
+            slot.expiry.store(matched ? std::max(old_expiry, expiry) : expiry,
+                std::memory_order_relaxed);
+            return end_write(slot);
+        }
+    }
+
+    void file_session_store::touch(
+        const std::vector<std::pair<std::string, std::int64_t>>& expiries) {
+        for (auto& [key, expiry] : expiries) {
+            if (key.size() > MAX_KEY_SIZE) continue;
+            std::size_t idx = find(key, stable_hash(key), 0, nullptr);
+            if (idx == num_slots_) continue;
+            slot_header& slot = get_header(get_slot(idx));
+            slot_lock lg{ slot };
+            // the expiry is not protected by `seq`,
+            // so touching a session does not change its version.
+            if (key_equals(slot, key)
+                && slot.expiry.load(std::memory_order_relaxed) < expiry)
+                slot.expiry.store(expiry, std::memory_order_relaxed);
+        }
+    }
+
+    // the slots of the expired sessions are reused in place.
+    void file_session_store::remove_expired(std::int64_t) {}
+
+    // **************************************************************************
+
+    db_session_store::db_session_store(const std::string& conn_str, int num_conn)
+        : db_conn_mgr_{ conn_str, num_conn } {
+        db_transaction tx{ db_conn_mgr_.get_or_block() };
+        tx.exec(
+            "create table if not exists bserv_session ("
+            "session_key varchar(64) primary key, "
+            "data text not null, "
+            "version bigint not null, "
+            "expiry bigint not null)");
+        tx.exec(
+            "create index if not exists bserv_session_expiry "
+            "on bserv_session (expiry)");
+        tx.commit();
+    }
+
+    session_load_result db_session_store::load(
+        std::string_view key, std::uint64_t version,
+        stored_session& session) {
+        if (key.size() > MAX_KEY_SIZE) return session_load_result::missing;
+        db_transaction tx{ db_conn_mgr_.get_or_block() };
+        db_result r = tx.exec(
+            "select version, expiry, "
+            "case when version = ? then null else data end "
+            "from bserv_session where session_key = ?",
+            (std::int64_t)version, std::string{ key });
+        tx.commit();
+        for (const auto& row : r) {
+            session.expiry = row[1].as<std::int64_t>();
+            if (row[2].is_null()) return session_load_result::unchanged;
+            session.version = (std::uint64_t)row[0].as<std::int64_t>();
+            session.data = row[2].c_str();
+            return session_load_result::loaded;
+        }
+        return session_load_result::missing;
+    }
+
+    std::uint64_t db_session_store::save(
+        std::string_view key, const std::string& data, std::int64_t expiry) {
+        if (key.size() > MAX_KEY_SIZE) return 0;
+        db_transaction tx{ db_conn_mgr_.get_or_block() };
+        db_result r = tx.exec(
+            "insert into bserv_session (session_key, data, version, expiry) "
+            "values (?, ?, 1, ?) "
+            "on conflict (session_key) do update set "
+            "data = excluded.data, "
+            "version = bserv_session.version + 1, "
+            "expiry = greatest(bserv_session.expiry, excluded.expiry) "
+            "returning version",
+            std::string{ key }, data, expiry);
+        tx.commit();
+        for (const auto& row : r)
+            return (std::uint64_t)row[0].as<std::int64_t>();
+        return 0;
+    }
+
+    void db_session_store::touch(
+        const std::vector<std::pair<std::string, std::int64_t>>& expiries) {
+        std::vector<std::string> keys;
+        std::vector<std::int64_t> values;
+        keys.reserve(expiries.size());
+        values.reserve(expiries.size());
+        for (auto& [key, expiry] : expiries) {
+            keys.push_back(key);
+            values.push_back(expiry);
+        }
+        db_transaction tx{ db_conn_mgr_.get_or_block() };
+        tx.exec(
+            "update bserv_session "
+            "set expiry = greatest(bserv_session.expiry, t.expiry) "
+            "from unnest(?::varchar[], ?::bigint[]) as t(session_key, expiry) "
+            "where bserv_session.session_key = t.session_key",
+            keys, values);
+        tx.commit();
+    }
+
+    void db_session_store::remove_expired(std::int64_t now) {
+        db_transaction tx{ db_conn_mgr_.get_or_block() };
+        tx.exec("delete from bserv_session where expiry < ?", now);
+        tx.commit();
+    }
+
+    // **************************************************************************
+
+    persistent_session_manager::persistent_session_manager(
+        std::shared_ptr<session_store> store,
+        std::chrono::seconds expiry_time,
+        std::chrono::milliseconds revalidate_time,
+        std::size_t num_shards)
+        : store_{ std::move(store) },
+        expiry_time_{ expiry_time },
+        revalidate_time_{ revalidate_time },
+        next_removal_{ 0 },
+        next_eviction_{ 0 },
+        stopped_{ false },
+        pending_{ false } {
+        std::size_t n = 1;
+        while (n < num_shards) n *= 2;
+        shard_mask_ = n - 1;
+        shards_ = std::make_unique<shard[]>(n);
+        writer_ = std::thread{ [this] { run(); } };
+    }
+
+    persistent_session_manager::~persistent_session_manager() {
+        {
+            std::lock_guard<std::mutex> lg{ writer_lock_ };
+            stopped_ = true;
+        }
+        cv_.notify_one();
+        writer_.join();
+    }
+
+    void persistent_session_manager::run() {
+        std::unique_lock<std::mutex> lock{ writer_lock_ };
+        auto next_tick = std::chrono::steady_clock::now() + SESSION_EXPIRY_TICK;
+        while (true) {
+            cv_.wait_until(lock, next_tick, [this] { return stopped_ || pending_; });
+            if (stopped_) break;
+            pending_ = false;
+            bool tick = std::chrono::steady_clock::now() >= next_tick;
+            if (tick) next_tick = std::chrono::steady_clock::now() + SESSION_EXPIRY_TICK;
+            lock.unlock();
+            std::int64_t now = unix_time();
+            try {
+                if (tick) flush();
+                else save_dirty();
+                revalidate_stale();
+            }
+            catch (const std::exception& e) {
+                lgerror << "persistent_session_manager: flush failed: " << e.what();
+            }
+            if (tick && now >= next_removal_) {
+                next_removal_ = now + SESSION_REMOVAL_INTERVAL;
+                try {
+                    store_->remove_expired(now);
+                }
+                catch (const std::exception& e) {
+                    lgerror << "persistent_session_manager: removal failed: " << e.what();
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    void persistent_session_manager::wake_writer() {
+        {
+            std::lock_guard<std::mutex> lg{ writer_lock_ };
+            pending_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    persistent_session_manager::shard&
+        persistent_session_manager::get_shard(std::string_view key) {
+        return shards_[session_internal::hash_session_id(key) & shard_mask_];
+    }
+
+    void persistent_session_manager::touch(
+        shard& s, const std::string& key,
+        cache_entry& entry, std::int64_t now) {
+        entry.expiry = now + expiry_time_.count();
+        if (!entry.touched) {
+            entry.touched = true;
+            s.touched_.push_back(key);
+        }
+    }
+
+    void persistent_session_manager::mark_dirty(
+        shard& s, const std::string& key, cache_entry& entry) {
+        if (!entry.dirty) {
+            entry.dirty = true;
+            s.dirty_.push_back(key);
+        }
+    }
+
+    bool persistent_session_manager::get_or_create(
+        std::string& key,
+        std::shared_ptr<session_type>& session_ptr) {
+        if (try_get(key, session_ptr)) return false;
+        std::int64_t expiry = unix_time() + expiry_time_.count();
+        std::string data = "{}";
+        session_ptr = std::make_shared<session_type>();
+        key = utils::generate_random_string(32);
+        // the new session is saved by the writer, so that the other processes
+        // know it. until then (or if it cannot be saved) it is only kept here.
+        {
+            shard& s = get_shard(key);
+            std::lock_guard<std::mutex> lg{ s.lock_ };
+            cache_entry& entry = s.entries_[key] = cache_entry{
+                session_ptr, std::move(data), 0, expiry, false,
+                std::chrono::steady_clock::now(), false, false };
+            mark_dirty(s, key, entry);
+        }
+        wake_writer();
+        return true;
+    }
+
+    bool persistent_session_manager::try_get(
+        std::string_view key,
+        std::shared_ptr<session_type>& session_ptr) {
+        if (key.empty()) return false;
+        shard& s = get_shard(key);
+        std::string cache_key{ key };
+        while (true) {
+            std::uint64_t version = 0;
+            std::int64_t local_expiry = 0;
+            {
+                std::lock_guard<std::mutex> lg{ s.lock_ };
+                auto it = s.entries_.find(cache_key);
+                if (it != s.entries_.end()) {
+                    cache_entry& entry = it->second;
+                    // the session is not in the store
+                    if (entry.version == 0) {
+                        std::int64_t now = unix_time();
+                        if (entry.expiry < now) {
+                            s.entries_.erase(it);
+                            return false;
+                        }
+                        entry.expiry = now + expiry_time_.count();
+                        session_ptr = entry.session;
+                        return true;
+                    }
+                    // the entry is used as it is, unless it seems expired
+                    // here (the other processes may have extended it).
+                    // it is revalidated by the writer if it is not recent
+                    // enough, or before it is used if `revalidate_time_` is 0.
+                    // the changes which are not written yet are kept.
+                    std::int64_t now = unix_time();
+                    if (entry.dirty || (entry.expiry >= now
+                        && revalidate_time_ != std::chrono::milliseconds::zero())) {
+                        if (!entry.dirty && !entry.stale
+                            && std::chrono::steady_clock::now() - entry.validated >= revalidate_time_) {
+                            entry.stale = true;
+                            s.stale_.push_back(cache_key);
+                            // the writer never waits for a shard while it
+                            // holds `writer_lock_`
+                            wake_writer();
+                        }
+                        touch(s, cache_key, entry, now);
+                        session_ptr = entry.session;
+                        return true;
+                    }
+                    version = entry.version;
+                    local_expiry = entry.expiry;
+                }
+            }
+            stored_session stored;
+            session_load_result result = store_->load(key, version, stored);
+            auto validated = std::chrono::steady_clock::now();
+            std::int64_t now = unix_time();
+            std::lock_guard<std::mutex> lg{ s.lock_ };
+            auto it = s.entries_.find(cache_key);
+            // the entry has been changed in the meantime, and the changes
+            // are to be written back
+            if (it != s.entries_.end() && it->second.dirty) continue;
+            // the local expiry may not have been written back yet
+            if (result == session_load_result::missing
+                || std::max(stored.expiry, local_expiry) < now) {
+                if (it != s.entries_.end()) s.entries_.erase(it);
+                return false;
+            }
+            if (result == session_load_result::unchanged) {
+                // the entry has been removed or reloaded in the meantime
+                if (it == s.entries_.end() || it->second.version != version)
+                    continue;
+            }
+            else {
+                auto session = std::make_shared<session_type>();
+                try {
+                    session->from_json(boost::json::parse(stored.data).as_object());
+                }
+                catch (const std::exception& e) {
+                    lgerror << "persistent_session_manager: invalid session: " << e.what();
+                    if (it != s.entries_.end()) s.entries_.erase(it);
+                    return false;
+                }
+                if (it == s.entries_.end())
+                    it = s.entries_.emplace(cache_key, cache_entry{}).first;
+                it->second.session = std::move(session);
+                it->second.data = std::move(stored.data);
+                it->second.version = stored.version;
+            }
+            cache_entry& entry = it->second;
+            entry.validated = validated;
+            touch(s, cache_key, entry, now);
+            session_ptr = entry.session;
+            return true;
+        }
+    }
+
+    void persistent_session_manager::commit(
+        std::string_view key,
+        const std::shared_ptr<session_type>& session_ptr) {
+        shard& s = get_shard(key);
+        std::string cache_key{ key };
+        std::string data = boost::json::serialize(session_ptr->to_json());
+        {
+            std::lock_guard<std::mutex> lg{ s.lock_ };
+            auto it = s.entries_.find(cache_key);
+            if (it == s.entries_.end() || it->second.data == data) return;
+            cache_entry& entry = it->second;
+            // if the session has been reloaded in the meantime, the changes
+            // of this request replace it (as they do in the store).
+            entry.session = session_ptr;
+            entry.data = std::move(data);
+            mark_dirty(s, cache_key, entry);
+        }
+        wake_writer();
+    }
+
+    void persistent_session_manager::save_dirty() {
+        struct pending_save {
+            std::string key;
+            std::string data;
+            std::int64_t expiry;
+            std::shared_ptr<session_type> session;
+        };
+        std::vector<pending_save> saves;
+        for (std::size_t i = 0; i <= shard_mask_; ++i) {
+            shard& s = shards_[i];
+            saves.clear();
+            {
+                std::lock_guard<std::mutex> lg{ s.lock_ };
+                for (auto& key : s.dirty_) {
+                    auto it = s.entries_.find(key);
+                    if (it == s.entries_.end() || !it->second.dirty) continue;
+                    cache_entry& entry = it->second;
+                    entry.dirty = false;
+                    saves.push_back({ std::move(key), entry.data, entry.expiry, entry.session });
+                }
+                s.dirty_.clear();
+            }
+            for (auto& save : saves) {
+                std::uint64_t version;
+                try {
+                    version = store_->save(save.key, save.data, save.expiry);
+                }
+                catch (const std::exception& e) {
+                    lgerror << "persistent_session_manager: save failed: " << e.what();
+                    // it is retried on the next flush
+                    std::lock_guard<std::mutex> lg{ s.lock_ };
+                    auto it = s.entries_.find(save.key);
+                    if (it != s.entries_.end()) mark_dirty(s, save.key, it->second);
+                    continue;
+                }
+                auto validated = std::chrono::steady_clock::now();
+                std::lock_guard<std::mutex> lg{ s.lock_ };
+                auto it = s.entries_.find(save.key);
+                if (it == s.entries_.end()) continue;
+                if (it->second.session == save.session) {
+                    it->second.version = version;
+                    it->second.validated = validated;
+                }
+                // the session has been reloaded in the meantime,
+                // so it will be loaded again on the next lookup.
+                else if (!it->second.dirty) s.entries_.erase(it);
+            }
+        }
+    }
+
+    void persistent_session_manager::revalidate_stale() {
+        std::vector<std::string> keys;
+        for (std::size_t i = 0; i <= shard_mask_; ++i) {
+            shard& s = shards_[i];
+            {
+                std::lock_guard<std::mutex> lg{ s.lock_ };
+                keys.swap(s.stale_);
+                s.stale_.clear();
+            }
+            for (auto& key : keys) {
+                std::uint64_t version;
+                std::int64_t local_expiry;
+                {
+                    std::lock_guard<std::mutex> lg{ s.lock_ };
+                    auto it = s.entries_.find(key);
+                    if (it == s.entries_.end() || !it->second.stale) continue;
+                    it->second.stale = false;
+                    if (it->second.dirty) continue;
+                    version = it->second.version;
+                    local_expiry = it->second.expiry;
+                }
+                stored_session stored;
+                session_load_result result;
+                try {
+                    result = store_->load(key, version, stored);
+                }
+                catch (const std::exception& e) {
+                    // it is queued again on the next lookup
+                    lgerror << "persistent_session_manager: revalidation failed: " << e.what();
+                    continue;
+                }
+                auto validated = std::chrono::steady_clock::now();
+                std::int64_t now = unix_time();
+                std::lock_guard<std::mutex> lg{ s.lock_ };
+                auto it = s.entries_.find(key);
+                // the entry has been changed or reloaded in the meantime
+                if (it == s.entries_.end() || it->second.dirty
+                    || it->second.version != version) continue;
+                cache_entry& entry = it->second;
+                if (result == session_load_result::missing
+                    || std::max({ stored.expiry, local_expiry, entry.expiry }) < now) {
+                    s.entries_.erase(it);
+                    continue;
+                }
+                if (result == session_load_result::loaded) {
+                    auto session = std::make_shared<session_type>();
+                    try {
+                        session->from_json(boost::json::parse(stored.data).as_object());
+                    }
+                    catch (const std::exception& e) {
+                        lgerror << "persistent_session_manager: invalid session: " << e.what();
+                        s.entries_.erase(it);
+                        continue;
+                    }
+                    entry.session = std::move(session);
+                    entry.data = std::move(stored.data);
+                    entry.version = stored.version;
+                }
+                entry.validated = validated;
+            }
+            keys.clear();
+        }
+    }
+
+    void persistent_session_manager::flush() {
+        save_dirty();
+        std::vector<std::pair<std::string, std::int64_t>> expiries;
+        for (std::size_t i = 0; i <= shard_mask_; ++i) {
+            shard& s = shards_[i];
+            std::lock_guard<std::mutex> lg{ s.lock_ };
+            for (auto& key : s.touched_) {
+                auto it = s.entries_.find(key);
+                if (it == s.entries_.end() || !it->second.touched) continue;
+                it->second.touched = false;
+                expiries.emplace_back(std::move(key), it->second.expiry);
+            }
+            s.touched_.clear();
+        }
+        if (!expiries.empty()) store_->touch(expiries);
+    }
+
+    void persistent_session_manager::collect_expired() {
+        std::int64_t now = unix_time();
+        if (now < next_eviction_) return;
+        next_eviction_ = now + SESSION_REMOVAL_INTERVAL;
+        // the sessions which have not been used here until they expire
+        // are removed from the cache (they may have been used elsewhere).
+        for (std::size_t i = 0; i <= shard_mask_; ++i) {
+            shard& s = shards_[i];
+            std::lock_guard<std::mutex> lg{ s.lock_ };
+            for (auto it = s.entries_.begin(); it != s.entries_.end();) {
+                if (it->second.expiry < now) it = s.entries_.erase(it);
+                else ++it;
+            }
+        }
+    }
+
+}  // bserv
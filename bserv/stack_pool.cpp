@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "bserv/stack_pool.hpp"
+
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "bserv/config.hpp"
+
+namespace bserv {
+
+    namespace {
+
+        std::size_t page_size() {
+#ifdef _WIN32
+            static const std::size_t size = [] {
+                SYSTEM_INFO info;
+                GetSystemInfo(&info);
+                return static_cast<std::size_t>(info.dwPageSize);
+            }();
+#else
+            static const std::size_t size =
+                static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+            return size;
+        }
+
+        // maps `size` bytes, the lowest page of which is the guard page
+        void* map_stack(std::size_t size) {
+#ifdef _WIN32
+            // the stack is only reserved, and its top page is committed.
+            // the page below the committed ones is a `PAGE_GUARD` page:
+            // touching it commits it and moves the guard page down, as for
+            // the stacks of threads. the lowest page is never committed.
+            const std::size_t page = page_size();
+            void* limit = VirtualAlloc(
+                nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+            if (limit == nullptr) throw std::bad_alloc{};
+            char* top = static_cast<char*>(limit) + size;
+            if (VirtualAlloc(top - page, page, MEM_COMMIT, PAGE_READWRITE) == nullptr
+                || (size > 2 * page && VirtualAlloc(top - 2 * page, page,
+                    MEM_COMMIT, PAGE_READWRITE | PAGE_GUARD) == nullptr)) {
+                VirtualFree(limit, 0, MEM_RELEASE);
+                throw std::bad_alloc{};
+            }
+#else
+            void* limit = mmap(
+                nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (limit == MAP_FAILED) throw std::bad_alloc{};
+            if (mprotect(limit, page_size(), PROT_NONE) != 0) {
+                munmap(limit, size);
+                throw std::bad_alloc{};
+            }
+#endif
+            return limit;
+        }
+
+        void unmap_stack(void* limit, std::size_t size) {
+#ifdef _WIN32
+            boost::ignore_unused(size);
+            VirtualFree(limit, 0, MEM_RELEASE);
+#else
+            munmap(limit, size);
+#endif
+        }
+
+    }  // namespace
+
+    stack_pool::~stack_pool() {
+        for (auto& s : free_) unmap_stack(s.limit, s.size);
+    }
+
+    stack_pool& stack_pool::local() {
+        thread_local stack_pool pool;
+        return pool;
+    }
+
+    void* stack_pool::allocate(std::size_t& size) {
+        const std::size_t page = page_size();
+        // whole pages, plus the guard page
+        const std::size_t mapped = (size + page - 1) / page * page + page;
+        stack s{ nullptr, mapped };
+        // the stacks in the pool usually have the same size,
+        // as they are allocated for the same server
+        while (!free_.empty()) {
+            stack top = free_.back();
+            free_.pop_back();
+            if (top.size == mapped) {
+                s = top;
+                break;
+            }
+            unmap_stack(top.limit, top.size);
+        }
+        if (s.limit == nullptr) s.limit = map_stack(mapped);
+        size = mapped - page;
+        return static_cast<char*>(s.limit) + mapped;
+    }
+
+    void stack_pool::deallocate(void* sp, std::size_t size) {
+        const std::size_t mapped = size + page_size();
+        void* limit = static_cast<char*>(sp) - mapped;
+        if (free_.size() < STACK_POOL_SIZE)
+            free_.push_back({ limit, mapped });
+        else unmap_stack(limit, mapped);
+    }
+
+}  // bserv
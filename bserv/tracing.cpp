@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "bserv/tracing.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#include "bserv/config.hpp"
+
+namespace bserv {
+
+    namespace {
+
+        using clock = std::chrono::steady_clock;
+
+        std::atomic<std::size_t> capacity_{ 0 };
+        std::atomic<std::uint64_t> next_trace_{ 1 };
+        const clock::time_point epoch_ = clock::now();
+
+        thread_local std::uint64_t current_trace_ = 0;
+        thread_local clock::duration* current_db_time_ = nullptr;
+
+        std::uint32_t this_thread_index() {
+            static std::atomic<std::uint32_t> next{ 0 };
+            thread_local const std::uint32_t index =
+                next.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+
+        // the spans of the threads which map to it. it is locked by
+        // its threads (without contention) and by the exporter.
+        struct alignas(64) ring {
+            std::mutex lock;
+            std::vector<trace_event> events;
+            std::size_t next = 0;
+        };
+
+        std::array<ring, METRICS_SHARDS> rings_;
+
+        double to_us(clock::duration d) {
+            return std::chrono::duration<double, std::micro>(d).count();
+        }
+
+        void append_escaped(std::string& out, const std::string& s) {
+            for (char c : s) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20) out += ' ';
+                else out += c;
+            }
+        }
+
+    }  // namespace
+
+    void enable_tracing(std::size_t capacity) {
+        capacity_ = capacity;
+    }
+
+    std::uint64_t new_trace_id() {
+        if (capacity_.load(std::memory_order_relaxed) == 0) return 0;
+        return next_trace_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::uint64_t current_trace() {
+        return current_trace_;
+    }
+
+    void add_db_time(clock::duration d) {
+        if (current_db_time_ != nullptr) *current_db_time_ += d;
+    }
+
+    void record_span(
+        const char* name, std::uint64_t trace,
+        clock::time_point start, clock::time_point end,
+        std::string detail) {
+        std::size_t capacity = capacity_.load(std::memory_order_relaxed);
+        if (trace == 0 || capacity == 0) return;
+        std::uint32_t thread = this_thread_index();
+        ring& r = rings_[thread % METRICS_SHARDS];
+        std::lock_guard<std::mutex> lg{ r.lock };
+        trace_event event{ trace, name, std::move(detail), start, end - start, thread };
+        if (r.events.size() < capacity) r.events.push_back(std::move(event));
+        else {
+            r.events[r.next % r.events.size()] = std::move(event);
+            ++r.next;
+        }
+    }
+
+    std::vector<trace_event> recorded_spans() {
+        std::vector<trace_event> events;
+        for (ring& r : rings_) {
+            std::lock_guard<std::mutex> lg{ r.lock };
+            events.insert(events.end(), r.events.begin(), r.events.end());
+        }
+        std::sort(events.begin(), events.end(),
+            [](const trace_event& a, const trace_event& b) {
+                return a.start < b.start;
+            });
+        return events;
+    }
+
+    std::string format_chrome_trace() {
+        std::vector<trace_event> events = recorded_spans();
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for (const trace_event& e : events) {
+            if (!first) out += ',';
+            first = false;
+            std::ostringstream event;
+            event.precision(3);
+            event << std::fixed
+                << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << e.trace
+                << ",\"ts\":" << to_us(e.start - epoch_)
+                << ",\"dur\":" << to_us(e.duration)
+                << ",\"name\":\"" << e.name
+                << "\",\"args\":{\"thread\":" << e.thread;
+            out += event.str();
+            if (!e.detail.empty()) {
+                out += ",\"detail\":\"";
+                append_escaped(out, e.detail);
+                out += '"';
+            }
+            out += "}}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    bool write_chrome_trace(const std::string& path) {
+        std::ofstream file{ path, std::ios::binary };
+        if (!file) return false;
+        file << format_chrome_trace();
+        return static_cast<bool>(file);
+    }
+
+    std::nullopt_t serve_trace(
+        http::response<http::string_body>& response) {
+        response.set(http::field::content_type, "application/json");
+        response.body() = format_chrome_trace();
+        response.prepare_payload();
+        return std::nullopt;
+    }
+
+    trace_scope::trace_scope(std::uint64_t trace, clock::duration* db_time)
+        : previous_{ current_trace_ }, previous_db_time_{ current_db_time_ } {
+        current_trace_ = trace;
+        current_db_time_ = db_time;
+    }
+
+    trace_scope::~trace_scope() {
+        current_trace_ = previous_;
+        current_db_time_ = previous_db_time_;
+    }
+
+    trace_guard::trace_guard()
+        : trace_{ current_trace_ }, db_time_{ current_db_time_ } {
+        current_trace_ = 0;
+        current_db_time_ = nullptr;
+    }
+
+    trace_guard::~trace_guard() {
+        current_trace_ = trace_;
+        current_db_time_ = db_time_;
+    }
+
+}  // bserv
@@ -2,33 +2,93 @@
 #include "bserv/utils.hpp"
 #include "bserv/router.hpp"
 
-#include <mutex>
-#include <sstream>
-#include <iomanip>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
 #include <fstream>
 
+#ifdef __linux__
+#include <sys/random.h>
+#include <cerrno>
+#endif
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BSERV_HAS_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/pwdbased.h>
 #include <cryptopp/sha.h>
 #include <cryptopp/base64.h>
+#include <cryptopp/osrng.h>
 
 namespace bserv::utils {
 
 	namespace internal {
 
-		// NOTE:
-		// - `random_device` is implementation dependent.
-		//   it doesn't work with GNU GCC on Windows.
-		// - for thread-safety, do not directly use it.
-		//   use `get_rd_value` instead.
-		std::random_device rd;
-		std::mutex rd_mutex;
-
-		std::random_device::result_type get_rd_value() {
-			std::lock_guard<std::mutex> lg{ rd_mutex };
-			return rd();
+		// fills `buf` with cryptographically secure random bytes from the OS.
+		// NOTE: `getrandom` (without flags) only blocks until the kernel's
+		//       pool is initialized at boot. where it is unavailable,
+		//       `OS_GenerateRandomBlock` reads `/dev/urandom` (or uses the
+		//       system's generator on Windows).
+		void fill_random_bytes(unsigned char* buf, std::size_t size) {
+#ifdef __linux__
+			while (size > 0) {
+				ssize_t n = getrandom(buf, size, 0);
+				if (n < 0) {
+					if (errno == EINTR) continue;
+					// e.g. `ENOSYS` on old kernels
+					break;
+				}
+				buf += n;
+				size -= (std::size_t)n;
+			}
+			if (size == 0) return;
+#endif
+			CryptoPP::OS_GenerateRandomBlock(false, buf, size);
 		}
 
+		// it is increased in the child process after `fork`,
+		// so that the child does not reuse the parent's random bytes.
+		std::atomic<unsigned> fork_generation{ 0 };
+
+#ifndef _WIN32
+		const int fork_handler_registered = pthread_atfork(
+			nullptr, nullptr, [] { fork_generation.fetch_add(1); });
+#endif
+
+		// the random bytes are taken from the OS in batches,
+		// and each thread has its own batch, so that no lock is needed.
+		class random_bytes {
+		private:
+			static constexpr std::size_t BATCH_SIZE = 256;
+			std::array<unsigned char, BATCH_SIZE> bytes_;
+			std::size_t pos_;
+			unsigned generation_;
+		public:
+			random_bytes() : pos_{ BATCH_SIZE }, generation_{ 0 } {}
+			unsigned char next() {
+				unsigned generation = fork_generation.load(std::memory_order_relaxed);
+				if (pos_ == BATCH_SIZE || generation_ != generation) {
+					fill_random_bytes(bytes_.data(), BATCH_SIZE);
+					pos_ = 0;
+					generation_ = generation;
+				}
+				return bytes_[pos_++];
+			}
+		};
+
 		// const std::string chars = "abcdefghijklmnopqrstuvwxyz"
 		//                           "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 		//                           "1234567890"
@@ -39,19 +99,29 @@ namespace bserv::utils {
 			"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 			"1234567890";
 
-
-		const std::string url_safe_characters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-			"abcdefghijklmnopqrstuvwxyz"
-			"0123456789-._~";
+		inline int count_trailing_zeros(unsigned mask) {
+#ifdef _MSC_VER
+			unsigned long idx;
+			_BitScanForward(&idx, mask);
+			return (int)idx;
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
 
 	}  // internal
 
-	// https://www.boost.org/doc/libs/1_75_0/libs/random/example/password.cpp
 	std::string generate_random_string(std::size_t len) {
-		std::string s;
-		std::mt19937 rng{ internal::get_rd_value() };
-		std::uniform_int_distribution<> dist{ 0, (int)internal::chars.length() - 1 };
-		for (std::size_t i = 0; i < len; ++i) s += internal::chars[dist(rng)];
+		thread_local internal::random_bytes bytes;
+		// the bytes not less than `limit` are rejected,
+		// so that the characters are uniformly distributed.
+		const unsigned limit = 256 - 256 % internal::chars.length();
+		std::string s(len, '\0');
+		for (auto& c : s) {
+			unsigned char b;
+			do b = bytes.next(); while (b >= limit);
+			c = internal::chars[b % internal::chars.length()];
+		}
 		return s;
 	}
 
@@ -122,66 +192,234 @@ namespace bserv::utils {
 
 	// unreserved  = ALPHA / DIGIT / "-" / "." / "_" / "~"
 
-	// https://stackoverflow.com/questions/54060359/encoding-decoded-urls-in-c
-	// there can be exceptions (std::stoi)!
-	std::string decode_url(const std::string& s) {
-		std::string r;
-		for (std::size_t i = 0; i < s.length(); ++i) {
-			if (s[i] == '%') {
-				int v = std::stoi(s.substr(i + 1, 2), nullptr, 16);
-				r.push_back(0xff & v);
-				i += 2;
+	namespace internal {
+
+		// `hex_values[c]` is the value of the hexadecimal digit `c`,
+		// or -1 if `c` is not a hexadecimal digit.
+		constexpr std::array<signed char, 256> make_hex_values() {
+			std::array<signed char, 256> values{};
+			for (int c = 0; c < 256; ++c) {
+				if (c >= '0' && c <= '9') values[c] = (signed char)(c - '0');
+				else if (c >= 'a' && c <= 'f') values[c] = (signed char)(c - 'a' + 10);
+				else if (c >= 'A' && c <= 'F') values[c] = (signed char)(c - 'A' + 10);
+				else values[c] = -1;
+			}
+			return values;
+		}
+
+		constexpr std::array<signed char, 256> hex_values = make_hex_values();
+
+		// `url_safe[c]` is true if `c` is one of
+		// "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		// "abcdefghijklmnopqrstuvwxyz"
+		// "0123456789-._~"
+		constexpr std::array<bool, 256> make_url_safe() {
+			std::array<bool, 256> safe{};
+			for (int c = 0; c < 256; ++c) {
+				safe[c] = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
+					|| (c >= '0' && c <= '9')
+					|| c == '-' || c == '.' || c == '_' || c == '~';
 			}
-			else if (s[i] == '+') r.push_back(' ');
-			else r.push_back(s[i]);
+			return safe;
 		}
+
+		constexpr std::array<bool, 256> url_safe = make_url_safe();
+
+		const char hex_digits[] = "0123456789ABCDEF";
+
+		// returns a pointer to the first character in [first, last)
+		// which is equal to `a` or `b`, or `last` if there is none.
+		// 32 (AVX2) or 16 (SSE2) characters are compared at a time,
+		// the remaining ones are compared one by one.
+		const char* find_either(
+			const char* first, const char* last, char a, char b) {
+#if defined(__AVX2__)
+			const __m256i va32 = _mm256_set1_epi8(a);
+			const __m256i vb32 = _mm256_set1_epi8(b);
+			for (; last - first >= 32; first += 32) {
+				__m256i chunk = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(first));
+				unsigned mask = (unsigned)_mm256_movemask_epi8(
+					_mm256_or_si256(
+						_mm256_cmpeq_epi8(chunk, va32),
+						_mm256_cmpeq_epi8(chunk, vb32)));
+				if (mask != 0) return first + count_trailing_zeros(mask);
+			}
+#endif
+#if defined(BSERV_HAS_SSE2)
+			const __m128i va16 = _mm_set1_epi8(a);
+			const __m128i vb16 = _mm_set1_epi8(b);
+			for (; last - first >= 16; first += 16) {
+				__m128i chunk = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first));
+				unsigned mask = (unsigned)_mm_movemask_epi8(
+					_mm_or_si128(
+						_mm_cmpeq_epi8(chunk, va16),
+						_mm_cmpeq_epi8(chunk, vb16)));
+				if (mask != 0) return first + count_trailing_zeros(mask);
+			}
+#endif
+			for (; first != last; ++first)
+				if (*first == a || *first == b) return first;
+			return last;
+		}
+
+		// returns a pointer to the first character in [first, last)
+		// which is not url safe, or `last` if there is none.
+		const char* find_url_unsafe(const char* first, const char* last) {
+#if defined(BSERV_HAS_SSE2)
+			// a character is url safe if it is in one of the ranges
+			// [0-9], [A-Z], [a-z] or it is one of "-._~".
+			// the signed comparisons also reject bytes >= 0x80.
+			const auto in_range = [](__m128i chunk, char lo, char hi) {
+				return _mm_and_si128(
+					_mm_cmpgt_epi8(chunk, _mm_set1_epi8((char)(lo - 1))),
+					_mm_cmplt_epi8(chunk, _mm_set1_epi8((char)(hi + 1))));
+			};
+			for (; last - first >= 16; first += 16) {
+				__m128i chunk = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first));
+				__m128i safe = _mm_or_si128(
+					_mm_or_si128(
+						in_range(chunk, '0', '9'),
+						in_range(chunk, 'A', 'Z')),
+					_mm_or_si128(
+						in_range(chunk, 'a', 'z'),
+						_mm_or_si128(
+							_mm_or_si128(
+								_mm_cmpeq_epi8(chunk, _mm_set1_epi8('-')),
+								_mm_cmpeq_epi8(chunk, _mm_set1_epi8('.'))),
+							_mm_or_si128(
+								_mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')),
+								_mm_cmpeq_epi8(chunk, _mm_set1_epi8('~'))))));
+				unsigned mask = ~(unsigned)_mm_movemask_epi8(safe) & 0xffffu;
+				if (mask != 0) return first + count_trailing_zeros(mask);
+			}
+#endif
+			for (; first != last; ++first)
+				if (!url_safe[(unsigned char)*first]) return first;
+			return last;
+		}
+
+		// appends the decoded [first, last) to `r`.
+		void decode_url_append(const char* first, const char* last, std::string& r) {
+			while (first != last) {
+				const char* special = find_either(first, last, '%', '+');
+				r.append(first, special);
+				if (special == last) break;
+				if (*special == '+') {
+					r.push_back(' ');
+					first = special + 1;
+					continue;
+				}
+				// behaves like `std::stoi(s.substr(i + 1, 2), nullptr, 16)`,
+				// except that signs and spaces are not accepted:
+				// at least one hexadecimal digit is required,
+				// and the two characters after '%' are always consumed.
+				int hi = special + 1 < last ? hex_values[(unsigned char)special[1]] : -1;
+				if (hi < 0) throw std::invalid_argument{ "decode_url: invalid percent-encoding" };
+				int lo = special + 2 < last ? hex_values[(unsigned char)special[2]] : -1;
+				r.push_back((char)(lo < 0 ? hi : (hi << 4 | lo)));
+				first = special + 3 < last ? special + 3 : last;
+			}
+		}
+
+		bool need_decoding(const char* first, const char* last) {
+			return find_either(first, last, '%', '+') != last;
+		}
+
+	}  // internal
+
+	// there can be exceptions (std::invalid_argument)!
+	std::string decode_url(const std::string& s) {
+		const char* first = s.data();
+		const char* last = first + s.length();
+		if (!internal::need_decoding(first, last)) return s;
+		std::string r;
+		r.reserve(s.length());
+		internal::decode_url_append(first, last, r);
 		return r;
 	}
 
 	std::string encode_url(const std::string& s) {
-		std::ostringstream oss;
-		for (auto& c : s) {
-			if (internal::url_safe_characters.find(c) != std::string::npos) {
-				oss << c;
-			}
-			else {
-				oss << '%' << std::setfill('0') << std::setw(2) <<
-					std::uppercase << std::hex << (0xff & c);
-			}
+		const char* first = s.data();
+		const char* last = first + s.length();
+		std::string r;
+		// in the worst case, every character is percent-encoded
+		r.reserve(3 * s.length());
+		while (first != last) {
+			const char* unsafe = internal::find_url_unsafe(first, last);
+			r.append(first, unsafe);
+			if (unsafe == last) break;
+			unsigned char c = (unsigned char)*unsafe;
+			char encoded[3] = { '%', internal::hex_digits[c >> 4], internal::hex_digits[c & 0xf] };
+			r.append(encoded, 3);
+			first = unsafe + 1;
 		}
-		return oss.str();
+		return r;
 	}
 
+	namespace internal {
+
+		// appends [first, last) to `buffer`, ignoring the leading ' '
+		// if `buffer` is empty.
+		void append_param_piece(
+			std::string& buffer, const char* first, const char* last) {
+			if (buffer.empty())
+				while (first != last && *first == ' ') ++first;
+			buffer.append(first, last);
+		}
+
+		void trim_param_back(std::string& buffer) {
+			std::size_t n = buffer.length();
+			while (n != 0 && buffer[n - 1] == ' ') --n;
+			buffer.resize(n);
+		}
+
+		void decode_param(std::string& buffer) {
+			if (need_decoding(buffer.data(), buffer.data() + buffer.length())) {
+				std::string decoded;
+				decoded.reserve(buffer.length());
+				decode_url_append(buffer.data(), buffer.data() + buffer.length(), decoded);
+				buffer.swap(decoded);
+			}
+		}
+
+	}  // internal
+
 	std::pair<
 		std::map<std::string, std::string>,
 		std::map<std::string, std::vector<std::string>>>
 		parse_params(std::string& s, std::size_t start_pos, char delimiter) {
 		std::map<std::string, std::string> dict_params;
 		std::map<std::string, std::vector<std::string>> list_params;
-		// we use the swap pointer technique
-		// we will always append characters to *a only.
-		std::string key, value, * a = &key, * b = &value;
-		// append an extra `delimiter` so that the last key-value pair
-		// is processed just like the other.
-		s.push_back(delimiter);
-		for (std::size_t i = start_pos; i < s.length(); ++i) {
-			if (s[i] == '=') {
+		std::string key, value;
+		const char* first = s.data() + (std::min)(start_pos, s.length());
+		const char* last = s.data() + s.length();
+		while (true) {
+			// [first, end) is the current `key=value` pair
+			const char* end = internal::find_either(first, last, delimiter, delimiter);
+			// we use the swap pointer technique:
+			// the characters are appended to *a only,
+			// and `a`, `b` are swapped at every '='.
+			std::string* a = &key, * b = &value;
+			for (const char* piece = first; ;) {
+				const char* eq = internal::find_either(piece, end, '=', '=');
+				internal::append_param_piece(*a, piece, eq);
+				if (eq == end) break;
 				std::swap(a, b);
+				piece = eq + 1;
 			}
-			else if (s[i] == delimiter) {
-				// swap(a, b);
-				a = &key;
-				b = &value;
-				// prevent ending with ' '
-				while (!key.empty() && key.back() == ' ') key.pop_back();
-				while (!value.empty() && value.back() == ' ') value.pop_back();
-				if (key.empty() && value.empty())
-					continue;
-				key = decode_url(key);
-				value = decode_url(value);
+			// prevent ending with ' '
+			internal::trim_param_back(key);
+			internal::trim_param_back(value);
+			if (!key.empty() || !value.empty()) {
+				internal::decode_param(key);
+				internal::decode_param(value);
 				// if `key` is in `list_params`, append `value`.
-				if (list_params.find(key) != list_params.end()) {
-					list_params[key].push_back(value);
+				auto l = list_params.find(key);
+				if (l != list_params.end()) {
+					l->second.push_back(std::move(value));
 				}
 				else { // `key` is not in `list_params`
 					auto p = dict_params.find(key);
@@ -189,50 +427,60 @@ namespace bserv::utils {
 					// move previous value and `value` to `list_params`
 					// and remove `key` in `dict_params`.
 					if (p != dict_params.end()) {
-						list_params[key] = { p->second, value };
+						list_params[key] = { std::move(p->second), std::move(value) };
 						dict_params.erase(p);
 					}
 					else { // `key` is not in `dict_params`
-						dict_params[key] = value;
+						dict_params.emplace(std::move(key), std::move(value));
 					}
 				}
 				// clear `key` and `value`
-				key = "";
-				value = "";
-			}
-			else {
-				// prevent beginning with ' '
-				if (a->empty() && s[i] == ' ') {
-					continue;
-				}
-				(*a) += s[i];
+				key.clear();
+				value.clear();
 			}
+			if (end == last) break;
+			first = end + 1;
 		}
-		// remove the last `delimiter` to restore `s` to what it was.
-		s.pop_back();
-		return std::make_pair(dict_params, list_params);
+		return std::make_pair(std::move(dict_params), std::move(list_params));
 	}
 
 	std::tuple<std::string,
 		std::map<std::string, std::string>,
 		std::map<std::string, std::vector<std::string>>>
 		parse_url(std::string& s) {
-		std::string url;
-		std::size_t i = 0;
-		for (; i < s.length(); ++i) {
-			if (s[i] != '?') {
-				url += s[i];
-			}
-			else {
-				break;
-			}
-		}
-		if (i == s.length())
-			return std::make_tuple(url,
+		std::size_t i = s.find('?');
+		if (i == std::string::npos)
+			return std::make_tuple(s,
 				std::map<std::string, std::string>{},
 				std::map<std::string, std::vector<std::string>>{});
 		auto&& [dict_params, list_params] = parse_params(s, i + 1);
-		return std::make_tuple(url, dict_params, list_params);
+		return std::make_tuple(s.substr(0, i),
+			std::move(dict_params), std::move(list_params));
+	}
+
+	namespace internal {
+
+		std::string_view trim_cookie_part(std::string_view s) {
+			while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+			while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+			return s;
+		}
+
+	}  // internal
+
+	std::optional<std::string_view> cookie_scanner::next() {
+		const char* last = header_.data() + header_.length();
+		while (pos_ < header_.length()) {
+			const char* first = header_.data() + pos_;
+			// [first, end) is the current `name=value` pair
+			const char* end = internal::find_either(first, last, ';', ';');
+			pos_ = end - header_.data() + 1;
+			const char* eq = internal::find_either(first, end, '=', '=');
+			if (eq == end) continue;
+			if (internal::trim_cookie_part({ first, (std::size_t)(eq - first) }) != name_) continue;
+			return internal::trim_cookie_part({ eq + 1, (std::size_t)(end - eq - 1) });
+		}
+		return std::nullopt;
 	}
 
 	namespace file {
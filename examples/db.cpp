@@ -29,18 +29,19 @@ std::optional<boost::json::value> get_or_empty(
 boost::json::object greet(
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	bserv::session_type& session = *session_ptr;
-	if (session.count("user")) {
-		boost::json::object& user = session["user"].as_object();
+	// `user_ptr` is a snapshot, which is not affected by the other requests
+	if (auto user_ptr = session.user()) {
+		const boost::json::object& user = user_ptr->object;
 		boost::json::object obj;
 		// the first way to check non-null (!= nullptr)
-		if (user["first_name"] != nullptr && user["last_name"] != nullptr) {
-			obj["welcome"] = std::string{ user["first_name"].as_string() }
-			+ ' ' + std::string{ user["last_name"].as_string() };
+		if (user.at("first_name") != nullptr && user.at("last_name") != nullptr) {
+			obj["welcome"] = std::string{ user.at("first_name").as_string() }
+			+ ' ' + std::string{ user.at("last_name").as_string() };
 		}
-		else obj["welcome"] = user["username"];
+		else obj["welcome"] = user_ptr->username;
 		// the second way (!is_null())
-		if (!user["email"].is_null()) {
-			obj["email"] = user["email"];
+		if (!user.at("email").is_null()) {
+			obj["email"] = user.at("email");
 		}
 		return obj;
 	}
@@ -139,7 +140,7 @@ boost::json::object user_login(
 		};
 	}
 	bserv::session_type& session = *session_ptr;
-	session["user"] = user;
+	session.set_user(std::make_shared<const bserv::session_user>(user));
 	return {
 		{"success", true},
 		{"message", "login successfully"}
@@ -148,8 +149,7 @@ boost::json::object user_login(
 boost::json::object user_logout(
 	std::shared_ptr<bserv::session_type> session_ptr) {
 	bserv::session_type& session = *session_ptr;
-	if (session.count("user"))
-		session.erase("user");
+	session.set_user(nullptr);
 	return {
 		{"success", true},
 		{"message", "logout successfully"}
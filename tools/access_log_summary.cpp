@@ -0,0 +1,153 @@
+// summarizes access logs (see `bserv/access_log.hpp`) by route: the
+// number of requests, their status codes, the percentiles of their
+// latency, the time spent in the database and the bytes transferred.
+// if the log is sampled, the counts are those of the sampled requests.
+//
+// Usage: access_log_summary [access log]...
+// (the log is read from stdin if no file is given)
+#include <boost/json.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+
+struct route_summary {
+	// in microseconds
+	std::vector<std::uint64_t> latencies;
+	// 1xx, 2xx, 3xx, 4xx, 5xx
+	std::uint64_t statuses[5]{};
+	std::uint64_t db_us = 0;
+	std::uint64_t bytes_in = 0;
+	std::uint64_t bytes_out = 0;
+	void add(const route_summary& other) {
+		latencies.insert(latencies.end(),
+			other.latencies.begin(), other.latencies.end());
+		for (int i = 0; i < 5; ++i) statuses[i] += other.statuses[i];
+		db_us += other.db_us;
+		bytes_in += other.bytes_in;
+		bytes_out += other.bytes_out;
+	}
+};
+
+struct log_summary {
+	std::map<std::string, route_summary> routes;
+	std::uint64_t first_ts = std::numeric_limits<std::uint64_t>::max();
+	std::uint64_t last_ts = 0;
+	std::uint64_t malformed = 0;
+	void add(const std::string& line) {
+		if (line.empty()) return;
+		try {
+			const boost::json::value value = boost::json::parse(line);
+			const boost::json::object& record = value.as_object();
+			const auto number = [&](const char* key) {
+				std::int64_t n = record.at(key).as_int64();
+				return n < 0 ? std::uint64_t{ 0 } : static_cast<std::uint64_t>(n);
+			};
+			std::uint64_t ts = number("ts");
+			std::uint64_t status = number("status");
+			route_summary& route = routes[std::string{ record.at("route").as_string().c_str() }];
+			route.latencies.push_back(number("us"));
+			if (status >= 100 && status < 600) ++route.statuses[status / 100 - 1];
+			route.db_us += number("db_us");
+			route.bytes_in += number("in");
+			route.bytes_out += number("out");
+			first_ts = std::min(first_ts, ts);
+			last_ts = std::max(last_ts, ts);
+		}
+		catch (const std::exception&) {
+			++malformed;
+		}
+	}
+};
+
+// in milliseconds
+double percentile(const std::vector<std::uint64_t>& sorted, double q) {
+	if (sorted.empty()) return 0;
+	std::size_t rank = static_cast<std::size_t>(std::ceil(q * sorted.size()));
+	return sorted[rank == 0 ? 0 : rank - 1] / 1000.0;
+}
+
+void print_row(const std::string& name, route_summary& route) {
+	std::sort(route.latencies.begin(), route.latencies.end());
+	std::size_t n = route.latencies.size();
+	std::uint64_t total_us = 0;
+	for (std::uint64_t us : route.latencies) total_us += us;
+	std::cout << std::left << std::setw(28) << name << std::right
+		<< std::setw(9) << n;
+	for (std::uint64_t count : route.statuses)
+		std::cout << std::setw(8) << count;
+	std::cout << std::fixed << std::setprecision(2)
+		<< std::setw(10) << total_us / 1000.0 / n
+		<< std::setw(10) << percentile(route.latencies, 0.5)
+		<< std::setw(10) << percentile(route.latencies, 0.99)
+		<< std::setw(10) << percentile(route.latencies, 0.999)
+		<< std::setw(10) << route.latencies.back() / 1000.0
+		<< std::setw(10) << route.db_us / 1000.0 / n
+		<< std::setw(7) << std::setprecision(0)
+		<< (total_us == 0 ? 0.0 : 100.0 * route.db_us / total_us) << '%'
+		<< std::setw(10) << route.bytes_in / n
+		<< std::setw(10) << route.bytes_out / n << '\n';
+}
+
+int main(int argc, char* argv[]) {
+	log_summary summary;
+	std::string line;
+	if (argc == 1) {
+		while (std::getline(std::cin, line)) summary.add(line);
+	}
+	for (int i = 1; i < argc; ++i) {
+		std::ifstream file{ argv[i] };
+		if (!file) {
+			std::cerr << "cannot open " << argv[i] << std::endl;
+			return EXIT_FAILURE;
+		}
+		while (std::getline(file, line)) summary.add(line);
+	}
+	if (summary.routes.empty()) {
+		std::cerr << "no records (" << summary.malformed << " malformed line(s))" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// the busiest routes first
+	std::vector<std::pair<std::string, route_summary*>> routes;
+	route_summary all;
+	for (auto& [name, route] : summary.routes) {
+		routes.emplace_back(name, &route);
+		all.add(route);
+	}
+	std::stable_sort(routes.begin(), routes.end(),
+		[](const auto& a, const auto& b) {
+			return a.second->latencies.size() > b.second->latencies.size();
+		});
+
+	double seconds = (summary.last_ts - summary.first_ts) / 1e6;
+	std::cout << all.latencies.size() << " record(s) in " << std::fixed
+		<< std::setprecision(1) << seconds << "s";
+	if (seconds > 0)
+		std::cout << " (" << all.latencies.size() / seconds << "/s)";
+	if (summary.malformed > 0)
+		std::cout << ", " << summary.malformed << " malformed line(s)";
+	std::cout << "\n\n";
+
+	std::cout << std::left << std::setw(28) << "route" << std::right
+		<< std::setw(9) << "requests"
+		<< std::setw(8) << "1xx" << std::setw(8) << "2xx" << std::setw(8) << "3xx"
+		<< std::setw(8) << "4xx" << std::setw(8) << "5xx"
+		<< std::setw(10) << "mean ms" << std::setw(10) << "p50 ms"
+		<< std::setw(10) << "p99 ms" << std::setw(10) << "p99.9 ms"
+		<< std::setw(10) << "max ms" << std::setw(10) << "db ms"
+		<< std::setw(8) << "db %"
+		<< std::setw(10) << "in B" << std::setw(10) << "out B" << '\n';
+	for (auto& [name, route] : routes)
+		print_row(name, *route);
+	if (routes.size() > 1) print_row("(all)", all);
+	return EXIT_SUCCESS;
+}